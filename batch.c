@@ -0,0 +1,458 @@
+/**
+ * Batch Conversion
+ *
+ * Converts many input files in one process. Each file is one task on the
+ * thread pool, and is converted start to finish on a single worker; with
+ * lots of small files, that keeps every worker busy without any of the
+ * per-file parallelism overhead. Each worker keeps its buffers from one file
+ * to the next.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "growbuf.h"
+#include "convert.h"
+#include "input.h"
+#include "layout.h"
+#include "threadpool.h"
+#include "tsv.h"
+#include "batch.h"
+
+#define DEBUG if (false)
+
+//
+// Output is buffered up to this much per worker before being written.
+//
+#define BATCH_OUTPUT_SIZE (64 * 1024)
+
+//
+// Buffers a worker reuses for each file it converts.
+//
+typedef struct
+{
+    growbuf* field_lengths;
+    growbuf* out;
+} batch_worker;
+
+typedef struct
+{
+    const char* const*       inputs;
+    char**                   paths;     // output file for each input
+    const tsv_batch_options* options;
+    tsv_threadpool*          pool;
+    batch_worker*            workers;   // one per pool worker, plus one for the caller
+    int*                     results;
+} batch_job;
+
+typedef struct
+{
+    batch_job* job;
+    size_t     index;
+} batch_file;
+
+//
+// An output path, and which input it's for, for finding ones which collide.
+//
+typedef struct
+{
+    const char* path;
+    size_t      index;
+} batch_output;
+
+/**
+ * Build the name of the output file for an input: its base name, with any
+ * extension replaced by the output format's, in the output directory.
+ *
+ * Args:
+ *  output_dir  - output directory
+ *  input       - input file name
+ *  extension   - extension for the output format, including its dot
+ *
+ * Returns:
+ *  The output file name, which the caller must free, or NULL on failure.
+ */
+static char* output_path(const char* output_dir, const char* input, const char* extension)
+{
+    const char* base = strrchr(input, '/');
+    base = (NULL == base) ? input : base + 1;
+
+    const char* ext = strrchr(base, '.');
+    size_t base_len = (NULL == ext || ext == base) ? strlen(base) : (size_t)(ext - base);
+
+    size_t dir_len = strlen(output_dir);
+    while (dir_len > 1 && '/' == output_dir[dir_len - 1]) {
+        dir_len--;
+    }
+
+    char* path = (char*)malloc(dir_len + 1 + base_len + strlen(extension) + 1);
+    if (NULL == path) {
+        return NULL;
+    }
+
+    sprintf(path, "%.*s/%.*s%s", (int)dir_len, output_dir, (int)base_len, base, extension);
+    return path;
+}
+
+/**
+ * qsort() comparator for batch_outputs: by path, then by input.
+ */
+static int compare_outputs(const void* a, const void* b)
+{
+    const batch_output* x = (const batch_output*)a;
+    const batch_output* y = (const batch_output*)b;
+    int                 c = strcmp(x->path, y->path);
+
+    if (0 != c) {
+        return c;
+    }
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+/**
+ * Fail every input whose output path is also another input's; different
+ * directories can have files of the same base name, and so can different
+ * extensions. They'd all be written at once to the same file.
+ *
+ * Args:
+ *  inputs      - names of the files to convert
+ *  paths       - output file for each of them
+ *  num_inputs  - number of files
+ *  results     - set to -EEXIST for each one which collides
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+static int check_output_paths(const char* const* inputs, char* const* paths, size_t num_inputs, int* results)
+{
+    batch_output* outputs = (batch_output*)malloc(num_inputs * sizeof(batch_output));
+
+    if (NULL == outputs) {
+        return -ENOMEM;
+    }
+
+    for (size_t i = 0; i < num_inputs; i++) {
+        outputs[i].path  = paths[i];
+        outputs[i].index = i;
+    }
+
+    qsort(outputs, num_inputs, sizeof(batch_output), compare_outputs);
+
+    for (size_t i = 0; i < num_inputs; ) {
+        size_t end = i + 1;
+
+        while (end < num_inputs && 0 == strcmp(outputs[i].path, outputs[end].path)) {
+            end++;
+        }
+
+        if (end - i > 1) {
+            for (size_t j = i; j < end; j++) {
+                fprintf(stderr, "%s: Error: %s is also the output for %s\n",
+                        inputs[outputs[j].index], outputs[j].path, inputs[outputs[(j == i) ? i + 1 : i].index]);
+                results[outputs[j].index] = -EEXIST;
+            }
+        }
+
+        i = end;
+    }
+
+    free(outputs);
+    return 0;
+}
+
+/**
+ * Convert one file.
+ *
+ * Args:
+ *  options - batch options
+ *  input   - name of the file to convert
+ *  path    - name of the file to write
+ *  worker  - buffers to use
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success. Failures have already been
+ *  reported on stderr.
+ */
+static int convert_file(const tsv_batch_options* options, const char* filename, const char* path, batch_worker* worker)
+{
+    tsv_input*     input      = NULL;
+    tsv_writer*    writer     = NULL;
+    tsv_filter*    filter     = NULL;
+    int            output     = -1;
+    const char*    doing      = NULL;
+    const growbuf* field_lengths;
+    size_t         num_fields;
+    off_t          startpos;
+    struct stat    input_stat;
+    struct stat    output_stat;
+    int            result;
+
+    doing = "opening input";
+    input = tsv_input_open(filename, options->use_mmap);
+    if (NULL == input || 0 != stat(filename, &input_stat)) {
+        result = -errno;
+        goto cleanup;
+    }
+
+    tsv_input_set_stats(input, options->stats);
+
+    doing = "reading input";
+    if (options->tab_width > 0) {
+        result = tsv_input_set_tab_width(input, options->tab_width);
+        if (0 != result) {
+            goto cleanup;
+        }
+    }
+
+    result = (options->start_line > 1) ? tsv_input_seek_line(input, options->start_line - 1) : 0;
+    if (0 != result) {
+        goto cleanup;
+    }
+    startpos = tsv_input_tell(input);
+
+    if (NULL != options->layout) {
+        field_lengths = options->layout->field_lengths;
+        num_fields    = options->layout->num_fields;
+    }
+    else {
+        worker->field_lengths->size = 0;
+        num_fields = tsv_get_field_lengths(input, worker->field_lengths, startpos, NULL);
+        if (0 == num_fields) {
+            result = -ENOMEM;
+            goto cleanup;
+        }
+        field_lengths = worker->field_lengths;
+    }
+
+    size_t first_line_no = options->start_line;
+
+    if (options->num_where > 0) {
+        size_t bad;
+
+        doing = "filtering rows";
+        result = tsv_create_filter(options->where, options->num_where, input, (const size_t*)field_lengths->buf, num_fields, startpos, &filter, &bad);
+        if (0 != result) {
+            goto cleanup;
+        }
+    }
+
+    doing = "selecting columns";
+    result = tsv_create_writer(options->format, options->columns, input, (const size_t*)field_lengths->buf, num_fields, &startpos, &writer);
+    if (0 != result) {
+        goto cleanup;
+    }
+    if (NULL != writer && writer->skip_header) {
+        first_line_no++;
+    }
+
+    //
+    // Don't truncate the output until it's known not to be the input, which
+    // could be mapped, and would be lost either way.
+    //
+    doing = "creating output";
+    output = open(path, O_WRONLY | O_CREAT, 0666);
+    if (-1 == output || 0 != fstat(output, &output_stat)) {
+        result = -errno;
+        goto cleanup;
+    }
+
+    if (output_stat.st_dev == input_stat.st_dev && output_stat.st_ino == input_stat.st_ino) {
+        fprintf(stderr, "%s: Error: the output %s is the input file\n", filename, path);
+        doing  = NULL;
+        result = -EEXIST;
+        goto cleanup;
+    }
+
+    if (0 != ftruncate(output, 0)) {
+        result = -errno;
+        goto cleanup;
+    }
+
+    tsv_convert_options convert_options = {
+        .pool          = NULL,
+        .on_violation  = options->on_violation,
+        .first_line_no = first_line_no,
+        .messages      = stderr,
+        .source        = filename,
+        .scratch       = worker->out,
+        .stats         = options->stats,
+        .writer        = writer,
+        .filter        = filter,
+    };
+    tsv_sink sink = { .fd = output };
+
+    doing = "converting";
+    result = tsv_convert(input, field_lengths, num_fields, startpos, &convert_options, &sink);
+    if (0 != result) {
+        goto cleanup;
+    }
+
+    doing = "writing output";
+    if (0 != close(output)) {
+        result = -errno;
+    }
+    output = -1;
+
+cleanup:
+    if (0 != result && -EILSEQ != result && NULL != doing) {
+        // -EILSEQ has already been reported by tsv_convert(), and anything
+        // without a doing has been reported here
+        fprintf(stderr, "%s: Error %s: %s\n", filename, doing, strerror(-result));
+    }
+
+    if (-1 != output) {
+        close(output);
+    }
+
+    tsv_writer_free(writer);
+    tsv_filter_free(filter);
+    tsv_input_close(input);
+
+    //
+    // Don't let one huge file pin a huge buffer for the rest of the batch.
+    //
+    if (worker->out->allocated_size > BATCH_OUTPUT_SIZE * 16) {
+        growbuf* out = growbuf_create(BATCH_OUTPUT_SIZE);
+        if (NULL != out) {
+            growbuf_free(worker->out);
+            worker->out = out;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Convert one file of a batch. Runs on a worker thread.
+ *
+ * Args:
+ *  arg - the batch_file to convert
+ */
+static void batch_file_run(void* arg)
+{
+    batch_file* file = (batch_file*)arg;
+    batch_job*  job  = file->job;
+    size_t      self = (NULL == job->pool) ? 0 : tsv_threadpool_current_worker(job->pool);
+
+    job->results[file->index] = convert_file(job->options, job->inputs[file->index], job->paths[file->index], &job->workers[self]);
+}
+
+/**
+ * Convert a batch of files, each to a .csv (or other format) file of the same
+ * base name in options->output_dir.
+ *
+ * Args:
+ *  inputs      - names of the files to convert
+ *  num_inputs  - number of files
+ *  options     - how to convert them
+ *  pool        - thread pool to convert on, or NULL to convert them one
+ *                after another on this thread
+ *  results     - array of num_inputs to fill in with each file's result:
+ *                -1 * an errno.h error number, 0 on success
+ *
+ * Returns:
+ *  The number of files which failed. Each failure is also reported on
+ *  stderr as it happens.
+ */
+size_t tsv_batch_convert(const char* const* inputs, size_t num_inputs, const tsv_batch_options* options, tsv_threadpool* pool, int* results)
+{
+    size_t       num_workers = (NULL == pool) ? 1 : pool->num_threads + 1;
+    batch_file*  files       = NULL;
+    size_t       failures    = 0;
+    batch_job    job = {
+        .inputs  = inputs,
+        .options = options,
+        .pool    = pool,
+        .results = results,
+    };
+
+    job.workers = (batch_worker*)calloc(num_workers, sizeof(batch_worker));
+    job.paths   = (char**)calloc(num_inputs, sizeof(char*));
+    files       = (batch_file*)malloc(num_inputs * sizeof(batch_file));
+    if (NULL == job.workers || NULL == job.paths || NULL == files) {
+        goto nomem;
+    }
+
+    //
+    // Every output path is known before anything is written, so inputs which
+    // would write the same file can be failed instead of racing each other.
+    //
+    for (size_t i = 0; i < num_inputs; i++) {
+        results[i]   = 0;
+        job.paths[i] = output_path(options->output_dir, inputs[i], tsv_format_extension(options->format));
+        if (NULL == job.paths[i]) {
+            goto nomem;
+        }
+    }
+
+    if (0 != check_output_paths(inputs, job.paths, num_inputs, results)) {
+        goto nomem;
+    }
+
+    for (size_t i = 0; i < num_workers; i++) {
+        job.workers[i].field_lengths = growbuf_create(10 * sizeof(size_t));
+        job.workers[i].out           = growbuf_create(BATCH_OUTPUT_SIZE);
+        if (NULL == job.workers[i].field_lengths || NULL == job.workers[i].out) {
+            goto nomem;
+        }
+    }
+
+    for (size_t i = 0; i < num_inputs; i++) {
+        files[i].job   = &job;
+        files[i].index = i;
+
+        if (0 != results[i]) {
+            continue;
+        }
+
+        if (NULL == pool || 0 != tsv_threadpool_submit(pool, batch_file_run, &files[i])) {
+            batch_file_run(&files[i]);
+        }
+    }
+
+    if (NULL != pool) {
+        tsv_threadpool_wait(pool);
+    }
+
+    for (size_t i = 0; i < num_inputs; i++) {
+        if (0 != results[i]) {
+            failures++;
+        }
+    }
+
+    goto cleanup;
+
+nomem:
+    fprintf(stderr, "malloc failed\n");
+    for (size_t i = 0; i < num_inputs; i++) {
+        results[i] = -ENOMEM;
+    }
+    failures = num_inputs;
+
+cleanup:
+    if (NULL != job.workers) {
+        for (size_t i = 0; i < num_workers; i++) {
+            growbuf_free(job.workers[i].field_lengths);
+            growbuf_free(job.workers[i].out);
+        }
+    }
+
+    if (NULL != job.paths) {
+        for (size_t i = 0; i < num_inputs; i++) {
+            free(job.paths[i]);
+        }
+    }
+
+    free(job.workers);
+    free(job.paths);
+    free(files);
+    return failures;
+}
@@ -0,0 +1,33 @@
+/**
+ * Batch Conversion
+ *
+ * Converts many input files in one process, spread over a thread pool.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+
+#include "convert.h"
+#include "layout.h"
+#include "threadpool.h"
+
+typedef struct
+{
+    const char*          output_dir;    // where to write <input name>.csv (or other format) files
+    tsv_format           format;
+    const char*          columns;       // columns to write, for tsv_parse_columns(), or NULL for all
+    const char* const*   where;         // --where specs rows must match; see filter.c
+    size_t               num_where;
+    int                  tab_width;     // 0 to leave tabs alone
+    size_t               start_line;    // 1-based
+    bool                 use_mmap;
+    const tsv_layout*    layout;        // NULL to detect each file's columns
+    tsv_violation_policy on_violation;
+    tsv_stats*           stats;         // where to count all the files' I/O, or NULL
+} tsv_batch_options;
+
+size_t tsv_batch_convert(const char* const* inputs, size_t num_inputs, const tsv_batch_options* options, tsv_threadpool* pool, int* results);
+
+#endif //BATCH_H
@@ -0,0 +1,39 @@
+#!/bin/sh
+#
+# Generate the benchmark datasets (if they aren't already there) and run the
+# per-phase harness on each. Results go to stdout as JSON lines.
+#
+# Environment:
+#  BENCH_ROWS       rows per dataset (default 200000)
+#  BENCH_REPEAT     runs per phase; the best is reported (default 3)
+#  BENCH_THREADS    threads for the end_to_end phase (default 1)
+#  BENCH_LABEL      label for this build (default: git describe)
+#
+
+set -e
+
+dir=$(dirname "$0")
+rows=${BENCH_ROWS:-200000}
+repeat=${BENCH_REPEAT:-3}
+threads=${BENCH_THREADS:-1}
+label=${BENCH_LABEL:-$(git -C "$dir" describe --always --dirty 2>/dev/null || echo unlabeled)}
+
+mkdir -p "$dir/data"
+
+dataset() {
+    name=$1
+    shift
+    file="$dir/data/$name-$rows.tsv"
+    if [ ! -f "$file" ]; then
+        "$dir/tsvgen" --rows "$rows" "$@" > "$file.tmp"
+        mv "$file.tmp" "$file"
+    fi
+    "$dir/tsvbench" --label "$label" --repeat "$repeat" --threads "$threads" "$file"
+}
+
+dataset plain   --cols 8  --width 12
+dataset tabs    --cols 8  --width 12 --tab-density 0.5
+dataset ragged  --cols 8  --width 12 --ragged 0.2
+dataset quoted  --cols 8  --width 12 --quotes 0.3
+dataset wide    --cols 40 --width 10
+dataset mixed   --cols 8  --widths 4,12,30,6,18
@@ -0,0 +1,377 @@
+/**
+ * Per-Phase Benchmark Harness
+ *
+ * Times each phase of a conversion separately on one input file, and
+ * reports each as a JSON object on its own line:
+ *
+ *  {"label":..., "dataset":..., "phase":..., "bytes":..., "rows":...,
+ *   "seconds":..., "mb_per_s":..., "rows_per_s":...}
+ *
+ * usage: tsvbench [--label L] [--repeat N] [--threads N] input-file
+ *
+ * Phases:
+ *  line_index      - finding the lines of the input
+ *  tab_expansion   - expanding tabs on every line
+ *  detection       - finding the columns (on the tab-expanded input)
+ *  extraction      - splitting every line into fields
+ *  csv_encoding    - splitting and encoding every line as CSV
+ *  end_to_end      - the whole conversion through libtsv, to nowhere
+ *
+ * Each phase is run --repeat times, and the fastest run is reported.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sysexits.h>
+
+#include "growbuf.h"
+#include "convert.h"
+#include "input.h"
+#include "lineindex.h"
+#include "libtsv.h"
+#include "tsv.h"
+
+#define TAB_WIDTH 8
+
+typedef struct
+{
+    const char*          data;
+    size_t               size;
+    const tsv_lineindex* lines;
+    const size_t*        field_lengths;
+    size_t               num_fields;
+    size_t               num_threads;
+    growbuf*             scratch;
+} bench_input;
+
+typedef int (*phase_fn)(const bench_input* in);
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int phase_line_index(const bench_input* in)
+{
+    tsv_lineindex* index = tsv_lineindex_create();
+    if (NULL == index) {
+        return -ENOMEM;
+    }
+
+    int result = tsv_lineindex_build(index, in->data, in->size);
+    tsv_lineindex_free(index);
+    return result;
+}
+
+static int phase_tab_expansion(const bench_input* in)
+{
+    tsv_linecursor cursor;
+    uint64_t       offset;
+    size_t         len;
+
+    tsv_linecursor_init(&cursor, in->lines, 0);
+    while (tsv_linecursor_next(&cursor, &offset, &len)) {
+        if (NULL == tsv_expand_tabs(in->data + offset, len, TAB_WIDTH, in->scratch, &len)) {
+            return -ENOMEM;
+        }
+    }
+
+    return 0;
+}
+
+static int phase_detection(const bench_input* in)
+{
+    tsv_input* input         = tsv_input_open_buffer(in->data, in->size);
+    growbuf*   field_lengths = growbuf_create(16 * sizeof(size_t));
+    int        result        = 0;
+
+    if (NULL == input || NULL == field_lengths) {
+        result = -ENOMEM;
+    }
+    else if (0 == tsv_get_field_lengths(input, field_lengths, 0, NULL)) {
+        result = -ENOMEM;
+    }
+
+    growbuf_free(field_lengths);
+    tsv_input_close(input);
+    return result;
+}
+
+static int phase_extraction(const bench_input* in)
+{
+    tsv_field*     fields = (tsv_field*)malloc(in->num_fields * sizeof(tsv_field));
+    tsv_linecursor cursor;
+    uint64_t       offset;
+    size_t         len;
+    size_t         total  = 0;
+
+    if (NULL == fields) {
+        return -ENOMEM;
+    }
+
+    tsv_linecursor_init(&cursor, in->lines, 0);
+    while (tsv_linecursor_next(&cursor, &offset, &len)) {
+        tsv_split_line(in->data + offset, len, in->field_lengths, in->num_fields, TSV_VIOLATION_IGNORE, fields);
+        total += fields[0].len;
+    }
+
+    free(fields);
+
+    // keep the loop from being optimized away
+    return (total == (size_t)-1) ? -EINVAL : 0;
+}
+
+static int phase_csv_encoding(const bench_input* in)
+{
+    tsv_linecursor cursor;
+    uint64_t       offset;
+    size_t         len;
+
+    in->scratch->size = 0;
+
+    tsv_linecursor_init(&cursor, in->lines, 0);
+    while (tsv_linecursor_next(&cursor, &offset, &len)) {
+        int result = tsv_convert_line(in->data + offset, len, in->field_lengths, in->num_fields, TSV_VIOLATION_IGNORE, NULL, NULL, in->scratch);
+        if (result < 0) {
+            return result;
+        }
+
+        if (in->scratch->size > 1024 * 1024) {
+            in->scratch->size = 0;
+        }
+    }
+
+    return 0;
+}
+
+static int discard(void* arg, const char* data, size_t len)
+{
+    return 0;
+}
+
+static int phase_end_to_end(const bench_input* in)
+{
+    tsv_context_options options = {
+        .tab_width   = TAB_WIDTH,
+        .start_line  = 1,
+        .num_threads = in->num_threads,
+    };
+    tsv_sink sink = { .write = discard };
+
+    tsv_context* ctx = tsv_context_open_buffer(in->data, in->size, &options);
+    if (NULL == ctx) {
+        return -errno;
+    }
+
+    int result = tsv_context_encode(ctx, &sink);
+    tsv_context_free(ctx);
+    return result;
+}
+
+/**
+ * Run a phase repeatedly and print its best time. The bytes reported are
+ * those of the input the phase runs on, raw or tab-expanded.
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+static int run_phase(const char* label, const char* dataset, const char* phase, phase_fn fn,
+        const bench_input* in, size_t rows, int repeat)
+{
+    size_t bytes = in->size;
+    double best = -1;
+
+    for (int i = 0; i < repeat; i++) {
+        double start  = now();
+        int    result = fn(in);
+        double took   = now() - start;
+
+        if (0 != result) {
+            fprintf(stderr, "%s failed: %s\n", phase, strerror(-result));
+            return result;
+        }
+
+        if (best < 0 || took < best) {
+            best = took;
+        }
+    }
+
+    if (best <= 0) {
+        best = 1e-9;
+    }
+
+    printf("{\"label\":\"%s\",\"dataset\":\"%s\",\"phase\":\"%s\",\"bytes\":%zu,\"rows\":%zu,"
+           "\"seconds\":%.6f,\"mb_per_s\":%.1f,\"rows_per_s\":%.0f}\n",
+           label, dataset, phase, bytes, rows, best, (double)bytes / best / 1e6, (double)rows / best);
+    return 0;
+}
+
+/**
+ * Read a whole file into memory.
+ */
+static char* read_file(const char* filename, size_t* size)
+{
+    FILE* file = fopen(filename, "rb");
+    if (NULL == file) {
+        return NULL;
+    }
+
+    growbuf* buf = growbuf_create(1024 * 1024);
+    char     chunk[65536];
+    size_t   n;
+
+    while (NULL != buf && 0 < (n = fread(chunk, 1, sizeof(chunk), file))) {
+        if (0 != growbuf_append(buf, chunk, n)) {
+            growbuf_free(buf);
+            buf = NULL;
+        }
+    }
+    fclose(file);
+
+    if (NULL == buf) {
+        return NULL;
+    }
+
+    char* data = (char*)buf->buf;
+    *size = buf->size;
+    free(buf);  // just the growbuf; the data lives on
+    return data;
+}
+
+int main(int argc, char** argv)
+{
+    const char* label       = "unlabeled";
+    const char* filename    = NULL;
+    int         repeat      = 3;
+    size_t      num_threads = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp("--label", argv[i]) && i + 1 < argc) {
+            label = argv[++i];
+        }
+        else if (0 == strcmp("--repeat", argv[i]) && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+        }
+        else if (0 == strcmp("--threads", argv[i]) && i + 1 < argc) {
+            num_threads = (size_t)atoi(argv[++i]);
+        }
+        else if (NULL == filename && '-' != argv[i][0]) {
+            filename = argv[i];
+        }
+        else {
+            filename = NULL;
+            break;
+        }
+    }
+
+    if (NULL == filename || repeat < 1) {
+        fprintf(stderr, "usage: tsvbench [--label L] [--repeat N] [--threads N] input-file\n");
+        return EX_USAGE;
+    }
+
+    const char* dataset = strrchr(filename, '/');
+    dataset = (NULL == dataset) ? filename : dataset + 1;
+
+    size_t size;
+    char*  data = read_file(filename, &size);
+    if (NULL == data) {
+        perror(filename);
+        return EX_NOINPUT;
+    }
+
+    //
+    // Set up the raw input, then a tab-expanded copy of it, and its layout,
+    // for the phases which come after those.
+    //
+
+    tsv_lineindex* raw_lines      = tsv_lineindex_create();
+    tsv_lineindex* expanded_lines = tsv_lineindex_create();
+    growbuf*       expanded       = growbuf_create(size + 1);
+    growbuf*       scratch        = growbuf_create(1024 * 1024);
+    growbuf*       field_lengths  = growbuf_create(16 * sizeof(size_t));
+    tsv_input*     input          = NULL;
+
+    if (NULL == raw_lines || NULL == expanded_lines || NULL == expanded || NULL == scratch || NULL == field_lengths
+            || 0 != tsv_lineindex_build(raw_lines, data, size))
+    {
+        fprintf(stderr, "malloc failed\n");
+        return EX_OSERR;
+    }
+
+    tsv_linecursor cursor;
+    uint64_t       offset;
+    size_t         len;
+
+    tsv_linecursor_init(&cursor, raw_lines, 0);
+    while (tsv_linecursor_next(&cursor, &offset, &len)) {
+        const char* line = tsv_expand_tabs(data + offset, len, TAB_WIDTH, scratch, &len);
+        if (NULL == line || 0 != growbuf_append(expanded, line, len) || 0 != growbuf_append_byte(expanded, '\n')) {
+            fprintf(stderr, "malloc failed\n");
+            return EX_OSERR;
+        }
+    }
+
+    input = tsv_input_open_buffer((const char*)expanded->buf, expanded->size);
+    if (NULL == input
+            || 0 != tsv_lineindex_build(expanded_lines, (const char*)expanded->buf, expanded->size)
+            || 0 == tsv_get_field_lengths(input, field_lengths, 0, NULL))
+    {
+        fprintf(stderr, "malloc failed\n");
+        return EX_OSERR;
+    }
+
+    bench_input raw = {
+        .data        = data,
+        .size        = size,
+        .lines       = raw_lines,
+        .num_threads = num_threads,
+        .scratch     = scratch,
+    };
+    bench_input exp = {
+        .data          = (const char*)expanded->buf,
+        .size          = expanded->size,
+        .lines         = expanded_lines,
+        .field_lengths = (const size_t*)field_lengths->buf,
+        .num_fields    = growbuf_num_elems(field_lengths, size_t),
+        .num_threads   = num_threads,
+        .scratch       = scratch,
+    };
+    size_t rows = raw_lines->num_lines;
+
+    int result = run_phase(label, dataset, "line_index", phase_line_index, &raw, rows, repeat);
+    if (0 == result) {
+        result = run_phase(label, dataset, "tab_expansion", phase_tab_expansion, &raw, rows, repeat);
+    }
+    if (0 == result) {
+        result = run_phase(label, dataset, "detection", phase_detection, &exp, rows, repeat);
+    }
+    if (0 == result) {
+        result = run_phase(label, dataset, "extraction", phase_extraction, &exp, rows, repeat);
+    }
+    if (0 == result) {
+        result = run_phase(label, dataset, "csv_encoding", phase_csv_encoding, &exp, rows, repeat);
+    }
+    if (0 == result) {
+        result = run_phase(label, dataset, "end_to_end", phase_end_to_end, &raw, rows, repeat);
+    }
+
+    tsv_input_close(input);
+    tsv_lineindex_free(raw_lines);
+    tsv_lineindex_free(expanded_lines);
+    growbuf_free(expanded);
+    growbuf_free(scratch);
+    growbuf_free(field_lengths);
+    free(data);
+
+    return (0 == result) ? EX_OK : EX_SOFTWARE;
+}
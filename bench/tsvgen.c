@@ -0,0 +1,214 @@
+/**
+ * Synthetic Fixed-Width Table Generator
+ *
+ * Writes a table of aligned columns to stdout, for benchmarking.
+ *
+ * usage: tsvgen [--rows N] [--cols N] [--width N] [--widths N,N,...]
+ *               [--tab-density P] [--ragged P] [--quotes P] [--seed N]
+ *
+ * --width sets every column's width. --widths sets each column's width in
+ * turn, repeating the list for columns past its end.
+ *
+ * Probabilities (P) are from 0 to 1:
+ *  --tab-density   fraction of column gaps written with tabs (8 wide)
+ *                  instead of spaces, where a tab fits
+ *  --ragged        fraction of rows cut short after a random column
+ *  --quotes        fraction of cells with an embedded comma or quote
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sysexits.h>
+
+#define TAB_WIDTH  8
+#define MAX_WIDTHS 256
+
+//
+// xorshift64*; deterministic for a given seed, unlike rand().
+//
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint64_t rng_next(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+static bool chance(double p)
+{
+    return (double)(rng_next() >> 11) / (double)(1ULL << 53) < p;
+}
+
+static size_t below(size_t n)
+{
+    return (0 == n) ? 0 : (size_t)(rng_next() % n);
+}
+
+/**
+ * Write one cell's text, at most max_len long, and return its length.
+ * Cells are words of lowercase letters separated by single spaces, so they
+ * never line up into a false column boundary for long.
+ */
+static size_t write_cell(size_t max_len, double quotes)
+{
+    size_t len = 1 + below(max_len);
+
+    for (size_t i = 0; i < len; i++) {
+        int c = 'a' + (int)below(26);
+        if (i > 0 && i + 1 < len && 0 == below(6)) {
+            c = ' ';
+        }
+        putchar(c);
+    }
+
+    if (len < max_len && chance(quotes)) {
+        putchar(chance(0.5) ? ',' : '"');
+        len++;
+    }
+
+    return len;
+}
+
+/**
+ * Pad from column pos to column target, with tabs where they fit if
+ * use_tabs is set, and spaces otherwise.
+ */
+static void write_gap(size_t pos, size_t target, bool use_tabs)
+{
+    if (use_tabs) {
+        for (size_t stop = (pos / TAB_WIDTH + 1) * TAB_WIDTH; stop <= target; stop += TAB_WIDTH) {
+            putchar('\t');
+            pos = stop;
+        }
+    }
+
+    for (; pos < target; pos++) {
+        putchar(' ');
+    }
+}
+
+static bool parse_arg(int argc, char** argv, int* i, const char* name, double* value)
+{
+    if (0 != strcmp(name, argv[*i])) {
+        return false;
+    }
+
+    if (*i + 1 == argc) {
+        fprintf(stderr, "the %s flag requires an argument.\n", name);
+        exit(EX_USAGE);
+    }
+
+    *value = atof(argv[++*i]);
+    return true;
+}
+
+/**
+ * Parse a comma-separated list of column widths into widths.
+ *
+ * Returns:
+ *  The number of widths, or 0 if the list is empty, too long, or has a
+ *  width under 3.
+ */
+static size_t parse_widths(const char* list, size_t* widths)
+{
+    size_t num_widths = 0;
+
+    while (num_widths < MAX_WIDTHS) {
+        char* end;
+        long  width = strtol(list, &end, 10);
+        if (end == list || width < 3) {
+            return 0;
+        }
+
+        widths[num_widths++] = (size_t)width;
+        if ('\0' == *end) {
+            return num_widths;
+        }
+        if (',' != *end) {
+            return 0;
+        }
+        list = end + 1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    double rows        = 100000;
+    double cols        = 8;
+    double width       = 12;
+    double tab_density = 0;
+    double ragged      = 0;
+    double quotes      = 0;
+    double seed        = 1;
+    size_t widths[MAX_WIDTHS];
+    size_t num_widths  = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp("--widths", argv[i]) && i + 1 < argc) {
+            num_widths = parse_widths(argv[++i], widths);
+            if (0 == num_widths) {
+                fprintf(stderr, "--widths takes up to %d comma-separated widths of at least 3.\n",
+                        MAX_WIDTHS);
+                return EX_USAGE;
+            }
+        } else if (!parse_arg(argc, argv, &i, "--rows", &rows)
+                && !parse_arg(argc, argv, &i, "--cols", &cols)
+                && !parse_arg(argc, argv, &i, "--width", &width)
+                && !parse_arg(argc, argv, &i, "--tab-density", &tab_density)
+                && !parse_arg(argc, argv, &i, "--ragged", &ragged)
+                && !parse_arg(argc, argv, &i, "--quotes", &quotes)
+                && !parse_arg(argc, argv, &i, "--seed", &seed))
+        {
+            fprintf(stderr, "usage: tsvgen [--rows N] [--cols N] [--width N] [--widths N,N,...]\n"
+                            "              [--tab-density P] [--ragged P] [--quotes P] [--seed N]\n");
+            return EX_USAGE;
+        }
+    }
+
+    if (rows < 1 || cols < 1 || width < 3) {
+        fprintf(stderr, "need at least 1 row, 1 column, and a width of 3.\n");
+        return EX_USAGE;
+    }
+
+    if (0 == num_widths) {
+        widths[num_widths++] = (size_t)width;
+    }
+
+    rng_state ^= (uint64_t)seed * 0x9E3779B97F4A7C15ULL;
+
+    for (size_t row = 0; row < (size_t)rows; row++) {
+        size_t num_cols = (size_t)cols;
+        if (row > 0 && chance(ragged)) {
+            num_cols = 1 + below(num_cols);
+        }
+
+        size_t pos   = 0;
+        size_t start = 0;
+        for (size_t col = 0; col < num_cols; col++) {
+            size_t col_width = widths[col % num_widths];
+
+            //
+            // Leave at least two spaces before the next column, so words in
+            // a cell never merge with the next one.
+            //
+            pos = start + write_cell(col_width - 2, quotes);
+
+            if (col + 1 < num_cols) {
+                write_gap(pos, start + col_width, chance(tab_density));
+            }
+            start += col_width;
+        }
+        putchar('\n');
+    }
+
+    return EX_OK;
+}
@@ -0,0 +1,1216 @@
+/**
+ * TSV to CSV Conversion
+ *
+ * Slices each line of the input into fields according to a layout found by
+ * tsv_get_field_lengths(), and writes them out as CSV or another format
+ * (see writer.h).
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "growbuf.h"
+#include "csvformat.h"
+#include "input.h"
+#include "lineindex.h"
+#include "threadpool.h"
+#include "convert.h"
+#include "writebehind.h"
+
+#define DEBUG if (false)
+
+//
+// Output is written out whenever this much has been converted.
+//
+#define OUTPUT_FLUSH_SIZE (256 * 1024)
+
+//
+// Buffers of output in flight with options->write_behind: one being filled,
+// and the rest waiting to be written.
+//
+#define WRITE_BEHIND_BUFFERS 3
+
+//
+// options->checkpoint is called after about this much output.
+//
+#define CHECKPOINT_INTERVAL (64 * 1024 * 1024)
+
+//
+// Most finished chunks to write out with one writev() call.
+//
+#define MAX_WRITEV_CHUNKS 64
+
+//
+// Number of lines each worker converts at a time.
+//
+#define CONVERT_CHUNK_LINES 16384
+
+//
+// Rows which don't fit the layout are reported individually up to this many;
+// after that, only the total is.
+//
+#define MAX_VIOLATION_WARNINGS 10
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  chunk_done;
+} convert_job;
+
+typedef struct {
+    convert_job*         job;
+    const char*          data;
+    const tsv_lineindex* lines;
+    size_t               first_line;
+    size_t               end_line;
+    int                  tab_width;
+    const size_t*        field_lengths;
+    size_t               num_fields;
+    tsv_violation_policy on_violation;
+    const tsv_filter*    filter;
+    const tsv_writer*    writer;
+    growbuf*             out;
+    size_t               rows;
+    size_t               violations;
+    size_t               violation_lines[MAX_VIOLATION_WARNINGS];
+    int                  result;
+    bool                 done;
+} convert_chunk;
+
+/**
+ * Trim the whitespace off the start and end of a field, by narrowing it.
+ *
+ * Args:
+ *  field   - start of the field; moved past any leading whitespace
+ *  length  - length of the field; shortened to exclude the whitespace
+ */
+static void trim(const char** field, size_t* length)
+{
+    const char* start = *field;
+    const char* end   = start + *length;
+
+    while (start < end && ' ' == *start) {
+        start++;
+    }
+
+    while (end > start && ' ' == end[-1]) {
+        end--;
+    }
+
+    *field  = start;
+    *length = end - start;
+}
+
+//
+// Where splitting a line into fields has got to.
+//
+typedef struct
+{
+    size_t pos;         // where the next field starts on the line
+    size_t boundary;    // where the layout says the last field ended
+    bool   violated;
+} field_splitter;
+
+/**
+ * Slice the next field off a line, untrimmed.
+ *
+ * A row doesn't fit the layout if it has a non-space character in the
+ * column where a field should end. Under TSV_VIOLATION_WIDEN, that field is
+ * extended to the next space, and the following field starts after it.
+ * Otherwise the row is sliced at the layout's boundaries.
+ *
+ * Args:
+ *  line            - line being split
+ *  len             - length of the line
+ *  field_length    - length of this field in the layout; 0 for the last
+ *  policy          - what to do if the row doesn't fit the layout. Rows are
+ *                    only checked if this isn't TSV_VIOLATION_IGNORE.
+ *  split           - progress so far; updated
+ *  field           - where to put the start of the field
+ *  field_len       - where to put the length of the field
+ */
+static inline void slice_field(const char* line, size_t len, size_t field_length, tsv_violation_policy policy,
+        field_splitter* split, const char** field, size_t* field_len)
+{
+    size_t end;
+
+    if (0 == field_length) {
+        //
+        // 0 is a special case, it means "read to end of line".
+        //
+        end = len;
+    }
+    else {
+        split->boundary += field_length;
+
+        //
+        // Lines shorter than the layout get empty trailing fields.
+        //
+        end = (split->boundary < len) ? split->boundary : len;
+
+        if (TSV_VIOLATION_IGNORE != policy
+                && split->boundary <= len && split->boundary > split->pos
+                && ' ' != line[split->boundary - 1])
+        {
+            split->violated = true;
+
+            if (TSV_VIOLATION_WIDEN == policy) {
+                while (end < len && ' ' != line[end - 1]) {
+                    end++;
+                }
+            }
+        }
+    }
+
+    if (end < split->pos) {
+        // an earlier field was widened over this one
+        end = split->pos;
+    }
+
+    *field     = line + split->pos;
+    *field_len = end - split->pos;
+    split->pos = end;
+}
+
+/**
+ * Slice the next field off a line, trimmed of whitespace. See slice_field().
+ */
+static inline void split_field(const char* line, size_t len, size_t field_length, tsv_violation_policy policy,
+        field_splitter* split, const char** field, size_t* field_len)
+{
+    slice_field(line, len, field_length, policy, split, field, field_len);
+
+    DEBUG fprintf(stderr, "got %zu bytes: ", *field_len);
+    DEBUG fwrite(*field, 1, *field_len, stderr);
+
+    trim(field, field_len);
+}
+
+/**
+ * Split one line into fields.
+ *
+ * The fields are slices of the line, trimmed of whitespace, so they're only
+ * valid as long as the line is.
+ *
+ * Args:
+ *  line            - line to split (without its newline)
+ *  len             - length of the line
+ *  field_lengths   - lengths of the fields; the last one is 0
+ *  num_fields      - number of fields
+ *  policy          - what to do if the row doesn't fit the layout; see
+ *                    tsv_convert_line()
+ *  fields          - array of num_fields to fill in
+ *
+ * Returns:
+ *  0, or TSV_ROW_VIOLATION if the row didn't fit the layout.
+ */
+int tsv_split_line(const char* line, size_t len, const size_t* field_lengths, size_t num_fields, tsv_violation_policy policy, tsv_field* fields)
+{
+    field_splitter split = { 0 };
+
+    for (size_t i = 0; i < num_fields; i++) {
+        split_field(line, len, field_lengths[i], policy, &split, &fields[i].data, &fields[i].len);
+    }
+
+    return split.violated ? TSV_ROW_VIOLATION : 0;
+}
+
+/**
+ * Test whether a line matches a filter.
+ *
+ * Only the fields the predicates are on are trimmed; the ones before them
+ * are just stepped over, and testing stops at the first which fails.
+ *
+ * Args:
+ *  line            - line to test
+ *  len             - length of the line
+ *  field_lengths   - lengths of the fields; the last one is 0
+ *  policy          - what to do if the row doesn't fit the layout, so the
+ *                    fields tested are the ones which would be written
+ *  filter          - the filter
+ *
+ * Returns:
+ *  true if every predicate matches.
+ */
+static bool filter_row(const char* line, size_t len, const size_t* field_lengths, tsv_violation_policy policy, const tsv_filter* filter)
+{
+    field_splitter split     = { 0 };
+    size_t         next      = 0;   // field which split is at
+    const char*    field     = NULL;
+    size_t         field_len = 0;
+
+    for (size_t i = 0; i < filter->num_predicates; i++) {
+        const tsv_predicate* predicate = &filter->predicates[i];
+
+        //
+        // They're in column order, so one on an earlier column is on the
+        // same one as the last.
+        //
+        if (predicate->column >= next) {
+            for (; next < predicate->column; next++) {
+                slice_field(line, len, field_lengths[next], policy, &split, &field, &field_len);
+            }
+
+            split_field(line, len, field_lengths[next], policy, &split, &field, &field_len);
+            next++;
+        }
+
+        if (!tsv_predicate_match(predicate, field, field_len)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Convert one line to a row of only the writer's columns.
+ *
+ * Fields before each column are stepped over by their boundaries, without
+ * being trimmed or encoded, and nothing past the last column is looked at,
+ * so a row only counts as not fitting the layout if it's over a boundary
+ * up to there. Columns in ascending order take one pass over the line; one
+ * which comes before the last starts the split over.
+ *
+ * Args:
+ *  as for tsv_convert_line()
+ */
+static int convert_columns(const char* line, size_t len, const size_t* field_lengths, tsv_violation_policy policy, const tsv_writer* writer, growbuf* out)
+{
+    field_splitter split = { 0 };
+    size_t         next  = 0;   // field which split is at
+    const char*    field;
+    size_t         field_len;
+
+    for (size_t i = 0; i < writer->num_fields; i++) {
+        size_t column = writer->columns[i];
+
+        if (column < next) {
+            split.pos      = 0;
+            split.boundary = 0;
+            next           = 0;
+        }
+
+        for (; next < column; next++) {
+            slice_field(line, len, field_lengths[next], policy, &split, &field, &field_len);
+        }
+
+        split_field(line, len, field_lengths[next], policy, &split, &field, &field_len);
+        next++;
+
+        int result = tsv_writer_field(writer, i, writer->num_fields, field, field_len, out);
+        if (0 != result) {
+            return result;
+        }
+    }
+
+    return split.violated ? TSV_ROW_VIOLATION : 0;
+}
+
+/**
+ * Convert one line to a row of the output format.
+ *
+ * Fields are handled as slices of the line, so this doesn't allocate
+ * anything beyond growing out.
+ *
+ * A row doesn't fit the layout if it has a non-space character in the
+ * column where a field should end. Under TSV_VIOLATION_WIDEN, that field is
+ * extended to the next space, and the following field starts after it.
+ * Otherwise the row is sliced at the layout's boundaries.
+ *
+ * Args:
+ *  line            - line to convert (without its newline)
+ *  len             - length of the line
+ *  field_lengths   - lengths of the fields; the last one is 0
+ *  num_fields      - number of fields
+ *  policy          - what to do if the row doesn't fit the layout. Rows are
+ *                    only checked if this isn't TSV_VIOLATION_IGNORE.
+ *  filter          - which rows to convert, or NULL for all of them
+ *  writer          - output format, or NULL for CSV
+ *  out             - growbuf to append the row to, including its newline
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success, TSV_ROW_VIOLATION if the
+ *  row was converted but didn't fit the layout, or TSV_ROW_FILTERED if it
+ *  didn't match the filter and wasn't converted (or checked).
+ */
+int tsv_convert_line(const char* line, size_t len, const size_t* field_lengths, size_t num_fields, tsv_violation_policy policy,
+        const tsv_filter* filter, const tsv_writer* writer, growbuf* out)
+{
+    field_splitter split = { 0 };
+
+    if (NULL != filter && !filter_row(line, len, field_lengths, policy, filter)) {
+        return TSV_ROW_FILTERED;
+    }
+
+    if (NULL != writer && NULL != writer->columns) {
+        return convert_columns(line, len, field_lengths, policy, writer, out);
+    }
+
+    for (size_t i = 0; i < num_fields; i++) {
+        const char* field;
+        size_t      field_len;
+
+        split_field(line, len, field_lengths[i], policy, &split, &field, &field_len);
+
+        int result = tsv_writer_field(writer, i, num_fields, field, field_len, out);
+        if (0 != result) {
+            return result;
+        }
+    }
+
+    return split.violated ? TSV_ROW_VIOLATION : 0;
+}
+
+/**
+ * Split the header line into fields, leaving the input just past it.
+ *
+ * Args:
+ *  input           - input to read
+ *  file_startpos   - position of the header line
+ *  field_lengths   - lengths of the fields; the last one is 0
+ *  num_fields      - number of fields
+ *  header          - array of num_fields to fill in; they're empty if there
+ *                    is no header line. Only valid until the input is read
+ *                    again.
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+static int read_header(tsv_input* input, off_t file_startpos, const size_t* field_lengths, size_t num_fields, tsv_field* header)
+{
+    const char* line;
+    size_t      len;
+    int         result;
+
+    result = tsv_input_seek(input, file_startpos);
+    if (0 != result) {
+        return result;
+    }
+
+    if (tsv_input_getline(input, &line, &len)) {
+        tsv_split_line(line, len, field_lengths, num_fields, TSV_VIOLATION_IGNORE, header);
+    }
+    else {
+        memset(header, 0, num_fields * sizeof(tsv_field));
+    }
+
+    return 0;
+}
+
+/**
+ * Create a filter from --where specs, looking up column names in the header
+ * line.
+ *
+ * Args:
+ *  where           - the specs; see filter.c. They must outlive the filter.
+ *  num_where       - number of specs
+ *  input           - input to read the header line from
+ *  field_lengths   - lengths of the fields; the last one is 0
+ *  num_fields      - number of fields
+ *  file_startpos   - position of the header line
+ *  filter          - where to put the filter, which the caller must free
+ *                    with tsv_filter_free()
+ *  bad             - where to put the index of the spec which wasn't valid,
+ *                    on -EINVAL
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success; -EINVAL if a spec isn't
+ *  valid.
+ */
+int tsv_create_filter(const char* const* where, size_t num_where, tsv_input* input, const size_t* field_lengths, size_t num_fields, off_t file_startpos, tsv_filter** filter, size_t* bad)
+{
+    tsv_field* header;
+    int        result;
+
+    *filter = NULL;
+
+    header = (tsv_field*)calloc(num_fields, sizeof(tsv_field));
+    if (NULL == header) {
+        return -ENOMEM;
+    }
+
+    result = read_header(input, file_startpos, field_lengths, num_fields, header);
+    if (0 == result) {
+        result = tsv_filter_create(where, num_where, header, num_fields, filter, bad);
+    }
+
+    free(header);
+    return result;
+}
+
+/**
+ * Create a writer for an input's output format and columns, naming the
+ * fields from the header line. Formats which don't write the header line as
+ * a row skip it.
+ *
+ * Args:
+ *  format          - output format
+ *  columns         - which columns to write, for tsv_parse_columns(), or
+ *                    NULL for all of them
+ *  input           - input to read the header line from
+ *  field_lengths   - lengths of the fields; the last one is 0
+ *  num_fields      - number of fields
+ *  file_startpos   - position of the header line; moved past it if the
+ *                    writer skips it
+ *  writer          - where to put the writer, which the caller must free
+ *                    with tsv_writer_free(). NULL for CSV of all the
+ *                    columns, which needs none.
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success; -EINVAL if columns doesn't
+ *  name columns of the table.
+ */
+int tsv_create_writer(tsv_format format, const char* columns, tsv_input* input, const size_t* field_lengths, size_t num_fields, off_t* file_startpos, tsv_writer** writer)
+{
+    tsv_field*  header   = NULL;
+    growbuf*    selected = NULL;
+    int         result;
+
+    *writer = NULL;
+    if (TSV_FORMAT_CSV == format && NULL == columns) {
+        return 0;
+    }
+
+    header   = (tsv_field*)calloc(num_fields, sizeof(tsv_field));
+    selected = growbuf_create(num_fields * sizeof(size_t));
+    if (NULL == header || NULL == selected) {
+        result = -ENOMEM;
+        goto cleanup;
+    }
+
+    result = read_header(input, *file_startpos, field_lengths, num_fields, header);
+    if (0 != result) {
+        goto cleanup;
+    }
+
+    if (NULL != columns) {
+        result = tsv_parse_columns(columns, header, num_fields, selected);
+        if (0 != result) {
+            goto cleanup;
+        }
+    }
+
+    *writer = tsv_writer_create(format, header, num_fields,
+            (NULL != columns) ? (const size_t*)selected->buf : NULL, growbuf_num_elems(selected, size_t));
+    if (NULL == *writer) {
+        result = -ENOMEM;
+        goto cleanup;
+    }
+
+    if ((*writer)->skip_header) {
+        *file_startpos = tsv_input_tell(input);
+    }
+
+cleanup:
+    free(header);
+    growbuf_free(selected);
+    return result;
+}
+
+/**
+ * Report a row which didn't fit the layout.
+ *
+ * Args:
+ *  violations  - running count of such rows; incremented
+ *  line_no     - line number of the row
+ *  options     - conversion options, for the policy and where to report to
+ */
+void tsv_report_violation(size_t* violations, size_t line_no, const tsv_convert_options* options)
+{
+    tsv_violation_policy policy = options->on_violation;
+
+    if (++*violations <= MAX_VIOLATION_WARNINGS && NULL != options->messages) {
+        fprintf(options->messages, "%s%s%s: line %zu doesn't fit the layout%s\n",
+                (NULL != options->source) ? options->source : "",
+                (NULL != options->source) ? ": " : "",
+                (TSV_VIOLATION_FAIL == policy) ? "Error" : "warning", line_no,
+                (TSV_VIOLATION_WIDEN == policy) ? "; widened its field" : "");
+    }
+}
+
+/**
+ * Report the total number of rows which didn't fit the layout, if it's more
+ * than were reported individually.
+ */
+static void report_violation_total(size_t violations, const tsv_convert_options* options)
+{
+    if (violations > MAX_VIOLATION_WARNINGS && NULL != options->messages) {
+        fprintf(options->messages, "%s%swarning: %zu lines didn't fit the layout\n",
+                (NULL != options->source) ? options->source : "",
+                (NULL != options->source) ? ": " : "",
+                violations);
+    }
+}
+
+/**
+ * Write all of a set of buffers to a sink, retrying short writes.
+ *
+ * Args:
+ *  sink    - where to write
+ *  iov     - buffers to write; modified
+ *  iovcnt  - number of buffers
+ *  stats   - stats to count the time spent writing in, or NULL
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+static int write_fully(const tsv_sink* sink, struct iovec* iov, int iovcnt, tsv_stats* stats)
+{
+    uint64_t start  = tsv_stats_clock(stats);
+    int      result = 0;
+
+    if (NULL != sink->write) {
+        for (int i = 0; i < iovcnt && 0 == result; i++) {
+            if (iov[i].iov_len > 0) {
+                result = sink->write(sink->arg, (const char*)iov[i].iov_base, iov[i].iov_len);
+            }
+        }
+        iovcnt = 0;
+    }
+
+    while (iovcnt > 0) {
+        ssize_t n = writev(sink->fd, iov, iovcnt);
+        if (n < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            result = -errno;
+            break;
+        }
+
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+
+        if (iovcnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    TSV_STATS_ADD(stats, output_ns, tsv_stats_clock(stats) - start);
+    return result;
+}
+
+/**
+ * Write out and empty a buffer of converted output.
+ *
+ * Args:
+ *  out     - buffer to write
+ *  output  - where to write it
+ *  stats   - stats to count the write in, or NULL
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+int tsv_flush_output(growbuf* out, const tsv_sink* output, tsv_stats* stats)
+{
+    struct iovec iov = { .iov_base = out->buf, .iov_len = out->size };
+
+    int result = write_fully(output, &iov, 1, stats);
+    if (0 == result) {
+        TSV_STATS_ADD(stats, bytes_written, (uint64_t)out->size);
+    }
+    out->size = 0;
+
+    return result;
+}
+
+/**
+ * Write out and empty the serial converter's output buffer, or queue it to
+ * be written behind.
+ *
+ * Args:
+ *  out     - buffer to write; replaced by an empty one if queued
+ *  wb      - write-behind to queue it on, or NULL to write it now
+ *  output  - where to write it
+ *  stats   - stats to count the write in, or NULL
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+static int flush_serial(growbuf** out, tsv_writebehind* wb, const tsv_sink* output, tsv_stats* stats)
+{
+    if (NULL != wb) {
+        return tsv_writebehind_submit(wb, out);
+    }
+
+    return tsv_flush_output(*out, output, stats);
+}
+
+/**
+ * Call the checkpoint callback, if there is one and enough has been written
+ * since it was last called.
+ *
+ * Args:
+ *  options         - conversion options
+ *  input_offset    - offset of the first line not yet written out
+ *  line_no         - line number there
+ *  written         - bytes written (or submitted to wb) so far
+ *  checkpointed    - bytes written as of the last checkpoint; updated
+ *  wb              - write-behind to wait for before checkpointing, or NULL
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+static int maybe_checkpoint(const tsv_convert_options* options, off_t input_offset, size_t line_no, uint64_t written, uint64_t* checkpointed,
+        tsv_writebehind* wb)
+{
+    if (NULL == options->checkpoint || written - *checkpointed < CHECKPOINT_INTERVAL) {
+        return 0;
+    }
+
+    if (NULL != wb) {
+        int result = tsv_writebehind_drain(wb);
+        if (0 != result) {
+            return result;
+        }
+    }
+
+    *checkpointed = written;
+    return options->checkpoint(options->checkpoint_arg, input_offset, line_no);
+}
+
+/**
+ * Write the output format's header or trailer, if it has one.
+ *
+ * Args:
+ *  begin   - true for the header, false for the trailer
+ *  options - conversion options, for the writer and stats
+ *  output  - where to write it
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+static int write_framing(bool begin, const tsv_convert_options* options, const tsv_sink* output)
+{
+    growbuf* buf;
+    int      result;
+
+    if (NULL == options->writer) {
+        return 0;
+    }
+
+    buf = growbuf_create(32);
+    if (NULL == buf) {
+        return -ENOMEM;
+    }
+
+    result = begin ? tsv_writer_begin(options->writer, buf) : tsv_writer_end(options->writer, buf);
+    if (0 == result && buf->size > 0) {
+        result = tsv_flush_output(buf, output, options->stats);
+    }
+
+    growbuf_free(buf);
+    return result;
+}
+
+/**
+ * Convert a chunk of lines. Runs on a worker thread.
+ *
+ * Args:
+ *  arg - the convert_chunk to convert; its out and result are filled in, and
+ *        done is set when finished.
+ */
+static void convert_chunk_run(void* arg)
+{
+    convert_chunk* chunk   = (convert_chunk*)arg;
+    growbuf*       scratch = NULL;
+    tsv_linecursor cursor;
+    uint64_t       offset;
+    size_t         len;
+
+    chunk->result     = 0;
+    chunk->rows       = 0;
+    chunk->violations = 0;
+
+    if (chunk->tab_width > 0) {
+        scratch = growbuf_create(512);
+        if (NULL == scratch) {
+            chunk->result = -ENOMEM;
+            goto done;
+        }
+    }
+
+    tsv_linecursor_init(&cursor, chunk->lines, chunk->first_line);
+    while (cursor.line < chunk->end_line && tsv_linecursor_next(&cursor, &offset, &len)) {
+        const char* line = chunk->data + offset;
+
+        if (chunk->tab_width > 0) {
+            line = tsv_expand_tabs(line, len, chunk->tab_width, scratch, &len);
+            if (NULL == line) {
+                chunk->result = -ENOMEM;
+                goto done;
+            }
+        }
+
+        size_t row_start = chunk->out->size;
+
+        chunk->result = tsv_convert_line(line, len, chunk->field_lengths, chunk->num_fields, chunk->on_violation, chunk->filter, chunk->writer, chunk->out);
+        if (TSV_ROW_VIOLATION == chunk->result) {
+            if (chunk->violations < MAX_VIOLATION_WARNINGS) {
+                chunk->violation_lines[chunk->violations] = cursor.line;    // already advanced, so 1-based
+            }
+            chunk->violations++;
+
+            if (TSV_VIOLATION_FAIL == chunk->on_violation) {
+                chunk->out->size = row_start;
+                chunk->result = -EILSEQ;
+                goto done;
+            }
+            chunk->result = 0;
+        }
+        else if (TSV_ROW_FILTERED == chunk->result) {
+            chunk->result = 0;
+            continue;
+        }
+        else if (0 != chunk->result) {
+            goto done;
+        }
+
+        chunk->rows++;
+    }
+
+done:
+    growbuf_free(scratch);
+
+    pthread_mutex_lock(&chunk->job->lock);
+    chunk->done = true;
+    pthread_cond_broadcast(&chunk->job->chunk_done);
+    pthread_mutex_unlock(&chunk->job->lock);
+}
+
+/**
+ * Find the line to stop converting an in-memory input at.
+ *
+ * Args:
+ *  lines   - the input's line index
+ *  options - conversion options
+ *
+ * Returns:
+ *  The 0-based number of the first line not to convert.
+ */
+static size_t end_line_of(const tsv_lineindex* lines, const tsv_convert_options* options)
+{
+    if (0 == options->end_offset) {
+        return lines->num_lines;
+    }
+
+    return tsv_lineindex_lookup(lines, (uint64_t)options->end_offset);
+}
+
+/**
+ * Convert an in-memory input on a thread pool.
+ *
+ * The lines are split into chunks which are converted in parallel, while
+ * this thread writes the finished chunks out in order, gathering any that
+ * are ready into one writev(). At most two chunks per thread are in flight
+ * at once, which bounds the memory used.
+ *
+ * Args:
+ *  input           - in-memory input, positioned at the first line to convert
+ *  field_lengths   - lengths of the fields
+ *  num_fields      - number of fields
+ *  options         - conversion options; pool must be set
+ *  output          - where to write the output
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+static int parallel_convert(tsv_input* input, const size_t* field_lengths, size_t num_fields, const tsv_convert_options* options, const tsv_sink* output)
+{
+    tsv_threadpool*      pool       = options->pool;
+    const tsv_lineindex* lines      = tsv_input_lines(input);
+    size_t               first_line = tsv_lineindex_lookup(lines, tsv_input_tell(input));
+    size_t               last_line  = end_line_of(lines, options);
+    size_t               num_chunks = (last_line - first_line + CONVERT_CHUNK_LINES - 1) / CONVERT_CHUNK_LINES;
+    size_t               window     = 2 * pool->num_threads;
+    convert_chunk*       slots      = NULL;
+    convert_job          job;
+    size_t               violations = 0;
+    uint64_t             written    = 0;
+    uint64_t             checkpointed = 0;
+    int                  result     = 0;
+
+    if (!options->continuing) {
+        result = write_framing(true, options, output);
+        if (0 != result) {
+            return result;
+        }
+    }
+
+    slots = (convert_chunk*)calloc(window, sizeof(convert_chunk));
+    if (NULL == slots) {
+        return -ENOMEM;
+    }
+
+    for (size_t i = 0; i < window; i++) {
+        slots[i].out = growbuf_create(OUTPUT_FLUSH_SIZE);
+        if (NULL == slots[i].out) {
+            result = -ENOMEM;
+            goto cleanup;
+        }
+    }
+
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.chunk_done, NULL);
+
+    DEBUG fprintf(stderr, "converting lines %zu-%zu in %zu chunks\n", first_line, last_line, num_chunks);
+
+    size_t next_submit = 0;
+    size_t next_write  = 0;
+    while (next_write < num_chunks) {
+
+        //
+        // keep the window full
+        //
+        while (next_submit < num_chunks && next_submit < next_write + window) {
+            convert_chunk* chunk = &slots[next_submit % window];
+
+            chunk->job           = &job;
+            chunk->data          = input->data;
+            chunk->lines         = lines;
+            chunk->first_line    = first_line + next_submit * CONVERT_CHUNK_LINES;
+            chunk->end_line      = chunk->first_line + CONVERT_CHUNK_LINES;
+            if (chunk->end_line > last_line) {
+                chunk->end_line = last_line;
+            }
+            chunk->tab_width     = input->tab_width;
+            chunk->field_lengths = field_lengths;
+            chunk->num_fields    = num_fields;
+            chunk->on_violation  = options->on_violation;
+            chunk->filter        = options->filter;
+            chunk->writer        = options->writer;
+            chunk->out->size     = 0;
+            chunk->done          = false;
+
+            if (0 != tsv_threadpool_submit(pool, convert_chunk_run, chunk)) {
+                //
+                // couldn't queue it; do it here instead
+                //
+                convert_chunk_run(chunk);
+            }
+            next_submit++;
+        }
+
+        //
+        // wait for the next chunk in order, then write it out along with
+        // any chunks after it which are also done
+        //
+        struct iovec iov[MAX_WRITEV_CHUNKS];
+        int          iovcnt = 0;
+        uint64_t     bytes  = 0;
+        uint64_t     rows   = 0;
+
+        pthread_mutex_lock(&job.lock);
+        while (!slots[next_write % window].done) {
+            pthread_cond_wait(&job.chunk_done, &job.lock);
+        }
+        for (size_t i = next_write; i < next_submit && iovcnt < MAX_WRITEV_CHUNKS; i++) {
+            convert_chunk* chunk = &slots[i % window];
+            if (!chunk->done) {
+                break;
+            }
+
+            for (size_t j = 0; j < chunk->violations; j++) {
+                if (j < MAX_VIOLATION_WARNINGS) {
+                    tsv_report_violation(&violations, chunk->violation_lines[j], options);
+                }
+                else {
+                    violations++;
+                }
+            }
+
+            //
+            // A chunk which hit a row that doesn't fit still has the rows
+            // before it to write out.
+            //
+            if (0 == chunk->result || -EILSEQ == chunk->result) {
+                iov[iovcnt].iov_base = chunk->out->buf;
+                iov[iovcnt].iov_len  = chunk->out->size;
+                iovcnt++;
+
+                bytes += chunk->out->size;
+                rows  += chunk->rows;
+            }
+
+            if (0 != chunk->result) {
+                result = chunk->result;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&job.lock);
+
+        int write_result = write_fully(output, iov, iovcnt, options->stats);
+        if (0 != write_result) {
+            result = write_result;
+        }
+        else {
+            TSV_STATS_ADD(options->stats, bytes_written, bytes);
+            TSV_STATS_ADD(options->stats, rows, rows);
+        }
+
+        if (0 != result) {
+            break;
+        }
+
+        next_write += iovcnt;
+
+        //
+        // Everything up to the end of the last chunk written is out, and
+        // line numbers are 1-based.
+        //
+        size_t end_line = first_line + next_write * CONVERT_CHUNK_LINES;
+        if (end_line > last_line) {
+            end_line = last_line;
+        }
+
+        written += bytes;
+        result = maybe_checkpoint(options, (off_t)tsv_lineindex_offset(lines, end_line), end_line + 1, written, &checkpointed, NULL);
+        if (0 != result) {
+            break;
+        }
+    }
+
+    report_violation_total(violations, options);
+
+    if (0 == result) {
+        result = write_framing(false, options, output);
+    }
+
+    //
+    // let anything still in flight finish before tearing down
+    //
+    tsv_threadpool_wait(pool);
+
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.chunk_done);
+
+cleanup:
+    for (size_t i = 0; i < window; i++) {
+        growbuf_free(slots[i].out);
+    }
+    free(slots);
+
+    return result;
+}
+
+/**
+ * Write the header line as a row, unfiltered, for formats which write it as
+ * one.
+ *
+ * Args:
+ *  input           - input, at the header line; left just past it
+ *  field_lengths   - lengths of the fields
+ *  num_fields      - number of fields
+ *  options         - conversion options
+ *  output          - where to write the row
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+static int write_header_row(tsv_input* input, const size_t* field_lengths, size_t num_fields, const tsv_convert_options* options, const tsv_sink* output)
+{
+    const char* line;
+    size_t      len;
+    growbuf*    row;
+    int         result = 0;
+
+    if (!tsv_input_getline(input, &line, &len)) {
+        return 0;
+    }
+
+    row = growbuf_create(len + num_fields + 2);
+    if (NULL == row) {
+        return -ENOMEM;
+    }
+
+    //
+    // It's sliced like any other row, but not held to the layout.
+    //
+    result = tsv_convert_line(line, len, field_lengths, num_fields, options->on_violation, NULL, options->writer, row);
+    if (TSV_ROW_VIOLATION == result) {
+        result = 0;
+    }
+
+    if (0 == result) {
+        TSV_STATS_ADD(options->stats, rows, 1);
+        result = tsv_flush_output(row, output, options->stats);
+    }
+
+    growbuf_free(row);
+    return result;
+}
+
+/**
+ * Convert an input to CSV, or the format of options->writer.
+ *
+ * Rows which don't fit the layout are handled according to
+ * options->on_violation, and reported to options->messages.
+ *
+ * Args:
+ *  input           - input to convert
+ *  field_lengths   - lengths of the fields (as size_t), from
+ *                    tsv_get_field_lengths()
+ *  num_fields      - number of fields
+ *  file_startpos   - position in the input where TSV data starts
+ *  options         - conversion options. With a thread pool, in-memory
+ *                    inputs are converted in parallel; either way, the
+ *                    output is the same.
+ *  output          - where to write the output
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success. -ENOMEM means the conversion
+ *  itself failed, and -EILSEQ means a row didn't fit the layout under
+ *  TSV_VIOLATION_FAIL; anything else is an I/O error, reading the input if
+ *  tsv_input_error() says so, otherwise writing the output.
+ */
+int tsv_convert(tsv_input* input, const growbuf* field_lengths, size_t num_fields, off_t file_startpos, const tsv_convert_options* options, const tsv_sink* output)
+{
+    const size_t*        lengths    = (const size_t*)field_lengths->buf;
+    const tsv_lineindex* lines      = tsv_input_lines(input);
+    growbuf*             out        = NULL;
+    tsv_writebehind*     wb         = NULL;
+    size_t               line_no    = options->first_line_no;
+    size_t               violations = 0;
+    uint64_t             rows       = 0;
+    uint64_t             written    = 0;
+    uint64_t             checkpointed = 0;
+    const char*          line;
+    size_t               len;
+    int                  result;
+
+    result = tsv_input_seek(input, file_startpos);
+    if (0 != result) {
+        return result;
+    }
+
+    //
+    // When the header line is written as a row, it names the columns, so
+    // the filter doesn't apply to it. It's also written on its own when the
+    // table starts partway into it (past a form feed), since the rest is
+    // converted in whole lines.
+    //
+    bool whole_line = (NULL == lines
+            || tsv_lineindex_offset(lines, tsv_lineindex_lookup(lines, file_startpos)) == (uint64_t)file_startpos);
+
+    if ((NULL != options->filter || !whole_line) && (NULL == options->writer || !options->writer->skip_header)
+            && !options->continuing)
+    {
+        result = write_header_row(input, lengths, num_fields, options, output);
+        if (0 != result) {
+            return result;
+        }
+        line_no++;
+    }
+
+    if (NULL != options->pool && NULL != lines
+            && end_line_of(lines, options) - tsv_lineindex_lookup(lines, tsv_input_tell(input)) > CONVERT_CHUNK_LINES)
+    {
+        return parallel_convert(input, lengths, num_fields, options, output);
+    }
+
+    if (options->write_behind) {
+        wb = tsv_writebehind_create(output, options->stats, OUTPUT_FLUSH_SIZE, WRITE_BEHIND_BUFFERS);
+        if (NULL == wb) {
+            return -ENOMEM;
+        }
+        out = tsv_writebehind_buffer(wb);
+    }
+    else if (NULL != options->scratch) {
+        out = options->scratch;
+        out->size = 0;
+    }
+    else {
+        out = growbuf_create(OUTPUT_FLUSH_SIZE);
+        if (NULL == out) {
+            return -ENOMEM;
+        }
+    }
+
+    if (!options->continuing) {
+        result = tsv_writer_begin(options->writer, out);
+        if (0 != result) {
+            goto cleanup;
+        }
+    }
+
+    for (; (0 == options->end_offset || tsv_input_tell(input) < options->end_offset)
+                && tsv_input_getline(input, &line, &len); line_no++)
+    {
+        size_t row_start = out->size;
+
+        result = tsv_convert_line(line, len, lengths, num_fields, options->on_violation, options->filter, options->writer, out);
+        if (TSV_ROW_VIOLATION == result) {
+            tsv_report_violation(&violations, line_no, options);
+
+            if (TSV_VIOLATION_FAIL == options->on_violation) {
+                out->size = row_start;
+                flush_serial(&out, wb, output, options->stats);
+                result = -EILSEQ;
+                goto cleanup;
+            }
+            result = 0;
+        }
+        else if (TSV_ROW_FILTERED == result) {
+            result = 0;
+            continue;
+        }
+
+        if (0 == result) {
+            rows++;
+
+            if (out->size >= OUTPUT_FLUSH_SIZE) {
+                written += out->size;
+                result = flush_serial(&out, wb, output, options->stats);
+
+                if (0 == result) {
+                    result = maybe_checkpoint(options, tsv_input_tell(input), line_no + 1, written, &checkpointed, wb);
+                }
+            }
+        }
+
+        if (0 != result) {
+            goto cleanup;
+        }
+    }
+
+    //
+    // If reading failed partway, write out what there is, but no trailer.
+    //
+    int read_result = tsv_input_error(input);
+    if (0 == read_result) {
+        result = tsv_writer_end(options->writer, out);
+    }
+    if (0 == result) {
+        result = flush_serial(&out, wb, output, options->stats);
+    }
+    if (0 == result) {
+        result = read_result;
+    }
+
+cleanup:
+    TSV_STATS_ADD(options->stats, rows, rows);
+    report_violation_total(violations, options);
+    if (NULL != wb) {
+        int wb_result = tsv_writebehind_free(wb);
+        if (0 == result) {
+            result = wb_result;
+        }
+    }
+    else if (out != options->scratch) {
+        growbuf_free(out);
+    }
+    return result;
+}
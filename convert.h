@@ -0,0 +1,64 @@
+/**
+ * TSV to CSV Conversion
+ *
+ * Slices each line of the input into fields according to a layout found by
+ * tsv_get_field_lengths(), and writes them out as CSV.
+ */
+
+#ifndef CONVERT_H
+#define CONVERT_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "growbuf.h"
+#include "input.h"
+#include "stats.h"
+#include "threadpool.h"
+#include "filter.h"
+#include "writer.h"
+#include "libtsv.h"   // tsv_violation_policy, tsv_sink
+
+//
+// tsv_convert_line() return value for a row which didn't fit the layout.
+//
+#define TSV_ROW_VIOLATION 1
+
+//
+// tsv_convert_line() return value for a row which didn't match the filter.
+//
+#define TSV_ROW_FILTERED 2
+
+typedef struct
+{
+    tsv_threadpool*      pool;          // NULL to convert on this thread
+    tsv_violation_policy on_violation;
+    size_t               first_line_no; // line number of file_startpos
+    FILE*                messages;      // where to report rows which don't fit; NULL for nowhere
+    const char*          source;        // name to prefix those reports with, or NULL
+    growbuf*             scratch;       // output buffer to reuse, or NULL to allocate one
+    tsv_stats*           stats;         // where to count rows and output, or NULL
+    const tsv_writer*    writer;        // output format, or NULL for CSV
+    const tsv_filter*    filter;        // which rows to write, or NULL for all
+    bool                 continuing;    // the output is being carried on from a checkpoint, so
+                                        // already has the format's header and the header row
+    int                (*checkpoint)(void* arg, off_t input_offset, size_t line_no);
+                                        // called every so often once everything before
+                                        // input_offset is written; returns -1 * an errno.h
+                                        // error number, or 0. NULL for none.
+    void*                checkpoint_arg;
+    bool                 write_behind;  // write output on another thread while converting, when
+                                        // not converting in parallel (which already does)
+    off_t                end_offset;    // where to stop converting, or 0 to go on to EOF
+} tsv_convert_options;
+
+int tsv_split_line(const char* line, size_t len, const size_t* field_lengths, size_t num_fields, tsv_violation_policy policy, tsv_field* fields);
+int tsv_convert_line(const char* line, size_t len, const size_t* field_lengths, size_t num_fields, tsv_violation_policy policy,
+        const tsv_filter* filter, const tsv_writer* writer, growbuf* out);
+int tsv_create_filter(const char* const* where, size_t num_where, tsv_input* input, const size_t* field_lengths, size_t num_fields, off_t file_startpos, tsv_filter** filter, size_t* bad);
+int tsv_create_writer(tsv_format format, const char* columns, tsv_input* input, const size_t* field_lengths, size_t num_fields, off_t* file_startpos, tsv_writer** writer);
+void tsv_report_violation(size_t* violations, size_t line_no, const tsv_convert_options* options);
+int tsv_flush_output(growbuf* out, const tsv_sink* output, tsv_stats* stats);
+int tsv_convert(tsv_input* input, const growbuf* field_lengths, size_t num_fields, off_t file_startpos, const tsv_convert_options* options, const tsv_sink* output);
+
+#endif //CONVERT_H
@@ -10,6 +10,10 @@
 #include <unistd.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "growbuf.h"
 #include "csvformat.h"
 
@@ -17,56 +21,97 @@
 #define DEBUG if (false)
 
 /**
- * same as strchr() except it looks for multiple characters.
+ * Find the first character in a field which means it has to be quoted: a
+ * comma, double-quote, CR or LF.
  *
  * Arguments:
- *   haystack	- string to be searched
- *   chars	- characters to search for
- *   nchars	- number of characters in chars
+ *   field	- field to search
+ *   len	- length of the field
  *
  * Return Value:
- *   Pointer to the first one of chars in haystack, or NULL if none found.
+ *   Pointer to the first such character, or NULL if there are none.
  */
-const char* strchrs(const char* haystack, const char* chars, size_t nchars)
+const char* csv_find_special(const char* field, size_t len)
 {
-    const char* end = haystack + strlen(haystack);
-    while (haystack < end) {
-        for (size_t i = 0; i < nchars; i++) {
-            if (*haystack == chars[i]) {
-                return haystack;
-            }
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i cr    = _mm_set1_epi8('\r');
+    const __m128i lf    = _mm_set1_epi8('\n');
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(field + i));
+        __m128i found = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(bytes, comma), _mm_cmpeq_epi8(bytes, quote)),
+                _mm_or_si128(_mm_cmpeq_epi8(bytes, cr), _mm_cmpeq_epi8(bytes, lf)));
+
+        int mask = _mm_movemask_epi8(found);
+        if (0 != mask) {
+            return field + i + __builtin_ctz(mask);
+        }
+    }
+#endif
+
+    for (; i < len; i++) {
+        switch (field[i]) {
+        case ',':
+        case '"':
+        case '\r':
+        case '\n':
+            return field + i;
         }
-	haystack++;
     }
 
     return NULL;
 }
 
 /**
- * Print a CSV field, with appropriate double-quotes.
+ * Append a CSV field to a buffer, with appropriate double-quotes.
  *
- * No double-quotes are used, unless the field contains a comma, or a newline.
+ * No double-quotes are used, unless the field contains a comma, a
+ * double-quote, or a line break (RFC 4180). The field doesn't need to be
+ * null-terminated. Runs of characters which don't need escaping are copied
+ * in bulk.
  *
  * Arguments:
- *   field	- field to print
- *   output	- file pointer to print to
+ *   field	- field to append
+ *   len	- length of the field
+ *   output	- growbuf to append to
+ *
+ * Return Value:
+ *   -1 * an errno.h error number. 0 on success.
  */
-void print_csv_field(const char* field, FILE* output)
+int append_csv_field(const char* field, size_t len, growbuf* output)
 {
-    if (NULL != strchrs(field, ",\n", 2)) {
-        fprintf(output, "\"");
-        for (size_t i = 0; i < strlen(field); i++) {
-            if (field[i] == '"') {
-                fprintf(output, "\"\"");
-            }
-            else {
-                fprintf(output, "%c", field[i]);
-            }
+    const char* special = csv_find_special(field, len);
+    int         result;
+
+    if (NULL == special) {
+        return growbuf_append(output, field, len);
+    }
+
+    const char* end = field + len;
+
+    result = growbuf_append_byte(output, '"');
+    while (0 == result && field < end) {
+        //
+        // nothing before special needs escaping; after it, only quotes do
+        //
+        const char* quote = memchr(special, '"', end - special);
+        const char* stop  = (NULL == quote) ? end : quote + 1;
+
+        result = growbuf_append(output, field, stop - field);
+        if (0 == result && NULL != quote) {
+            result = growbuf_append_byte(output, '"');
         }
-        fprintf(output, "\"");
+
+        field = special = stop;
     }
-    else {
-        fprintf(output, "%s", field);
+    if (0 == result) {
+        result = growbuf_append_byte(output, '"');
     }
-}
 
+    return result;
+}
@@ -1,8 +1,9 @@
 #ifndef CSVFORMAT_H
 #define CSVFORMAT_H
 
-#include <stdio.h>
+#include "growbuf.h"
 
-void print_csv_field(const char* field, FILE* output);
+const char* csv_find_special(const char* field, size_t len);
+int append_csv_field(const char* field, size_t len, growbuf* output);
 
 #endif // CSVFORMAT_H
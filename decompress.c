@@ -0,0 +1,355 @@
+/**
+ * Decompression
+ *
+ * Recognizes compressed input by its magic bytes, and decompresses it, either
+ * all at once or a buffer at a time. gzip is always supported; zstd only when
+ * built with ZSTD=1.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+#include <zlib.h>
+#ifdef TSV_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "decompress.h"
+
+#define DEBUG if (false)
+
+//
+// Initial output size for tsv_decompress(), as a multiple of the input size.
+//
+#define EXPANSION_GUESS 4
+
+struct _tsv_decoder
+{
+    tsv_compression compression;
+    bool            ended;      // at the end of a gzip member or zstd frame
+    z_stream        zs;
+#ifdef TSV_HAVE_ZSTD
+    ZSTD_DStream*   zds;
+#endif
+};
+
+/**
+ * Find out whether data is compressed, from its first few bytes.
+ *
+ * Args:
+ *  data    - start of the data
+ *  len     - how much of it there is; TSV_COMPRESSION_MAGIC_LEN is enough
+ *
+ * Returns:
+ *  How it's compressed, or TSV_COMPRESSION_NONE.
+ */
+tsv_compression tsv_detect_compression(const char* data, size_t len)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+
+    if (len >= 2 && 0x1f == bytes[0] && 0x8b == bytes[1]) {
+        return TSV_COMPRESSION_GZIP;
+    }
+
+    if (len >= 4 && 0x28 == bytes[0] && 0xb5 == bytes[1] && 0x2f == bytes[2] && 0xfd == bytes[3]) {
+        return TSV_COMPRESSION_ZSTD;
+    }
+
+    return TSV_COMPRESSION_NONE;
+}
+
+/**
+ * Get the name of a compression format, for messages.
+ *
+ * Args:
+ *  compression - format to name
+ *
+ * Returns:
+ *  Its name.
+ */
+const char* tsv_compression_name(tsv_compression compression)
+{
+    switch (compression) {
+    case TSV_COMPRESSION_GZIP:
+        return "gzip";
+    case TSV_COMPRESSION_ZSTD:
+        return "zstd";
+    default:
+        return "none";
+    }
+}
+
+/**
+ * Start decompressing.
+ *
+ * Args:
+ *  compression - how the data is compressed
+ *
+ * Returns:
+ *  The new decoder, or NULL with errno set on failure: ENOTSUP if this build
+ *  can't decompress that format.
+ */
+tsv_decoder* tsv_decoder_create(tsv_compression compression)
+{
+    tsv_decoder* dec;
+
+    if (TSV_COMPRESSION_GZIP != compression
+#ifdef TSV_HAVE_ZSTD
+            && TSV_COMPRESSION_ZSTD != compression
+#endif
+        )
+    {
+        errno = ENOTSUP;
+        return NULL;
+    }
+
+    dec = (tsv_decoder*)calloc(1, sizeof(tsv_decoder));
+    if (NULL == dec) {
+        return NULL;
+    }
+
+    dec->compression = compression;
+
+    if (TSV_COMPRESSION_GZIP == compression) {
+        // 16 + MAX_WBITS: gzip wrapper only
+        if (Z_OK != inflateInit2(&dec->zs, 16 + MAX_WBITS)) {
+            free(dec);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+#ifdef TSV_HAVE_ZSTD
+    else {
+        dec->zds = ZSTD_createDStream();
+        if (NULL == dec->zds || ZSTD_isError(ZSTD_initDStream(dec->zds))) {
+            ZSTD_freeDStream(dec->zds);
+            free(dec);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+#endif
+
+    return dec;
+}
+
+/**
+ * Free a decoder.
+ *
+ * Args:
+ *  dec - decoder to free
+ */
+void tsv_decoder_free(tsv_decoder* dec)
+{
+    if (NULL == dec) {
+        return;
+    }
+
+    if (TSV_COMPRESSION_GZIP == dec->compression) {
+        inflateEnd(&dec->zs);
+    }
+#ifdef TSV_HAVE_ZSTD
+    else {
+        ZSTD_freeDStream(dec->zds);
+    }
+#endif
+
+    free(dec);
+}
+
+/**
+ * Decompress gzip data. Concatenated members are decompressed one after
+ * another, as gzip -d does.
+ */
+static int run_gzip(tsv_decoder* dec, const char* in, size_t in_len, size_t* consumed,
+        char* out, size_t out_size, size_t* produced)
+{
+    int result = 0;
+
+    //
+    // zlib's lengths are only 32 bits.
+    //
+    dec->zs.next_in   = (Bytef*)in;
+    dec->zs.avail_in  = (uInt)((in_len > UINT_MAX) ? UINT_MAX : in_len);
+    dec->zs.next_out  = (Bytef*)out;
+    dec->zs.avail_out = (uInt)((out_size > UINT_MAX) ? UINT_MAX : out_size);
+
+    while (dec->zs.avail_out > 0) {
+        if (dec->ended) {
+            if (0 == dec->zs.avail_in) {
+                break;
+            }
+
+            // another member follows
+            inflateReset(&dec->zs);
+            dec->ended = false;
+        }
+
+        int ret = inflate(&dec->zs, Z_NO_FLUSH);
+        if (Z_STREAM_END == ret) {
+            dec->ended = true;
+        }
+        else if (Z_BUF_ERROR == ret) {
+            // needs more input
+            break;
+        }
+        else if (Z_OK != ret) {
+            DEBUG fprintf(stderr, "inflate: %d %s\n", ret, (NULL != dec->zs.msg) ? dec->zs.msg : "");
+            result = (Z_MEM_ERROR == ret) ? -ENOMEM : -EBADMSG;
+            break;
+        }
+    }
+
+    *consumed = (const char*)dec->zs.next_in - in;
+    *produced = (char*)dec->zs.next_out - out;
+    return result;
+}
+
+#ifdef TSV_HAVE_ZSTD
+/**
+ * Decompress zstd data. Concatenated frames are decompressed one after
+ * another.
+ */
+static int run_zstd(tsv_decoder* dec, const char* in, size_t in_len, size_t* consumed,
+        char* out, size_t out_size, size_t* produced)
+{
+    ZSTD_inBuffer  input  = { .src = in, .size = in_len, .pos = 0 };
+    ZSTD_outBuffer output = { .dst = out, .size = out_size, .pos = 0 };
+    int            result = 0;
+
+    while (output.pos < output.size) {
+        size_t before = output.pos;
+
+        if (dec->ended && input.pos == input.size) {
+            break;
+        }
+
+        size_t ret = ZSTD_decompressStream(dec->zds, &output, &input);
+        if (ZSTD_isError(ret)) {
+            DEBUG fprintf(stderr, "zstd: %s\n", ZSTD_getErrorName(ret));
+            result = -EBADMSG;
+            break;
+        }
+
+        dec->ended = (0 == ret);
+
+        if (input.pos == input.size && output.pos == before) {
+            // needs more input
+            break;
+        }
+    }
+
+    *consumed = input.pos;
+    *produced = output.pos;
+    return result;
+}
+#endif
+
+/**
+ * Decompress some more of the data.
+ *
+ * Args:
+ *  dec         - decoder to use
+ *  in          - the next of the compressed data
+ *  in_len      - how much of it there is
+ *  consumed    - set to how much of it was used up. Whatever wasn't has to be
+ *                passed in again next time.
+ *  out         - buffer to decompress into
+ *  out_size    - size of the buffer
+ *  produced    - set to how many bytes were decompressed into it. This can
+ *                be 0 even with input left over, if the buffer was small.
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success. -EBADMSG if the data is
+ *  corrupt.
+ */
+int tsv_decoder_run(tsv_decoder* dec, const char* in, size_t in_len, size_t* consumed,
+        char* out, size_t out_size, size_t* produced)
+{
+#ifdef TSV_HAVE_ZSTD
+    if (TSV_COMPRESSION_ZSTD == dec->compression) {
+        return run_zstd(dec, in, in_len, consumed, out, out_size, produced);
+    }
+#endif
+
+    return run_gzip(dec, in, in_len, consumed, out, out_size, produced);
+}
+
+/**
+ * Find out whether the data decompressed so far ends cleanly, at the end of
+ * a gzip member or zstd frame. If it doesn't when the input runs out, the
+ * input was truncated.
+ *
+ * Args:
+ *  dec - decoder to query
+ *
+ * Returns:
+ *  true if it ends cleanly.
+ */
+bool tsv_decoder_at_end(const tsv_decoder* dec)
+{
+    return dec->ended;
+}
+
+/**
+ * Decompress data all at once.
+ *
+ * Args:
+ *  compression - how the data is compressed
+ *  in          - the compressed data
+ *  in_len      - its length
+ *  out         - growbuf to append the decompressed data to
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success. -EBADMSG if the data is
+ *  corrupt or truncated, and -ENOTSUP if this build can't decompress it.
+ */
+int tsv_decompress(tsv_compression compression, const char* in, size_t in_len, growbuf* out)
+{
+    tsv_decoder* dec = tsv_decoder_create(compression);
+    int          result;
+
+    if (NULL == dec) {
+        return -errno;
+    }
+
+    result = growbuf_reserve(out, (in_len < SIZE_MAX / EXPANSION_GUESS) ? in_len * EXPANSION_GUESS : in_len);
+
+    while (0 == result) {
+        size_t consumed;
+        size_t produced;
+
+        if (out->size == out->allocated_size) {
+            result = growbuf_reserve(out, out->allocated_size);
+            if (0 != result) {
+                break;
+            }
+        }
+
+        result = tsv_decoder_run(dec, in, in_len, &consumed, (char*)out->buf + out->size, out->allocated_size - out->size, &produced);
+        in       += consumed;
+        in_len   -= consumed;
+        out->size += produced;
+
+        if (0 == produced && 0 == consumed && out->size < out->allocated_size) {
+            // out of input
+            break;
+        }
+    }
+
+    if (0 == result && (0 != in_len || !tsv_decoder_at_end(dec))) {
+        result = -EBADMSG;
+    }
+
+    DEBUG fprintf(stderr, "decompressed %s data to %zu bytes: %d\n", tsv_compression_name(compression), out->size, result);
+
+    tsv_decoder_free(dec);
+    return result;
+}
@@ -0,0 +1,42 @@
+/**
+ * Decompression
+ *
+ * Recognizes compressed input by its magic bytes, and decompresses it, either
+ * all at once or a buffer at a time. gzip is always supported; zstd only when
+ * built with ZSTD=1.
+ */
+
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "growbuf.h"
+
+//
+// Enough of the start of the input to recognize any compression.
+//
+#define TSV_COMPRESSION_MAGIC_LEN 4
+
+typedef enum
+{
+    TSV_COMPRESSION_NONE,
+    TSV_COMPRESSION_GZIP,
+    TSV_COMPRESSION_ZSTD,
+} tsv_compression;
+
+typedef struct _tsv_decoder tsv_decoder;
+
+tsv_compression tsv_detect_compression(const char* data, size_t len);
+const char*     tsv_compression_name(tsv_compression compression);
+
+tsv_decoder*    tsv_decoder_create(tsv_compression compression);
+void            tsv_decoder_free(tsv_decoder* dec);
+int             tsv_decoder_run(tsv_decoder* dec, const char* in, size_t in_len, size_t* consumed,
+                        char* out, size_t out_size, size_t* produced);
+bool            tsv_decoder_at_end(const tsv_decoder* dec);
+
+int             tsv_decompress(tsv_compression compression, const char* in, size_t in_len, growbuf* out);
+
+#endif //DECOMPRESS_H
@@ -0,0 +1,295 @@
+/**
+ * Row Filters
+ *
+ * A --where spec is a column (a 1-based number or a name from the header
+ * line), optionally followed by an operator and its operand:
+ *
+ *  col         the field isn't empty
+ *  col=text    the field is text
+ *  col!=text   the field isn't text
+ *  col^=text   the field starts with text
+ *  col~regex   the field matches a POSIX extended regular expression
+ *  col<n, col<=n, col>n, col>=n
+ *              the field is a number, and compares so with n
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <regex.h>
+
+#include "growbuf.h"
+#include "filter.h"
+
+#define DEBUG if (false)
+
+//
+// Longest field which can be compared as a number.
+//
+#define MAX_NUMBER_LEN 63
+
+/**
+ * Parse a number which takes up the whole of a slice.
+ *
+ * Returns:
+ *  true if it was a number.
+ */
+static bool parse_number(const char* text, size_t len, double* number)
+{
+    char  buf[MAX_NUMBER_LEN + 1];
+    char* end;
+
+    if (0 == len || len > MAX_NUMBER_LEN) {
+        return false;
+    }
+
+    memcpy(buf, text, len);
+    buf[len] = '\0';
+
+    *number = strtod(buf, &end);
+    return (end == buf + len);
+}
+
+/**
+ * Parse one --where spec.
+ *
+ * Args:
+ *  spec        - the spec
+ *  header      - the table's header row, split into fields
+ *  num_fields  - number of fields
+ *  predicate   - where to put it
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success; -EINVAL if it's not valid.
+ */
+static int parse_predicate(const char* spec, const tsv_field* header, size_t num_fields, tsv_predicate* predicate)
+{
+    size_t      col_len = strcspn(spec, "=!^~<>");
+    const char* op      = spec + col_len;
+    size_t      op_len  = 1;
+    char*       column  = NULL;
+    growbuf*    columns = NULL;
+    int         result  = 0;
+
+    switch (op[0]) {
+    case '\0':
+        predicate->match = TSV_MATCH_NONEMPTY;
+        op_len = 0;
+        break;
+    case '=':
+        predicate->match = TSV_MATCH_EQUAL;
+        break;
+    case '~':
+        predicate->match = TSV_MATCH_REGEX;
+        break;
+    case '!':
+    case '^':
+        if ('=' != op[1]) {
+            return -EINVAL;
+        }
+        predicate->match = ('!' == op[0]) ? TSV_MATCH_NOT_EQUAL : TSV_MATCH_PREFIX;
+        op_len = 2;
+        break;
+    case '<':
+    case '>':
+        op_len = ('=' == op[1]) ? 2 : 1;
+        if ('<' == op[0]) {
+            predicate->match = (2 == op_len) ? TSV_MATCH_LESS_EQUAL : TSV_MATCH_LESS;
+        }
+        else {
+            predicate->match = (2 == op_len) ? TSV_MATCH_GREATER_EQUAL : TSV_MATCH_GREATER;
+        }
+        break;
+    }
+
+    predicate->text     = op + op_len;
+    predicate->text_len = strlen(predicate->text);
+
+    //
+    // The column is whatever tsv_parse_columns() makes of it, as long as
+    // that's one column.
+    //
+
+    column  = strndup(spec, col_len);
+    columns = growbuf_create(4 * sizeof(size_t));
+    if (NULL == column || NULL == columns) {
+        result = -ENOMEM;
+        goto cleanup;
+    }
+
+    result = tsv_parse_columns(column, header, num_fields, columns);
+    if (0 == result && 1 != growbuf_num_elems(columns, size_t)) {
+        result = -EINVAL;
+    }
+    if (0 != result) {
+        goto cleanup;
+    }
+    predicate->column = growbuf_index(columns, 0, size_t);
+
+    switch (predicate->match) {
+    case TSV_MATCH_REGEX:
+        if (0 != regcomp(&predicate->regex, predicate->text, REG_EXTENDED | REG_NOSUB)) {
+            result = -EINVAL;
+        }
+        break;
+    case TSV_MATCH_LESS:
+    case TSV_MATCH_LESS_EQUAL:
+    case TSV_MATCH_GREATER:
+    case TSV_MATCH_GREATER_EQUAL:
+        if (!parse_number(predicate->text, predicate->text_len, &predicate->number)) {
+            result = -EINVAL;
+        }
+        break;
+    default:
+        break;
+    }
+
+cleanup:
+    free(column);
+    growbuf_free(columns);
+    return result;
+}
+
+/**
+ * Order predicates by column.
+ */
+static int compare_predicates(const void* a, const void* b)
+{
+    size_t column_a = ((const tsv_predicate*)a)->column;
+    size_t column_b = ((const tsv_predicate*)b)->column;
+
+    return (column_a > column_b) - (column_a < column_b);
+}
+
+/**
+ * Create a filter from --where specs, all of which a row must match.
+ *
+ * Args:
+ *  specs       - the specs; they must outlive the filter
+ *  num_specs   - number of specs
+ *  header      - the table's header row, split into fields, to look up
+ *                column names in
+ *  num_fields  - number of fields
+ *  filter      - where to put the filter, which the caller must free with
+ *                tsv_filter_free()
+ *  bad         - where to put the index of the spec which wasn't valid, on
+ *                -EINVAL
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success; -EINVAL if a spec isn't
+ *  valid or doesn't name a column of the table.
+ */
+int tsv_filter_create(const char* const* specs, size_t num_specs, const tsv_field* header, size_t num_fields, tsv_filter** filter, size_t* bad)
+{
+    tsv_filter* f;
+    int         result = 0;
+
+    *filter = NULL;
+
+    f = (tsv_filter*)calloc(1, sizeof(tsv_filter));
+    if (NULL == f) {
+        return -ENOMEM;
+    }
+
+    f->predicates = (tsv_predicate*)calloc(num_specs, sizeof(tsv_predicate));
+    if (NULL == f->predicates) {
+        tsv_filter_free(f);
+        return -ENOMEM;
+    }
+
+    for (size_t i = 0; i < num_specs; i++) {
+        result = parse_predicate(specs[i], header, num_fields, &f->predicates[i]);
+        if (0 != result) {
+            *bad = i;
+            tsv_filter_free(f);
+            return result;
+        }
+        f->num_predicates++;
+    }
+
+    //
+    // Testing them in column order lets a row be split in one pass.
+    //
+    qsort(f->predicates, f->num_predicates, sizeof(tsv_predicate), compare_predicates);
+
+    *filter = f;
+    return 0;
+}
+
+/**
+ * Free a filter.
+ *
+ * Args:
+ *  filter  - filter to free; may be NULL
+ */
+void tsv_filter_free(tsv_filter* filter)
+{
+    if (NULL == filter) {
+        return;
+    }
+
+    for (size_t i = 0; i < filter->num_predicates; i++) {
+        if (TSV_MATCH_REGEX == filter->predicates[i].match) {
+            regfree(&filter->predicates[i].regex);
+        }
+    }
+
+    free(filter->predicates);
+    free(filter);
+}
+
+/**
+ * Test a field against a predicate.
+ *
+ * Args:
+ *  predicate   - predicate to test
+ *  field       - the field's trimmed text
+ *  len         - length of the field
+ *
+ * Returns:
+ *  true if it matches.
+ */
+bool tsv_predicate_match(const tsv_predicate* predicate, const char* field, size_t len)
+{
+    double number;
+
+    switch (predicate->match) {
+    case TSV_MATCH_NONEMPTY:
+        return (len > 0);
+
+    case TSV_MATCH_EQUAL:
+    case TSV_MATCH_NOT_EQUAL:
+        return (len == predicate->text_len && 0 == memcmp(field, predicate->text, len))
+            == (TSV_MATCH_EQUAL == predicate->match);
+
+    case TSV_MATCH_PREFIX:
+        return (len >= predicate->text_len && 0 == memcmp(field, predicate->text, predicate->text_len));
+
+    case TSV_MATCH_REGEX: {
+#ifdef REG_STARTEND
+        regmatch_t match = { .rm_so = 0, .rm_eo = (regoff_t)len };
+        return (0 == regexec(&predicate->regex, field, 1, &match, REG_STARTEND));
+#else
+        char* copy = strndup(field, len);
+        bool  found = (NULL != copy && 0 == regexec(&predicate->regex, copy, 0, NULL, 0));
+        free(copy);
+        return found;
+#endif
+    }
+
+    case TSV_MATCH_LESS:
+        return parse_number(field, len, &number) && number < predicate->number;
+    case TSV_MATCH_LESS_EQUAL:
+        return parse_number(field, len, &number) && number <= predicate->number;
+    case TSV_MATCH_GREATER:
+        return parse_number(field, len, &number) && number > predicate->number;
+    case TSV_MATCH_GREATER_EQUAL:
+        return parse_number(field, len, &number) && number >= predicate->number;
+    }
+
+    return false;
+}
@@ -0,0 +1,51 @@
+/**
+ * Row Filters
+ *
+ * Predicates on fields, for --where. They're tested against the trimmed
+ * slices of a line, before anything is encoded, so rows which don't match
+ * cost little more than finding their fields.
+ */
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <regex.h>
+
+#include "writer.h"
+
+typedef enum
+{
+    TSV_MATCH_NONEMPTY,     // col
+    TSV_MATCH_EQUAL,        // col=text
+    TSV_MATCH_NOT_EQUAL,    // col!=text
+    TSV_MATCH_PREFIX,       // col^=text
+    TSV_MATCH_REGEX,        // col~regex
+    TSV_MATCH_LESS,         // col<number
+    TSV_MATCH_LESS_EQUAL,   // col<=number
+    TSV_MATCH_GREATER,      // col>number
+    TSV_MATCH_GREATER_EQUAL,// col>=number
+} tsv_match;
+
+typedef struct
+{
+    size_t      column;     // 0-based
+    tsv_match   match;
+    const char* text;       // points into the spec it was parsed from
+    size_t      text_len;
+    double      number;
+    regex_t     regex;
+} tsv_predicate;
+
+typedef struct _tsv_filter
+{
+    tsv_predicate* predicates;      // all of which a row must match, by column
+    size_t         num_predicates;
+} tsv_filter;
+
+int  tsv_filter_create(const char* const* specs, size_t num_specs, const tsv_field* header, size_t num_fields, tsv_filter** filter, size_t* bad);
+void tsv_filter_free(tsv_filter* filter);
+bool tsv_predicate_match(const tsv_predicate* predicate, const char* field, size_t len);
+
+#endif //FILTER_H
@@ -0,0 +1,300 @@
+/**
+ * Following Growing Inputs
+ *
+ * The file is read with pread() from the saved position, and only complete
+ * lines are converted; a partial line at the end waits for the rest of it.
+ * Once the output for a batch of lines has been written, the position after
+ * them is saved, so a run which is killed repeats at most one batch.
+ *
+ * On Linux, inotify says when there's more to read. Elsewhere the file is
+ * polled once a second.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "growbuf.h"
+#include "input.h"
+#include "layout.h"
+#include "convert.h"
+#include "follow.h"
+
+#define DEBUG if (false)
+
+//
+// How much to read at once.
+//
+#define FOLLOW_READ_SIZE (1024 * 1024)
+
+//
+// State of a follow in progress.
+//
+typedef struct
+{
+    int      fd;
+    int      notify_fd;     // -1 to poll instead
+    char*    chunk;         // FOLLOW_READ_SIZE bytes to read into
+    growbuf* pending;       // bytes read but not converted yet: a partial line
+    growbuf* out;           // converted output
+    growbuf* scratch;       // tab expansion
+    size_t   violations;
+} follower;
+
+/**
+ * Wait until the file might have grown.
+ *
+ * Args:
+ *  f   - the follower
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success; -ESTALE if the file was
+ *  moved or deleted.
+ */
+static int wait_for_data(follower* f)
+{
+#ifdef __linux__
+    if (-1 != f->notify_fd) {
+        char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+        ssize_t n = read(f->notify_fd, buf, sizeof(buf));
+        if (n < 0) {
+            return (EINTR == errno) ? 0 : -errno;
+        }
+
+        for (ssize_t i = 0; i < n; ) {
+            const struct inotify_event* event = (const struct inotify_event*)(buf + i);
+            if (0 != (event->mask & (IN_MOVE_SELF | IN_DELETE_SELF))) {
+                return -ESTALE;
+            }
+            i += sizeof(struct inotify_event) + event->len;
+        }
+        return 0;
+    }
+#endif
+
+    sleep(1);
+    return 0;
+}
+
+/**
+ * Convert the complete lines at the start of the pending bytes, and drop
+ * them from it.
+ *
+ * Args:
+ *  f           - the follower
+ *  layout      - layout, with the position of the first pending byte;
+ *                moved past the lines converted
+ *  header_pos  - offset of a header line which isn't to be filtered, or -1
+ *  options     - conversion options
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success; -EILSEQ if a line didn't fit
+ *  the layout under TSV_VIOLATION_FAIL, in which case the lines before it
+ *  are still converted.
+ */
+static int convert_pending(follower* f, tsv_layout* layout, off_t header_pos, const tsv_convert_options* options)
+{
+    const char*   data    = (const char*)f->pending->buf;
+    const size_t* lengths = (const size_t*)layout->field_lengths->buf;
+    size_t        start   = 0;
+    int           result  = 0;
+
+    while (start < f->pending->size) {
+        const char* newline = (const char*)memchr(data + start, '\n', f->pending->size - start);
+        if (NULL == newline) {
+            break;
+        }
+
+        const char*       line      = data + start;
+        size_t            len       = newline - line;
+        size_t            row_start = f->out->size;
+        const tsv_filter* filter    = options->filter;
+
+        if ((off_t)layout->input_offset == header_pos) {
+            filter = NULL;
+        }
+
+        if (layout->tab_width > 0) {
+            line = tsv_expand_tabs(line, len, layout->tab_width, f->scratch, &len);
+            if (NULL == line) {
+                result = -ENOMEM;
+                break;
+            }
+        }
+
+        result = tsv_convert_line(line, len, lengths, layout->num_fields, options->on_violation, filter, options->writer, f->out);
+        if (TSV_ROW_VIOLATION == result) {
+            tsv_report_violation(&f->violations, layout->input_line, options);
+
+            if (TSV_VIOLATION_FAIL == options->on_violation) {
+                f->out->size = row_start;
+                result = -EILSEQ;
+                break;
+            }
+            result = 0;
+        }
+        else if (TSV_ROW_FILTERED == result) {
+            result = 0;
+        }
+        else if (0 != result) {
+            break;
+        }
+        else {
+            TSV_STATS_ADD(options->stats, rows, 1);
+        }
+
+        size_t consumed = newline + 1 - (data + start);
+        start                += consumed;
+        layout->input_offset += consumed;
+        layout->input_line++;
+    }
+
+    memmove(f->pending->buf, data + start, f->pending->size - start);
+    f->pending->size -= start;
+
+    return result;
+}
+
+/**
+ * Convert the lines of a file past the position in its layout, then keep
+ * converting lines as they're appended, until an error. The state file is
+ * updated after each batch of lines is written out.
+ *
+ * Args:
+ *  filename    - file to follow
+ *  state_file  - file to save the layout and position to
+ *  layout      - layout, with has_position set and the position to start
+ *                from; updated as lines are converted
+ *  header_pos  - offset of a header line which is written as a row, so
+ *                isn't to be filtered; -1 if there isn't one
+ *  options     - conversion options; pool is ignored
+ *  output      - where to write the output
+ *
+ * Returns:
+ *  -1 * an errno.h error number, as for tsv_convert(); -ESTALE if the file
+ *  was truncated, moved, or deleted. It doesn't return otherwise.
+ */
+int tsv_follow(const char* filename, const char* state_file, tsv_layout* layout, off_t header_pos,
+        const tsv_convert_options* options, const tsv_sink* output)
+{
+    follower f      = { .fd = -1, .notify_fd = -1 };
+    uint64_t read_pos;
+    int      result = 0;
+
+    f.fd = open(filename, O_RDONLY);
+    if (-1 == f.fd) {
+        return -errno;
+    }
+
+#ifdef __linux__
+    //
+    // Watch before the first read, so nothing appended after it is missed.
+    //
+    f.notify_fd = inotify_init1(IN_CLOEXEC);
+    if (-1 != f.notify_fd
+            && -1 == inotify_add_watch(f.notify_fd, filename, IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF))
+    {
+        close(f.notify_fd);
+        f.notify_fd = -1;
+    }
+#endif
+
+    f.chunk   = (char*)malloc(FOLLOW_READ_SIZE);
+    f.pending = growbuf_create(FOLLOW_READ_SIZE);
+    f.out     = growbuf_create(FOLLOW_READ_SIZE);
+    f.scratch = growbuf_create(512);
+    if (NULL == f.chunk || NULL == f.pending || NULL == f.out || NULL == f.scratch) {
+        result = -ENOMEM;
+        goto cleanup;
+    }
+
+    read_pos = layout->input_offset;
+
+    for (;;) {
+        struct stat st;
+
+        //
+        // Read and convert everything there is so far.
+        //
+        for (;;) {
+            ssize_t n = pread(f.fd, f.chunk, FOLLOW_READ_SIZE, (off_t)read_pos);
+            if (n < 0) {
+                if (EINTR == errno) {
+                    continue;
+                }
+                result = -errno;
+                goto cleanup;
+            }
+            if (0 == n) {
+                break;
+            }
+
+            TSV_STATS_ADD(options->stats, bytes_read, (uint64_t)n);
+            read_pos += n;
+
+            result = growbuf_append(f.pending, f.chunk, n);
+            if (0 == result) {
+                result = convert_pending(&f, layout, header_pos, options);
+            }
+            if (0 == result) {
+                layout->output_offset += f.out->size;
+                result = tsv_flush_output(f.out, output, options->stats);
+            }
+            if (0 == result) {
+                result = tsv_layout_save(state_file, layout);
+            }
+            if (0 != result) {
+                goto cleanup;
+            }
+        }
+
+        //
+        // A file which got shorter has been truncated or replaced; what's
+        // in it now isn't a continuation of what was converted.
+        //
+        if (0 == fstat(f.fd, &st) && (uint64_t)st.st_size < read_pos) {
+            result = -ESTALE;
+            goto cleanup;
+        }
+
+        result = wait_for_data(&f);
+        if (0 != result) {
+            goto cleanup;
+        }
+    }
+
+cleanup:
+    if (-EILSEQ == result) {
+        //
+        // Save how far it got; the lines before the bad one were written.
+        //
+        layout->output_offset += f.out->size;
+        if (0 == tsv_flush_output(f.out, output, options->stats)) {
+            tsv_layout_save(state_file, layout);
+        }
+    }
+
+    if (-1 != f.notify_fd) {
+        close(f.notify_fd);
+    }
+    close(f.fd);
+
+    free(f.chunk);
+    growbuf_free(f.pending);
+    growbuf_free(f.out);
+    growbuf_free(f.scratch);
+
+    return result;
+}
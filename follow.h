@@ -0,0 +1,19 @@
+/**
+ * Following Growing Inputs
+ *
+ * Converts the lines appended to a file as they arrive, keeping how far it
+ * has got in a state file so a later run carries on from there.
+ */
+
+#ifndef FOLLOW_H
+#define FOLLOW_H
+
+#include <sys/types.h>
+
+#include "convert.h"
+#include "layout.h"
+
+int tsv_follow(const char* filename, const char* state_file, tsv_layout* layout, off_t header_pos,
+        const tsv_convert_options* options, const tsv_sink* output);
+
+#endif //FOLLOW_H
@@ -7,17 +7,23 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <errno.h>
 
 #include "growbuf.h"
 
 /**
- * Allocation granularity setting.
+ * Smallest buffer a growbuf grows to.
  *
- * Up to this size, the growbuf grows by doubling in size each time.
- * After this size, it grows by adding a multiple of this amount.
+ * Past this, a growbuf doubles in size each time it runs out of room, so
+ * appending n bytes a few at a time costs O(n) copying in total.
  */
-#define GROWBUF_ALLOC_GRANULARITY 4096
+#define GROWBUF_MIN_SIZE 64
+
+/**
+ * Alignment of arena allocations; enough for any type we store.
+ */
+#define GROWBUF_ARENA_ALIGN 16
 
 /**
  * Create a growbuf
@@ -36,7 +42,7 @@ growbuf* growbuf_create(size_t initial_size)
     }
 
     if (initial_size > 0) {
-        gb->buf = (void*)malloc(initial_size);
+        gb->buf = (void*)calloc(1, initial_size);
         if (NULL == gb->buf) {
             free(gb);
             return NULL;
@@ -49,8 +55,6 @@ growbuf* growbuf_create(size_t initial_size)
     gb->allocated_size = initial_size;
     gb->size = 0;
 
-    memset(gb->buf, 0, initial_size);
-
     return gb;
 }
 
@@ -73,6 +77,93 @@ void growbuf_free(growbuf* gb)
     }
 }
 
+/**
+ * Make sure a growbuf has room for more data, growing it if necessary.
+ *
+ * Args:
+ *  gb          - growbuf to grow
+ *  additional  - how many bytes past its current size it needs room for
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+int growbuf_reserve(growbuf* gb, size_t additional)
+{
+    size_t newsize;
+    void*  newbuf;
+
+    if (NULL == gb) {
+        return -EINVAL;
+    }
+
+    if (additional <= gb->allocated_size - gb->size) {
+        return 0;
+    }
+
+    if (additional > SIZE_MAX - gb->size) {
+        return -ENOMEM;
+    }
+
+    newsize = (gb->allocated_size < GROWBUF_MIN_SIZE) ? GROWBUF_MIN_SIZE : gb->allocated_size;
+    while (newsize < gb->size + additional) {
+        if (newsize > SIZE_MAX / 2) {
+            newsize = gb->size + additional;
+            break;
+        }
+        newsize *= 2;
+    }
+
+    newbuf = realloc(gb->buf, newsize);
+    if (NULL == newbuf) {
+        fprintf(stderr, "GROWBUF EXPANSION FAILED\n");
+        return -ENOMEM;
+    }
+
+    gb->buf = newbuf;
+    gb->allocated_size = newsize;
+
+    return 0;
+}
+
+/**
+ * Give back whatever space a growbuf has allocated beyond its current size.
+ *
+ * Args:
+ *  gb  - growbuf to shrink
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+int growbuf_shrink_to_fit(growbuf* gb)
+{
+    void* newbuf;
+
+    if (NULL == gb) {
+        return -EINVAL;
+    }
+
+    if (gb->size == gb->allocated_size) {
+        return 0;
+    }
+
+    if (0 == gb->size) {
+        free(gb->buf);
+        gb->buf = NULL;
+        gb->allocated_size = 0;
+        return 0;
+    }
+
+    newbuf = realloc(gb->buf, gb->size);
+    if (NULL == newbuf) {
+        return -ENOMEM;
+    }
+
+    gb->buf = newbuf;
+    gb->allocated_size = gb->size;
+
+    return 0;
+}
+
 /**
  * Append to a growbuf, growing it if necessary.
  *
@@ -86,57 +177,152 @@ void growbuf_free(growbuf* gb)
  */
 int growbuf_append(growbuf* gb, const void* buf, size_t len)
 {
-    if (NULL == gb) {
-        return -EINVAL;
+    int result = growbuf_reserve(gb, len);
+    if (0 != result) {
+        return result;
     }
 
-    if (NULL == gb->buf) {
-        gb->buf = malloc(len);
-        if (NULL == gb->buf) {
-            fprintf(stderr, "GROWBUF EXPANSION FAILED\n");
-            return -ENOMEM;
-        }
-        gb->allocated_size = len;
+    if (len > 0) {
+        memcpy((char*)gb->buf + gb->size, buf, len);
+        gb->size += len;
     }
 
-    if (gb->size + len > gb->allocated_size) {
+    return 0;
+}
+
+/**
+ * Create an arena.
+ *
+ * Args:
+ *  block_size  - how much to allocate at a time. Allocations bigger than
+ *                this get a block of their own.
+ *
+ * Returns:
+ *  pointer to initialized arena, or NULL if out of memory.
+ */
+growbuf_arena* growbuf_arena_create(size_t block_size)
+{
+    growbuf_arena* arena = (growbuf_arena*)calloc(1, sizeof(growbuf_arena));
+    if (NULL == arena) {
+        return NULL;
+    }
 
-        size_t newsize;
-        void*  newbuf;
+    arena->blocks = growbuf_create(8 * sizeof(char*));
+    if (NULL == arena->blocks) {
+        free(arena);
+        return NULL;
+    }
 
-        if (gb->size + len < GROWBUF_ALLOC_GRANULARITY) {
+    arena->block_size = (block_size < GROWBUF_MIN_SIZE) ? GROWBUF_MIN_SIZE : block_size;
 
-            newsize = gb->allocated_size;
-            while (newsize < gb->size + len) {
-                newsize *= 2;
-            }
+    return arena;
+}
 
+/**
+ * Free an arena and everything allocated from it.
+ *
+ * Args:
+ *  arena   - arena to free
+ */
+void growbuf_arena_free(growbuf_arena* arena)
+{
+    if (NULL != arena) {
+        for (size_t i = 0; i < growbuf_num_elems(arena->blocks, char*); i++) {
+            free(growbuf_index(arena->blocks, i, char*));
         }
-        else {
+        growbuf_free(arena->blocks);
+        free(arena);
+    }
+}
+
+/**
+ * Free everything allocated from an arena, but keep its first block around to
+ * be reused.
+ *
+ * Args:
+ *  arena   - arena to reset
+ */
+void growbuf_arena_reset(growbuf_arena* arena)
+{
+    size_t num_blocks = growbuf_num_elems(arena->blocks, char*);
+
+    if (0 == num_blocks) {
+        return;
+    }
+
+    for (size_t i = 1; i < num_blocks; i++) {
+        free(growbuf_index(arena->blocks, i, char*));
+    }
+    arena->blocks->size = sizeof(char*);
+
+    //
+    // The first block may be an oversized one; that's fine, it's at least
+    // block_size.
+    //
+    arena->next      = growbuf_index(arena->blocks, 0, char*);
+    arena->remaining = arena->block_size;
+}
+
+/**
+ * Allocate memory from an arena. It stays valid until the arena is reset or
+ * freed.
+ *
+ * Args:
+ *  arena   - arena to allocate from
+ *  len     - number of bytes needed
+ *
+ * Returns:
+ *  pointer to the memory, aligned for any type, or NULL if out of memory.
+ */
+void* growbuf_arena_alloc(growbuf_arena* arena, size_t len)
+{
+    char*  block;
+    size_t block_len;
+
+    len = (len + GROWBUF_ARENA_ALIGN - 1) & ~(size_t)(GROWBUF_ARENA_ALIGN - 1);
 
-            newsize = (((gb->size + len) / GROWBUF_ALLOC_GRANULARITY) + 1) * GROWBUF_ALLOC_GRANULARITY;
+    if (len > arena->remaining) {
+        block_len = (len > arena->block_size) ? len : arena->block_size;
 
+        block = (char*)malloc(block_len);
+        if (NULL == block) {
+            return NULL;
         }
 
-        newbuf = realloc(gb->buf, newsize);
-        if (NULL == newbuf) {
-            fprintf(stderr, "GROWBUF EXPANSION FAILED\n");
-            return -ENOMEM;
+        if (0 != growbuf_push(arena->blocks, char*, block)) {
+            free(block);
+            return NULL;
         }
 
-        gb->buf = newbuf;
-        gb->allocated_size = newsize;
-            
+        arena->next      = block;
+        arena->remaining = block_len;
     }
 
-    memcpy((char*)gb->buf + gb->size, buf, len);
+    block = arena->next;
+    arena->next      += len;
+    arena->remaining -= len;
 
-    gb->size += len;
-
-    return 0;
+    return block;
 }
 
-int growbuf_append_byte(growbuf* gb, char byte)
+/**
+ * Copy a string into an arena.
+ *
+ * Args:
+ *  arena   - arena to allocate from
+ *  str     - string to copy
+ *  len     - its length, not counting any null terminator
+ *
+ * Returns:
+ *  the null-terminated copy, or NULL if out of memory.
+ */
+char* growbuf_arena_strndup(growbuf_arena* arena, const char* str, size_t len)
 {
-    return growbuf_append(gb, &byte, 1);
+    char* copy = (char*)growbuf_arena_alloc(arena, len + 1);
+    if (NULL != copy) {
+        memcpy(copy, str, len);
+        copy[len] = '\0';
+    }
+
+    return copy;
 }
@@ -7,6 +7,9 @@
 #ifndef GROWBUF_H
 #define GROWBUF_H
 
+#include <stddef.h>
+#include <errno.h>
+
 typedef struct _growbuf
 {
     void*  buf;
@@ -14,10 +17,63 @@ typedef struct _growbuf
     size_t size;
 } growbuf;
 
+//
+// Bump allocator for lots of small, short-lived allocations which are all
+// freed at once. Unlike a growbuf, what it hands out never moves.
+//
+typedef struct _growbuf_arena
+{
+    growbuf* blocks;        // char*, the blocks allocated so far
+    char*    next;          // free space in the last block
+    size_t   remaining;     // bytes left at next
+    size_t   block_size;    // size of a typical block
+} growbuf_arena;
+
 growbuf* growbuf_create(size_t initial_size);
 void     growbuf_free(growbuf* gb);
 int      growbuf_append(growbuf* gb, const void* buf, size_t len);
-int      growbuf_append_byte(growbuf* gb, char byte);
+int      growbuf_reserve(growbuf* gb, size_t additional);
+int      growbuf_shrink_to_fit(growbuf* gb);
+
+growbuf_arena* growbuf_arena_create(size_t block_size);
+void           growbuf_arena_free(growbuf_arena* arena);
+void           growbuf_arena_reset(growbuf_arena* arena);
+void*          growbuf_arena_alloc(growbuf_arena* arena, size_t len);
+char*          growbuf_arena_strndup(growbuf_arena* arena, const char* str, size_t len);
+
+/**
+ * Append one byte to a growbuf, growing it if necessary.
+ *
+ * Args:
+ *  gb      - growbuf to append to
+ *  byte    - byte to append
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+static inline int growbuf_append_byte(growbuf* gb, char byte)
+{
+    if (gb->size < gb->allocated_size) {
+        ((char*)gb->buf)[gb->size++] = byte;
+        return 0;
+    }
+
+    return growbuf_append(gb, &byte, 1);
+}
+
+//
+// Append a value of given type to a growbuf, growing it if necessary.
+// Evaluates to 0 on success or -ENOMEM.
+//
+// The value is stored in place rather than copied with memcpy, so the growbuf
+// should hold only values of this type (or at least keep them aligned).
+//
+#define growbuf_push(g, type, value)                                        \
+    ((((g)->allocated_size - (g)->size >= sizeof(type))                     \
+            || 0 == growbuf_reserve((g), sizeof(type)))                     \
+        ? ((*(type*)((char*)(g)->buf + (g)->size) = (value)),               \
+            (g)->size += sizeof(type), 0)                                   \
+        : -ENOMEM)
 
 //
 // Get the element of given type at given index.
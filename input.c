@@ -0,0 +1,881 @@
+/**
+ * Input Sources
+ *
+ * Gives the rest of the program line-at-a-time access to the input, either
+ * through a read-only memory mapping of the whole file, or by reading it
+ * ahead on a background thread. Tabs can be expanded to spaces as lines are
+ * read.
+ *
+ * Streaming inputs only keep a leading window of lines in memory. Reads stop
+ * at the end of the window until the input is seeked backwards into it;
+ * after that, the window is replayed and reading carries on forward through
+ * the rest of the stream, which can't be seeked in.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "input.h"
+
+#define DEBUG if (false)
+
+//
+// Inputs whose whole contents are in memory.
+//
+#define HAS_SPAN(input) (TSV_INPUT_MMAP == (input)->mode || TSV_INPUT_BUFFER == (input)->mode)
+
+//
+// Initial buffer size for reading unseekable streams into memory.
+//
+#define STREAM_CHUNK_SIZE (64 * 1024)
+
+//
+// Read-ahead buffers for inputs which aren't in memory: enough to keep a
+// disk streaming while the previous buffer is converted.
+//
+#define READAHEAD_BUFFER_SIZE (1024 * 1024)
+#define READAHEAD_BUFFERS     4
+
+/**
+ * Try to map a file into memory.
+ *
+ * Args:
+ *  input   - input to set up; on success its mode, data and size are set
+ *  fd      - open file descriptor to map
+ *
+ * Returns:
+ *  true if the file was mapped, false if it isn't mappable (not a regular
+ *  file, or mmap failed), in which case the caller should read it instead.
+ */
+static bool map_file(tsv_input* input, int fd)
+{
+    struct stat st;
+
+    if (0 != fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+
+    input->mode = TSV_INPUT_MMAP;
+    input->size = (size_t)st.st_size;
+
+    if (0 == input->size) {
+        //
+        // mmap() refuses zero-length mappings; an empty span will do.
+        //
+        input->data = NULL;
+        return true;
+    }
+
+    void* data = mmap(NULL, input->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (MAP_FAILED == data) {
+        DEBUG perror("mmap");
+        return false;
+    }
+
+    posix_madvise(data, input->size, POSIX_MADV_SEQUENTIAL);
+    posix_madvise(data, input->size, POSIX_MADV_WILLNEED);
+
+    input->data = (const char*)data;
+    return true;
+}
+
+/**
+ * Read all of an unseekable stream into memory.
+ *
+ * Args:
+ *  input   - input to set up; on success its mode, data and size are set
+ *  fd      - stream to read; not closed
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+static int read_stream(tsv_input* input, int fd)
+{
+    char*  buf       = NULL;
+    size_t allocated = 0;
+    size_t size      = 0;
+
+    for (;;) {
+        if (size == allocated) {
+            size_t newsize = (0 == allocated) ? STREAM_CHUNK_SIZE : allocated * 2;
+            char*  newbuf  = (char*)realloc(buf, newsize);
+            if (NULL == newbuf) {
+                free(buf);
+                return -ENOMEM;
+            }
+            buf       = newbuf;
+            allocated = newsize;
+        }
+
+        ssize_t n = read(fd, buf + size, allocated - size);
+        if (n < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            int err = errno;
+            free(buf);
+            return -err;
+        }
+
+        if (0 == n) {
+            break;
+        }
+        size += (size_t)n;
+    }
+
+    DEBUG fprintf(stderr, "read %zu bytes from stream into memory\n", size);
+
+    input->mode = TSV_INPUT_BUFFER;
+    input->data = buf;
+    input->size = size;
+    return 0;
+}
+
+/**
+ * Replace an in-memory input with its decompressed contents, if it's
+ * compressed.
+ *
+ * Args:
+ *  input   - mapped or buffered input
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+static int decompress_span(tsv_input* input)
+{
+    growbuf* out;
+    int      result;
+
+    input->compression = tsv_detect_compression(input->data, input->size);
+    if (TSV_COMPRESSION_NONE == input->compression) {
+        return 0;
+    }
+
+    out = growbuf_create(0);
+    if (NULL == out) {
+        return -ENOMEM;
+    }
+
+    result = tsv_decompress(input->compression, input->data, input->size, out);
+    if (0 != result) {
+        growbuf_free(out);
+        return result;
+    }
+    growbuf_shrink_to_fit(out);
+
+    if (TSV_INPUT_MMAP == input->mode) {
+        munmap((void*)input->data, input->size);
+    }
+    else if (!input->borrowed) {
+        free((void*)input->data);
+    }
+
+    DEBUG fprintf(stderr, "decompressed %zu bytes of %s input to %zu\n", input->size, tsv_compression_name(input->compression), out->size);
+
+    input->mode     = TSV_INPUT_BUFFER;
+    input->data     = (const char*)out->buf;
+    input->size     = out->size;
+    input->borrowed = false;
+
+    out->buf = NULL;
+    growbuf_free(out);
+    return 0;
+}
+
+/**
+ * Read the leading window of a streaming input into memory, if that hasn't
+ * been done yet.
+ *
+ * The window holds whole lines, and at least one line if there is one.
+ *
+ * Args:
+ *  input   - streaming input
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+static int fill_window(tsv_input* input)
+{
+    const char* line;
+    ssize_t     n;
+    size_t      num_lines = 0;
+    int         result;
+
+    if (input->window_filled) {
+        // an earlier attempt may have run out of memory
+        return (NULL == input->lines) ? -ENOMEM : 0;
+    }
+
+    input->window_filled = true;
+    input->window_start  = input->stream_pos;
+
+    while (num_lines < input->window_lines && input->window->size < input->window_bytes
+            && -1 != (n = tsv_readahead_getline(input->reader, &line)))
+    {
+        result = growbuf_append(input->window, line, n);
+        if (0 != result) {
+            return result;
+        }
+
+        input->stream_pos += n;
+        num_lines++;
+        TSV_STATS_ADD(input->stats, bytes_read, (uint64_t)n);
+    }
+
+    DEBUG fprintf(stderr, "stream window: %zu lines, %zu bytes\n", num_lines, input->window->size);
+
+    input->data = (const char*)input->window->buf;
+    input->size = input->window->size;
+
+    input->lines = tsv_lineindex_create();
+    if (NULL == input->lines) {
+        return -ENOMEM;
+    }
+
+    result = tsv_lineindex_build(input->lines, input->data, input->size);
+    tsv_linecursor_init(&input->cursor, input->lines, 0);
+
+    //
+    // If reading failed, the window is whatever was read before it did, and
+    // tsv_input_error() says so.
+    //
+    return result;
+}
+
+/**
+ * Index the lines of an in-memory input, if that hasn't been done yet.
+ *
+ * Args:
+ *  input   - mapped or buffered input
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+static int index_lines(tsv_input* input)
+{
+    if (NULL != input->lines) {
+        return 0;
+    }
+
+    input->lines = tsv_lineindex_create();
+    if (NULL == input->lines) {
+        return -ENOMEM;
+    }
+
+    int result = tsv_lineindex_build(input->lines, input->data, input->size);
+    if (0 != result) {
+        tsv_lineindex_free(input->lines);
+        input->lines = NULL;
+        return result;
+    }
+
+    tsv_linecursor_init(&input->cursor, input->lines, 0);
+    return 0;
+}
+
+/**
+ * Open an input from a file descriptor.
+ *
+ * Args:
+ *  fd          - file descriptor to read; not closed, and not read from
+ *                after this returns unless the input is read ahead, in
+ *                which case it reads through a duplicate of it
+ *  use_mmap    - try to memory-map the file. Inputs which can't be mapped
+ *                are read ahead regardless, and ones which can't be seeked
+ *                in either (pipes, terminals, etc.) are read into memory.
+ *                Compressed inputs are decompressed into memory.
+ *
+ * Returns:
+ *  The new input, or NULL with errno set on failure.
+ */
+tsv_input* tsv_input_open_fd(int fd, bool use_mmap)
+{
+    tsv_input* input = (tsv_input*)calloc(1, sizeof(tsv_input));
+    if (NULL == input) {
+        return NULL;
+    }
+
+    int result = 0;
+
+    if (use_mmap && map_file(input, fd)) {
+        DEBUG fprintf(stderr, "mapped %zu bytes of fd %d\n", input->size, fd);
+        goto in_memory;
+    }
+
+    input->mode = TSV_INPUT_STDIO;
+
+    struct stat st;
+    off_t       pos;
+    char        magic[TSV_COMPRESSION_MAGIC_LEN];
+    if (0 != fstat(fd, &st) || !S_ISREG(st.st_mode) || -1 == (pos = lseek(fd, 0, SEEK_CUR))) {
+        //
+        // Detection needs to make a second pass over the input, so anything
+        // unseekable has to be kept in memory.
+        //
+        result = read_stream(input, fd);
+        goto in_memory;
+    }
+
+    ssize_t n = pread(fd, magic, sizeof(magic), pos);
+    if (n > 0 && TSV_COMPRESSION_NONE != tsv_detect_compression(magic, (size_t)n)) {
+        //
+        // Same goes for compressed files, which can't be seeked in either.
+        //
+        result = read_stream(input, fd);
+        goto in_memory;
+    }
+
+    int dupfd = dup(fd);
+    if (-1 == dupfd || NULL == (input->reader = tsv_readahead_create(dupfd, READAHEAD_BUFFER_SIZE, READAHEAD_BUFFERS, false))) {
+        int err = errno;
+        if (-1 != dupfd) {
+            close(dupfd);
+        }
+        free(input);
+        errno = err;
+        return NULL;
+    }
+
+    return input;
+
+in_memory:
+    if (0 == result) {
+        result = decompress_span(input);
+    }
+
+    if (0 != result) {
+        tsv_input_close(input);
+        errno = -result;
+        return NULL;
+    }
+
+    return input;
+}
+
+/**
+ * Open an input file.
+ *
+ * Args:
+ *  filename    - file to open
+ *  use_mmap    - as for tsv_input_open_fd()
+ *
+ * Returns:
+ *  The new input, or NULL with errno set on failure.
+ */
+tsv_input* tsv_input_open(const char* filename, bool use_mmap)
+{
+    int fd = open(filename, O_RDONLY);
+    if (-1 == fd) {
+        return NULL;
+    }
+
+    tsv_input* input = tsv_input_open_fd(fd, use_mmap);
+
+    int err = errno;
+    close(fd);
+    errno = err;
+
+    return input;
+}
+
+/**
+ * Open an input over a buffer already in memory.
+ *
+ * Args:
+ *  data    - the input; not copied, so it has to outlive the input
+ *  size    - size of the input
+ *
+ * Returns:
+ *  The new input, or NULL with errno set on failure.
+ */
+tsv_input* tsv_input_open_buffer(const char* data, size_t size)
+{
+    tsv_input* input = (tsv_input*)calloc(1, sizeof(tsv_input));
+    if (NULL == input) {
+        return NULL;
+    }
+
+    input->mode     = TSV_INPUT_BUFFER;
+    input->data     = data;
+    input->size     = size;
+    input->borrowed = true;
+    return input;
+}
+
+/**
+ * Open an input file for streaming.
+ *
+ * Only a leading window of the file is kept in memory, so this works on
+ * inputs of any size, seekable or not. Compressed inputs are decompressed as
+ * they're read.
+ *
+ * Args:
+ *  filename        - file to open
+ *  window_lines    - most lines to keep in the window; 0 for no window, for
+ *                    reading straight through without going back
+ *  window_bytes    - most bytes to keep in the window. The window always
+ *                    ends with a whole line, so it can go over this by up to
+ *                    one line.
+ *
+ * Returns:
+ *  The new input, or NULL with errno set on failure.
+ */
+tsv_input* tsv_input_open_stream(const char* filename, size_t window_lines, size_t window_bytes)
+{
+    tsv_input* input = (tsv_input*)calloc(1, sizeof(tsv_input));
+    if (NULL == input) {
+        return NULL;
+    }
+
+    input->mode         = TSV_INPUT_STREAM;
+    input->window_lines = window_lines;
+    input->window_bytes = (0 == window_bytes) ? 1 : window_bytes;
+
+    //
+    // With no window, there's nothing to replay, so reading carries on into
+    // the stream from the start.
+    //
+    input->rewound      = (0 == window_lines);
+
+    input->window = growbuf_create(STREAM_CHUNK_SIZE);
+    if (NULL == input->window) {
+        free(input);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    int fd = open(filename, O_RDONLY);
+    if (-1 == fd || NULL == (input->reader = tsv_readahead_create(fd, READAHEAD_BUFFER_SIZE, READAHEAD_BUFFERS, true))) {
+        int err = errno;
+        if (-1 != fd) {
+            close(fd);
+        }
+        growbuf_free(input->window);
+        free(input);
+        errno = err;
+        return NULL;
+    }
+
+    return input;
+}
+
+/**
+ * Close an input and free all its resources.
+ *
+ * Args:
+ *  input   - input to close
+ */
+void tsv_input_close(tsv_input* input)
+{
+    if (NULL == input) {
+        return;
+    }
+
+    if (TSV_INPUT_MMAP == input->mode && NULL != input->data) {
+        munmap((void*)input->data, input->size);
+    }
+    else if (TSV_INPUT_BUFFER == input->mode && !input->borrowed) {
+        free((void*)input->data);
+    }
+
+    tsv_readahead_free(input->reader);
+
+    tsv_lineindex_free(input->lines);
+    growbuf_free(input->window);
+    growbuf_free(input->expanded);
+    free(input);
+}
+
+/**
+ * Start counting an input's reads and seeks.
+ *
+ * Inputs already in memory count as having been read in full.
+ *
+ * Args:
+ *  input   - input to count
+ *  stats   - where to count them, or NULL to stop counting
+ */
+void tsv_input_set_stats(tsv_input* input, tsv_stats* stats)
+{
+    input->stats = stats;
+
+    if (HAS_SPAN(input) && !input->borrowed) {
+        TSV_STATS_ADD(stats, bytes_read, (uint64_t)input->size);
+    }
+}
+
+/**
+ * Turn on tab expansion for an input.
+ *
+ * Args:
+ *  input       - input to change
+ *  tab_width   - width of a tab character, or 0 to leave tabs alone
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+int tsv_input_set_tab_width(tsv_input* input, int tab_width)
+{
+    if (tab_width < 0) {
+        return -EINVAL;
+    }
+
+    if (tab_width > 0 && NULL == input->expanded) {
+        input->expanded = growbuf_create(512);
+        if (NULL == input->expanded) {
+            return -ENOMEM;
+        }
+    }
+
+    input->tab_width = tab_width;
+    return 0;
+}
+
+/**
+ * Expand the tabs in a line to spaces.
+ *
+ * Each tab advances to the next multiple of tab_width columns. Lines with no
+ * tabs are returned as-is without being copied.
+ *
+ * Args:
+ *  line            - line to expand (without its newline)
+ *  len             - length of the line
+ *  tab_width       - width of a tab character
+ *  scratch         - growbuf to expand the line into, if needed
+ *  expanded_len    - set to the length of the expanded line
+ *
+ * Returns:
+ *  The expanded line, which is either line itself, or the contents of
+ *  scratch. NULL if out of memory.
+ */
+const char* tsv_expand_tabs(const char* line, size_t len, int tab_width, growbuf* scratch, size_t* expanded_len)
+{
+    const char* tab = memchr(line, '\t', len);
+    if (NULL == tab) {
+        *expanded_len = len;
+        return line;
+    }
+
+    scratch->size = 0;
+    if (0 != growbuf_append(scratch, line, tab - line)) {
+        return NULL;
+    }
+
+    size_t col = tab - line;
+    for (size_t i = col; i < len; i++) {
+        if ('\t' == line[i]) {
+            do {
+                if (0 != growbuf_append_byte(scratch, ' ')) {
+                    return NULL;
+                }
+                col++;
+            } while (0 != col % tab_width);
+        }
+        else {
+            if (0 != growbuf_append_byte(scratch, line[i])) {
+                return NULL;
+            }
+            col++;
+        }
+    }
+
+    *expanded_len = scratch->size;
+    return (const char*)scratch->buf;
+}
+
+/**
+ * Read the next line of input.
+ *
+ * The returned line is not null-terminated, and doesn't include the newline.
+ * If tab expansion is on, its tabs have been expanded. It remains valid until
+ * the next call on this input.
+ *
+ * Args:
+ *  input   - input to read from
+ *  line    - set to point to the start of the line
+ *  len     - set to the length of the line
+ *
+ * Returns:
+ *  true if a line was read, false at EOF.
+ */
+bool tsv_input_getline(tsv_input* input, const char** line, size_t* len)
+{
+    uint64_t offset;
+    bool     in_window = false;
+
+    if (TSV_INPUT_STREAM == input->mode) {
+        if (0 != fill_window(input)) {
+            return false;
+        }
+
+        in_window = tsv_linecursor_next(&input->cursor, &offset, len);
+        if (!in_window && !input->rewound) {
+            // end of the window, and it hasn't been replayed yet
+            return false;
+        }
+    }
+    else if (HAS_SPAN(input)) {
+        if (0 != index_lines(input)) {
+            return false;
+        }
+
+        in_window = tsv_linecursor_next(&input->cursor, &offset, len);
+        if (!in_window) {
+            return false;
+        }
+    }
+
+    if (in_window) {
+        *line = input->data + offset + input->skip;
+        *len -= input->skip;
+        input->skip = 0;
+    }
+    else {
+        ssize_t n = tsv_readahead_getline(input->reader, line);
+        if (n < 0) {
+            return false;
+        }
+
+        input->stream_pos += n;
+        TSV_STATS_ADD(input->stats, bytes_read, (uint64_t)n);
+
+        if (n > 0 && '\n' == (*line)[n - 1]) {
+            n--;
+        }
+
+        *len = (size_t)n;
+    }
+
+    if (input->tab_width > 0) {
+        *line = tsv_expand_tabs(*line, *len, input->tab_width, input->expanded, len);
+        if (NULL == *line) {
+            fprintf(stderr, "malloc failed\n");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Find out whether reading the input failed, as opposed to it just ending.
+ *
+ * Args:
+ *  input   - input to query
+ *
+ * Returns:
+ *  -1 * an errno.h error number from the read that failed, or 0 if none has.
+ *  -EBADMSG means compressed input was corrupt or truncated.
+ */
+int tsv_input_error(tsv_input* input)
+{
+    if (NULL == input->reader) {
+        return 0;
+    }
+
+    return tsv_readahead_error(input->reader);
+}
+
+/**
+ * Find how far into its line an offset is, for seeking partway into it.
+ *
+ * Args:
+ *  lines   - line index of the in-memory data
+ *  line    - the line the offset is on, from tsv_lineindex_lookup()
+ *  offset  - offset into the in-memory data
+ *
+ * Returns:
+ *  Number of bytes of the line before the offset; 0 past the last line.
+ */
+static size_t line_skip(const tsv_lineindex* lines, size_t line, uint64_t offset)
+{
+    if (line >= lines->num_lines) {
+        return 0;
+    }
+
+    return (size_t)(offset - tsv_lineindex_offset(lines, line));
+}
+
+/**
+ * Seek to an absolute position in the input.
+ *
+ * Seeking partway into a line of an in-memory input (or a streaming input's
+ * window) makes the next line read start there. Streaming inputs can only
+ * seek within their window, and only until reading has gone past the end of
+ * it.
+ *
+ * Args:
+ *  input   - input to seek in
+ *  offset  - byte offset from the start of the input
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+int tsv_input_seek(tsv_input* input, off_t offset)
+{
+    if (offset < 0) {
+        return -EINVAL;
+    }
+
+    TSV_STATS_ADD(input->stats, seeks, 1);
+
+    if (HAS_SPAN(input)) {
+        int result = index_lines(input);
+        if (0 != result) {
+            return result;
+        }
+
+        input->cursor.line = tsv_lineindex_lookup(input->lines, offset);
+        input->skip        = line_skip(input->lines, input->cursor.line, offset);
+        return 0;
+    }
+    else if (TSV_INPUT_STREAM == input->mode) {
+        int result = fill_window(input);
+        if (0 != result) {
+            return result;
+        }
+
+        if ((uint64_t)offset < input->window_start
+                || (uint64_t)offset > input->window_start + input->size
+                || input->stream_pos != input->window_start + input->size)
+        {
+            return -ESPIPE;
+        }
+
+        size_t line = tsv_lineindex_lookup(input->lines, offset - input->window_start);
+        if (line < input->cursor.line) {
+            input->rewound = true;
+        }
+
+        input->cursor.line = line;
+        input->skip        = line_skip(input->lines, line, offset - input->window_start);
+        return 0;
+    }
+
+    return tsv_readahead_seek(input->reader, offset);
+}
+
+/**
+ * Get the current position in the input.
+ *
+ * Args:
+ *  input   - input to query
+ *
+ * Returns:
+ *  Byte offset from the start of the input, or -1 on error.
+ */
+off_t tsv_input_tell(tsv_input* input)
+{
+    if (HAS_SPAN(input)) {
+        if (0 != index_lines(input)) {
+            return -1;
+        }
+
+        return (off_t)(tsv_lineindex_offset(input->lines, input->cursor.line) + input->skip);
+    }
+    else if (TSV_INPUT_STREAM == input->mode) {
+        if (input->window_filled && input->cursor.line < input->lines->num_lines) {
+            return (off_t)(input->window_start + tsv_lineindex_offset(input->lines, input->cursor.line) + input->skip);
+        }
+
+        return (off_t)input->stream_pos;
+    }
+
+    return tsv_readahead_tell(input->reader);
+}
+
+/**
+ * Seek to the start of a line.
+ *
+ * This is O(1) on in-memory inputs. Inputs read ahead from a file are
+ * rewound and read forward. Streaming inputs skip forward to the line if
+ * their window hasn't been read yet, so the window starts there; otherwise
+ * they can only seek within the window.
+ *
+ * Args:
+ *  input   - input to seek in
+ *  line    - line number (0-based) to go to. Seeking past the last line
+ *            leaves the input at EOF.
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+int tsv_input_seek_line(tsv_input* input, size_t line)
+{
+    if (HAS_SPAN(input)) {
+        int result = index_lines(input);
+        if (0 != result) {
+            return result;
+        }
+
+        input->cursor.line = line;
+        input->skip        = 0;
+        return 0;
+    }
+    else if (TSV_INPUT_STREAM == input->mode) {
+        if (input->window_filled) {
+            if (line < input->window_first || line - input->window_first > input->lines->num_lines) {
+                return -ESPIPE;
+            }
+            uint64_t offset = tsv_lineindex_offset(input->lines, line - input->window_first);
+            return tsv_input_seek(input, (off_t)(input->window_start + offset));
+        }
+
+        const char* skipped;
+        ssize_t     n;
+        while (input->window_first < line
+                && -1 != (n = tsv_readahead_getline(input->reader, &skipped)))
+        {
+            input->stream_pos += n;
+            input->window_first++;
+            TSV_STATS_ADD(input->stats, bytes_read, (uint64_t)n);
+        }
+
+        return 0;
+    }
+
+    int result = tsv_readahead_seek(input->reader, 0);
+    if (0 != result) {
+        return result;
+    }
+    TSV_STATS_ADD(input->stats, seeks, 1);
+
+    for (size_t i = 0; i < line; i++) {
+        const char* skipped;
+        ssize_t     n = tsv_readahead_getline(input->reader, &skipped);
+        if (-1 == n) {
+            break;
+        }
+        TSV_STATS_ADD(input->stats, bytes_read, (uint64_t)n);
+    }
+
+    return 0;
+}
+
+/**
+ * Get the line index of an input.
+ *
+ * Args:
+ *  input   - input to query
+ *
+ * Returns:
+ *  The index of all lines in the input, or NULL if the input isn't held in
+ *  memory.
+ */
+const tsv_lineindex* tsv_input_lines(tsv_input* input)
+{
+    if (!HAS_SPAN(input) || 0 != index_lines(input)) {
+        return NULL;
+    }
+
+    return input->lines;
+}
@@ -0,0 +1,86 @@
+/**
+ * Input Sources
+ *
+ * Gives the rest of the program line-at-a-time access to the input, either
+ * through a read-only memory mapping of the whole file, or by reading it
+ * ahead on a background thread. Tabs can be expanded to spaces as lines are
+ * read.
+ *
+ * Streaming inputs only keep a leading window of lines in memory. Reads stop
+ * at the end of the window until the input is seeked backwards into it;
+ * after that, the window is replayed and reading carries on forward through
+ * the rest of the stream, which can't be seeked in.
+ */
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "growbuf.h"
+#include "lineindex.h"
+#include "readahead.h"
+#include "decompress.h"
+#include "stats.h"
+
+typedef enum
+{
+    TSV_INPUT_MMAP,     // whole file mapped; lines point into the mapping
+    TSV_INPUT_STDIO,    // read ahead from a file; lines point into its buffers
+    TSV_INPUT_BUFFER,   // unseekable stream read into memory up front
+    TSV_INPUT_STREAM,   // leading window in memory, then read forward only
+} tsv_input_mode;
+
+typedef struct _tsv_input
+{
+    tsv_input_mode mode;
+    tsv_compression compression;    // how the file was compressed, if it's been looked at
+
+    // TSV_INPUT_MMAP and TSV_INPUT_BUFFER, and the window of TSV_INPUT_STREAM
+    const char*    data;
+    size_t         size;
+    bool           borrowed;   // data belongs to whoever opened the input
+    tsv_lineindex* lines;   // built on first use
+    tsv_linecursor cursor;
+    size_t         skip;    // bytes to leave off the start of the next line, after
+                            // seeking partway into it
+
+    // TSV_INPUT_STDIO and TSV_INPUT_STREAM
+    tsv_readahead* reader;
+
+    // TSV_INPUT_STREAM
+    growbuf*       window;
+    size_t         window_lines;    // most lines to keep in the window
+    size_t         window_bytes;    // most bytes to keep in the window
+    size_t         window_first;    // line number where the window starts
+    uint64_t       window_start;    // offset where the window starts
+    uint64_t       stream_pos;      // offset of the next byte of the stream
+    bool           window_filled;
+    bool           rewound;
+
+    // tab expansion; 0 = off
+    int            tab_width;
+    growbuf*       expanded;
+
+    tsv_stats*     stats;   // NULL unless counting
+} tsv_input;
+
+tsv_input* tsv_input_open(const char* filename, bool use_mmap);
+tsv_input* tsv_input_open_fd(int fd, bool use_mmap);
+tsv_input* tsv_input_open_buffer(const char* data, size_t size);
+tsv_input* tsv_input_open_stream(const char* filename, size_t window_lines, size_t window_bytes);
+void       tsv_input_close(tsv_input* input);
+int        tsv_input_set_tab_width(tsv_input* input, int tab_width);
+void       tsv_input_set_stats(tsv_input* input, tsv_stats* stats);
+bool       tsv_input_getline(tsv_input* input, const char** line, size_t* len);
+int        tsv_input_error(tsv_input* input);
+int        tsv_input_seek(tsv_input* input, off_t offset);
+off_t      tsv_input_tell(tsv_input* input);
+int        tsv_input_seek_line(tsv_input* input, size_t line);
+const tsv_lineindex* tsv_input_lines(tsv_input* input);
+
+const char* tsv_expand_tabs(const char* line, size_t len, int tab_width, growbuf* scratch, size_t* expanded_len);
+
+#endif //INPUT_H
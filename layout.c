@@ -0,0 +1,291 @@
+/**
+ * Layout Files
+ *
+ * A layout file is a few lines of text:
+ *
+ *  tsv-layout 1
+ *  tab-width 8
+ *  start-line 1
+ *  fingerprint 0123456789abcdef
+ *  fields 12 16 0
+ *
+ * "fields" lists the field lengths in order, ending with the 0 which means
+ * "to end of line". Unknown keys are ignored, so newer files can add some.
+ *
+ * State files for --follow and --checkpoint are layout files with one more
+ * line, saying where conversion has got to: input byte offset, line number,
+ * and output byte offset.
+ *
+ *  position 123456 789 234567
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "growbuf.h"
+#include "layout.h"
+
+#define DEBUG if (false)
+
+#define LAYOUT_MAGIC    "tsv-layout"
+#define LAYOUT_VERSION  1
+
+//
+// FNV-1a parameters.
+//
+#define FINGERPRINT_BASIS   UINT64_C(0xcbf29ce484222325)
+#define FINGERPRINT_PRIME   UINT64_C(0x100000001b3)
+
+/**
+ * Compute the fingerprint of a header line, used to tell whether an input
+ * still has the format a layout was saved from.
+ *
+ * Args:
+ *  line    - the header line (after tab expansion, without its newline)
+ *  len     - length of the line
+ *
+ * Returns:
+ *  64-bit FNV-1a hash of the line.
+ */
+uint64_t tsv_layout_fingerprint(const char* line, size_t len)
+{
+    uint64_t hash = FINGERPRINT_BASIS;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)line[i];
+        hash *= FINGERPRINT_PRIME;
+    }
+
+    return hash;
+}
+
+/**
+ * Write a layout to a file.
+ *
+ * The file is written under a temporary name, synced, and renamed into
+ * place, so it's never seen half-written, even if this is interrupted or
+ * the system crashes.
+ *
+ * Args:
+ *  filename    - file to write; replaced if it exists
+ *  layout      - layout to write
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+int tsv_layout_save(const char* filename, const tsv_layout* layout)
+{
+    const size_t* lengths  = (const size_t*)layout->field_lengths->buf;
+    char*         tempname = NULL;
+    FILE*         file;
+    int           result   = 0;
+
+    tempname = (char*)malloc(strlen(filename) + sizeof(".tmp"));
+    if (NULL == tempname) {
+        return -ENOMEM;
+    }
+    sprintf(tempname, "%s.tmp", filename);
+
+    file = fopen(tempname, "w");
+    if (NULL == file) {
+        result = -errno;
+        goto cleanup;
+    }
+
+    fprintf(file, "%s %d\n", LAYOUT_MAGIC, LAYOUT_VERSION);
+    fprintf(file, "tab-width %d\n", layout->tab_width);
+    fprintf(file, "start-line %zu\n", layout->start_line);
+    fprintf(file, "fingerprint %016" PRIx64 "\n", layout->fingerprint);
+    fprintf(file, "fields");
+    for (size_t i = 0; i < layout->num_fields; i++) {
+        fprintf(file, " %zu", lengths[i]);
+    }
+    fprintf(file, "\n");
+    if (layout->has_position) {
+        fprintf(file, "position %" PRIu64 " %zu %" PRIu64 "\n", layout->input_offset, layout->input_line, layout->output_offset);
+    }
+
+    if (0 != fflush(file) || ferror(file)) {
+        result = -EIO;
+    }
+
+    //
+    // Without this, a crash soon after the rename can leave the new name on
+    // an empty file.
+    //
+    if (0 == result && 0 != fsync(fileno(file))) {
+        result = -errno;
+    }
+
+    if (0 != fclose(file) && 0 == result) {
+        result = -errno;
+    }
+
+    if (0 == result && 0 != rename(tempname, filename)) {
+        result = -errno;
+    }
+
+    if (0 != result) {
+        unlink(tempname);
+    }
+
+cleanup:
+    free(tempname);
+    return result;
+}
+
+/**
+ * Parse the field lengths from the rest of a "fields" line.
+ *
+ * Args:
+ *  text    - the lengths, separated by spaces
+ *  layout  - layout to fill in field_lengths and num_fields of
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+static int parse_fields(const char* text, tsv_layout* layout)
+{
+    layout->field_lengths->size = 0;
+    layout->num_fields          = 0;
+
+    for (;;) {
+        char*              end;
+        unsigned long long n;
+
+        while (' ' == *text) {
+            text++;
+        }
+
+        if ('\0' == *text || '\n' == *text) {
+            break;
+        }
+
+        if (layout->num_fields > 0 && 0 == growbuf_index(layout->field_lengths, layout->num_fields - 1, size_t)) {
+            // only the last field can be 0
+            return -EINVAL;
+        }
+
+        errno = 0;
+        n = strtoull(text, &end, 10);
+        if (0 != errno || end == text || '-' == *text) {
+            return -EINVAL;
+        }
+        text = end;
+
+        size_t length = (size_t)n;
+        if (0 != growbuf_append(layout->field_lengths, &length, sizeof(size_t))) {
+            return -ENOMEM;
+        }
+        layout->num_fields++;
+    }
+
+    if (0 == layout->num_fields || 0 != growbuf_index(layout->field_lengths, layout->num_fields - 1, size_t)) {
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+/**
+ * Read a layout from a file.
+ *
+ * Args:
+ *  filename    - file to read
+ *  layout      - layout to fill in. Its field_lengths growbuf must already
+ *                be allocated.
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success; -EINVAL if the file isn't a
+ *  valid layout.
+ */
+int tsv_layout_load(const char* filename, tsv_layout* layout)
+{
+    FILE*   file;
+    char*   line       = NULL;
+    size_t  line_size  = 0;
+    bool    got_magic  = false;
+    bool    got_fields = false;
+    int     result     = 0;
+
+    file = fopen(filename, "r");
+    if (NULL == file) {
+        return -errno;
+    }
+
+    layout->tab_width    = 0;
+    layout->start_line   = 1;
+    layout->fingerprint  = 0;
+    layout->has_position = false;
+
+    while (0 == result && -1 != getline(&line, &line_size, file)) {
+        char key[32];
+        int  value_pos;
+
+        if (1 != sscanf(line, "%31s %n", key, &value_pos)) {
+            // blank line
+            continue;
+        }
+
+        const char* value = line + value_pos;
+
+        DEBUG fprintf(stderr, "layout %s: %s", key, value);
+
+        if (!got_magic) {
+            int version;
+            if (0 != strcmp(LAYOUT_MAGIC, key) || 1 != sscanf(value, "%d", &version)) {
+                result = -EINVAL;
+            }
+            else if (version > LAYOUT_VERSION) {
+                result = -ENOTSUP;
+            }
+            got_magic = true;
+        }
+        else if (0 == strcmp("tab-width", key)) {
+            if (1 != sscanf(value, "%d", &layout->tab_width) || layout->tab_width < 0) {
+                result = -EINVAL;
+            }
+        }
+        else if (0 == strcmp("start-line", key)) {
+            if (1 != sscanf(value, "%zu", &layout->start_line)) {
+                result = -EINVAL;
+            }
+        }
+        else if (0 == strcmp("fingerprint", key)) {
+            if (1 != sscanf(value, "%" SCNx64, &layout->fingerprint)) {
+                result = -EINVAL;
+            }
+        }
+        else if (0 == strcmp("position", key)) {
+            if (3 != sscanf(value, "%" SCNu64 " %zu %" SCNu64, &layout->input_offset, &layout->input_line, &layout->output_offset)
+                    || 0 == layout->input_line)
+            {
+                result = -EINVAL;
+            }
+            layout->has_position = true;
+        }
+        else if (0 == strcmp("fields", key)) {
+            result = parse_fields(value, layout);
+            got_fields = true;
+        }
+    }
+
+    if (0 == result && ferror(file)) {
+        result = -EIO;
+    }
+
+    if (0 == result && !got_fields) {
+        result = -EINVAL;
+    }
+
+    free(line);
+    fclose(file);
+    return result;
+}
@@ -0,0 +1,34 @@
+/**
+ * Layout Files
+ *
+ * Saved column layouts, so a recurring input format can skip detection.
+ */
+
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "growbuf.h"
+
+typedef struct
+{
+    growbuf*  field_lengths;    // size_t each; the last one is 0
+    size_t    num_fields;
+    int       tab_width;        // 0 = tabs not expanded
+    size_t    start_line;       // 1-based
+    uint64_t  fingerprint;      // of the header line; see tsv_layout_fingerprint()
+
+    // how far conversion has got, for --follow and --checkpoint state files
+    bool      has_position;
+    uint64_t  input_offset;     // of the first line not yet converted
+    size_t    input_line;       // 1-based line number there
+    uint64_t  output_offset;    // size of the output up to there
+} tsv_layout;
+
+uint64_t tsv_layout_fingerprint(const char* line, size_t len);
+int      tsv_layout_save(const char* filename, const tsv_layout* layout);
+int      tsv_layout_load(const char* filename, tsv_layout* layout);
+
+#endif //LAYOUT_H
@@ -0,0 +1,456 @@
+/**
+ * libtsv
+ *
+ * Embeddable interface to the converter. All state lives in a tsv_context,
+ * so any number of inputs can be converted at once, one context per thread.
+ *
+ * With TSV_STATS=1 in the environment, each context writes its statistics
+ * (see stats.h) to stderr as JSON when it's freed.
+ *
+ * Typical use:
+ *
+ *  tsv_context* ctx = tsv_context_open_fd(fd, NULL);
+ *  tsv_context_detect(ctx);
+ *  while (tsv_context_next_row(ctx, &fields) > 0) { ... }
+ *      or
+ *  tsv_context_encode(ctx, &sink);
+ *  tsv_context_free(ctx);
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include "growbuf.h"
+#include "convert.h"
+#include "input.h"
+#include "stats.h"
+#include "threadpool.h"
+#include "tsv.h"
+#include "libtsv.h"
+
+#define DEBUG if (false)
+
+struct _tsv_context
+{
+    tsv_input*          input;
+    tsv_threadpool*     pool;
+    tsv_context_options options;
+    off_t               startpos;       // where the table starts; -1 until found
+    growbuf*            field_lengths;  // size_t; empty until detected or set
+    size_t              num_fields;
+    growbuf*            fields;         // tsv_field; the row last returned
+    size_t              line_no;        // of the row last returned
+    bool                reading_rows;
+    tsv_stats*          stats;          // NULL unless TSV_STATS is set
+};
+
+//
+// Defaults for a NULL options argument; the same as the tsv program's.
+//
+static const tsv_context_options default_options = {
+    .tab_width    = 8,
+    .start_line   = 1,
+    .num_threads  = 1,
+    .on_violation = TSV_VIOLATION_IGNORE,
+    .messages     = NULL,
+    .format       = TSV_FORMAT_CSV,
+    .columns      = NULL,
+    .where        = NULL,
+    .num_where    = 0,
+};
+
+/**
+ * Finish setting up a new context around an input.
+ *
+ * Args:
+ *  input   - the input; owned by the context from here on, even on failure
+ *  options - options, or NULL for the defaults
+ *
+ * Returns:
+ *  The new context, or NULL with errno set on failure.
+ */
+static tsv_context* context_create(tsv_input* input, const tsv_context_options* options)
+{
+    tsv_context* ctx;
+    int          result = -ENOMEM;
+
+    if (NULL == input) {
+        return NULL;
+    }
+
+    ctx = (tsv_context*)calloc(1, sizeof(tsv_context));
+    if (NULL == ctx) {
+        goto fail;
+    }
+
+    ctx->input    = input;
+    ctx->options  = (NULL == options) ? default_options : *options;
+    ctx->startpos = -1;
+
+    ctx->field_lengths = growbuf_create(10 * sizeof(size_t));
+    ctx->fields        = growbuf_create(10 * sizeof(tsv_field));
+    if (NULL == ctx->field_lengths || NULL == ctx->fields) {
+        goto fail;
+    }
+
+    if (tsv_stats_requested()) {
+        ctx->stats = tsv_stats_create();
+        if (NULL == ctx->stats) {
+            goto fail;
+        }
+        tsv_input_set_stats(input, ctx->stats);
+    }
+
+    if (ctx->options.tab_width > 0) {
+        result = tsv_input_set_tab_width(input, ctx->options.tab_width);
+        if (0 != result) {
+            goto fail;
+        }
+    }
+
+    if (ctx->options.num_threads > 1) {
+        ctx->pool = tsv_threadpool_create(ctx->options.num_threads);
+        if (NULL == ctx->pool) {
+            result = -EAGAIN;
+            goto fail;
+        }
+    }
+
+    return ctx;
+
+fail:
+    if (NULL == ctx) {
+        tsv_input_close(input);
+    }
+    else {
+        tsv_context_free(ctx);
+    }
+    errno = -result;
+    return NULL;
+}
+
+/**
+ * Open a context reading from a file descriptor.
+ *
+ * Regular files are mapped into memory; anything else is read into memory.
+ *
+ * Args:
+ *  fd      - file descriptor to read; not closed, and not needed after this
+ *            returns unless it's a regular file which can't be mapped
+ *  options - options, or NULL for the defaults
+ *
+ * Returns:
+ *  The new context, or NULL with errno set on failure.
+ */
+tsv_context* tsv_context_open_fd(int fd, const tsv_context_options* options)
+{
+    return context_create(tsv_input_open_fd(fd, true), options);
+}
+
+/**
+ * Open a context reading from a buffer in memory.
+ *
+ * Args:
+ *  data    - the input; not copied, so it has to outlive the context
+ *  size    - size of the input
+ *  options - options, or NULL for the defaults
+ *
+ * Returns:
+ *  The new context, or NULL with errno set on failure.
+ */
+tsv_context* tsv_context_open_buffer(const char* data, size_t size, const tsv_context_options* options)
+{
+    return context_create(tsv_input_open_buffer(data, size), options);
+}
+
+/**
+ * Free a context and everything it holds.
+ *
+ * Args:
+ *  ctx - context to free; may be NULL
+ */
+void tsv_context_free(tsv_context* ctx)
+{
+    if (NULL == ctx) {
+        return;
+    }
+
+    if (NULL != ctx->pool) {
+        tsv_threadpool_free(ctx->pool);
+    }
+
+    if (NULL != ctx->stats) {
+        tsv_stats_print(ctx->stats, stderr);
+        tsv_stats_free(ctx->stats);
+    }
+
+    tsv_input_close(ctx->input);
+    growbuf_free(ctx->field_lengths);
+    growbuf_free(ctx->fields);
+    free(ctx);
+}
+
+/**
+ * Find where the table starts, if that hasn't been done yet.
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+static int find_start(tsv_context* ctx)
+{
+    if (ctx->startpos >= 0) {
+        return 0;
+    }
+
+    if (ctx->options.start_line > 1) {
+        int result = tsv_input_seek_line(ctx->input, ctx->options.start_line - 1);
+        if (0 != result) {
+            return result;
+        }
+    }
+
+    ctx->startpos = tsv_input_tell(ctx->input);
+    return (ctx->startpos < 0) ? -EIO : 0;
+}
+
+/**
+ * Make room for a row's worth of fields.
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+static int size_fields(tsv_context* ctx)
+{
+    ctx->fields->size = 0;
+    for (size_t i = 0; i < ctx->num_fields; i++) {
+        tsv_field empty = { NULL, 0 };
+        if (0 != growbuf_append(ctx->fields, &empty, sizeof(empty))) {
+            return -ENOMEM;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Detect the columns of the input.
+ *
+ * Args:
+ *  ctx - context to detect the columns of
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+int tsv_context_detect(tsv_context* ctx)
+{
+    if (NULL == ctx) {
+        return -EINVAL;
+    }
+
+    tsv_stats_begin(ctx->stats, TSV_PHASE_OPEN);
+    int result = find_start(ctx);
+    tsv_stats_end(ctx->stats);
+    if (0 != result) {
+        return result;
+    }
+
+    tsv_stats_begin(ctx->stats, TSV_PHASE_DETECT);
+    ctx->field_lengths->size = 0;
+    ctx->num_fields = tsv_get_field_lengths(ctx->input, ctx->field_lengths, ctx->startpos, ctx->pool);
+    tsv_stats_end(ctx->stats);
+    if (0 == ctx->num_fields) {
+        return -ENOMEM;
+    }
+    TSV_STATS_ADD(ctx->stats, columns, ctx->num_fields);
+
+    ctx->reading_rows = false;
+    return size_fields(ctx);
+}
+
+/**
+ * Use a known layout instead of detecting one.
+ *
+ * Args:
+ *  ctx             - context to set the layout of
+ *  field_lengths   - lengths of the fields; the last one has to be 0,
+ *                    meaning "to end of line"
+ *  num_fields      - number of fields
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+int tsv_context_set_layout(tsv_context* ctx, const size_t* field_lengths, size_t num_fields)
+{
+    if (NULL == ctx || 0 == num_fields || 0 != field_lengths[num_fields - 1]) {
+        return -EINVAL;
+    }
+
+    int result = find_start(ctx);
+    if (0 != result) {
+        return result;
+    }
+
+    ctx->field_lengths->size = 0;
+    ctx->num_fields = 0;
+    if (0 != growbuf_append(ctx->field_lengths, field_lengths, num_fields * sizeof(size_t))) {
+        return -ENOMEM;
+    }
+    ctx->num_fields = num_fields;
+
+    ctx->reading_rows = false;
+    return size_fields(ctx);
+}
+
+/**
+ * Get the number of fields in the layout; 0 if there isn't one yet.
+ */
+size_t tsv_context_num_fields(const tsv_context* ctx)
+{
+    return (NULL == ctx) ? 0 : ctx->num_fields;
+}
+
+/**
+ * Get the field lengths of the layout, as for tsv_context_set_layout().
+ */
+const size_t* tsv_context_field_lengths(const tsv_context* ctx)
+{
+    return (NULL == ctx) ? NULL : (const size_t*)ctx->field_lengths->buf;
+}
+
+/**
+ * Read the next row, split into fields. Columns are detected first if
+ * there's no layout yet.
+ *
+ * Args:
+ *  ctx     - context to read from
+ *  fields  - where to put the fields: tsv_context_num_fields() slices,
+ *            trimmed of whitespace. They're valid until the next call.
+ *
+ * Returns:
+ *  The number of fields, or 0 at the end of the input. -1 * an errno.h error
+ *  number on failure; -EILSEQ for a row which doesn't fit the layout under
+ *  TSV_VIOLATION_FAIL.
+ */
+int tsv_context_next_row(tsv_context* ctx, const tsv_field** fields)
+{
+    const char* line;
+    size_t      len;
+    int         result;
+
+    if (NULL == ctx) {
+        return -EINVAL;
+    }
+
+    if (0 == ctx->num_fields) {
+        result = tsv_context_detect(ctx);
+        if (0 != result) {
+            return result;
+        }
+    }
+
+    if (!ctx->reading_rows) {
+        result = tsv_input_seek(ctx->input, ctx->startpos);
+        if (0 != result) {
+            return result;
+        }
+
+        ctx->reading_rows = true;
+        ctx->line_no      = (ctx->options.start_line > 1) ? ctx->options.start_line - 1 : 0;
+    }
+
+    if (!tsv_input_getline(ctx->input, &line, &len)) {
+        return 0;
+    }
+    ctx->line_no++;
+
+    result = tsv_split_line(line, len, tsv_context_field_lengths(ctx), ctx->num_fields,
+            ctx->options.on_violation, (tsv_field*)ctx->fields->buf);
+    if (TSV_ROW_VIOLATION == result && TSV_VIOLATION_FAIL == ctx->options.on_violation) {
+        return -EILSEQ;
+    }
+    TSV_STATS_ADD(ctx->stats, rows, 1);
+
+    *fields = (const tsv_field*)ctx->fields->buf;
+    return (int)ctx->num_fields;
+}
+
+/**
+ * Get the line number of the row last read by tsv_context_next_row().
+ */
+size_t tsv_context_line_no(const tsv_context* ctx)
+{
+    return (NULL == ctx) ? 0 : ctx->line_no;
+}
+
+/**
+ * Convert the whole table to CSV, or the format in the context's options.
+ * Columns are detected first if there's no layout yet.
+ *
+ * Args:
+ *  ctx     - context to convert
+ *  sink    - where to write the output
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success. See tsv_convert().
+ */
+int tsv_context_encode(tsv_context* ctx, const tsv_sink* sink)
+{
+    if (NULL == ctx) {
+        return -EINVAL;
+    }
+
+    if (0 == ctx->num_fields) {
+        int result = tsv_context_detect(ctx);
+        if (0 != result) {
+            return result;
+        }
+    }
+
+    tsv_writer* writer   = NULL;
+    tsv_filter* filter   = NULL;
+    off_t       startpos = ctx->startpos;
+    int         result;
+
+    ctx->reading_rows = false;
+
+    if (ctx->options.num_where > 0) {
+        size_t bad;
+
+        result = tsv_create_filter(ctx->options.where, ctx->options.num_where, ctx->input,
+                (const size_t*)ctx->field_lengths->buf, ctx->num_fields, startpos, &filter, &bad);
+        if (0 != result) {
+            return result;
+        }
+    }
+
+    result = tsv_create_writer(ctx->options.format, ctx->options.columns, ctx->input, (const size_t*)ctx->field_lengths->buf, ctx->num_fields, &startpos, &writer);
+    if (0 != result) {
+        tsv_filter_free(filter);
+        return result;
+    }
+
+    tsv_convert_options options = {
+        .pool          = ctx->pool,
+        .on_violation  = ctx->options.on_violation,
+        .first_line_no = (ctx->options.start_line > 1) ? ctx->options.start_line : 1,
+        .messages      = ctx->options.messages,
+        .stats         = ctx->stats,
+        .writer        = writer,
+        .filter        = filter,
+    };
+
+    if (NULL != writer && writer->skip_header) {
+        options.first_line_no++;
+    }
+
+    tsv_stats_begin(ctx->stats, TSV_PHASE_CONVERT);
+    result = tsv_convert(ctx->input, ctx->field_lengths, ctx->num_fields, startpos, &options, sink);
+    tsv_stats_end(ctx->stats);
+
+    tsv_writer_free(writer);
+    tsv_filter_free(filter);
+    return result;
+}
@@ -0,0 +1,91 @@
+/**
+ * libtsv
+ *
+ * Embeddable interface to the converter. All state lives in a tsv_context,
+ * so any number of inputs can be converted at once, one context per thread.
+ *
+ * This is the only header a program using the library needs; the types it
+ * shares with the converter are defined here, and the converter's own
+ * headers get them from it. Only the functions marked TSV_API are exported
+ * from libtsv.so.
+ *
+ * A NULL context, as from a failed open, gives -EINVAL, 0 or NULL.
+ */
+
+#ifndef LIBTSV_H
+#define LIBTSV_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#if defined(__GNUC__)
+#define TSV_API __attribute__((visibility("default")))
+#else
+#define TSV_API
+#endif
+
+//
+// What to do with rows which have text running over a field boundary.
+//
+typedef enum
+{
+    TSV_VIOLATION_IGNORE,   // slice them at the boundaries anyway
+    TSV_VIOLATION_WARN,     // slice them at the boundaries, and warn
+    TSV_VIOLATION_WIDEN,    // let the field run on to the next space, and warn
+    TSV_VIOLATION_FAIL,     // stop with -EILSEQ
+} tsv_violation_policy;
+
+typedef enum
+{
+    TSV_FORMAT_CSV,         // RFC 4180
+    TSV_FORMAT_JSONL,       // one JSON object per row, keyed by the header row
+    TSV_FORMAT_PGTEXT,      // PostgreSQL COPY text format
+    TSV_FORMAT_PGBINARY,    // PostgreSQL COPY binary format, every column as text
+} tsv_format;
+
+//
+// A field sliced out of a line.
+//
+typedef struct
+{
+    const char* data;
+    size_t      len;
+} tsv_field;
+
+//
+// Where converted output goes: a file descriptor, or a callback.
+//
+typedef struct
+{
+    int   fd;   // written to if write is NULL
+    int (*write)(void* arg, const char* data, size_t len);  // returns -1 * an errno.h error number, or 0
+    void* arg;
+} tsv_sink;
+
+typedef struct _tsv_context tsv_context;
+
+typedef struct
+{
+    int                  tab_width;     // 0 to leave tabs alone
+    size_t               start_line;    // 1-based; 0 means 1
+    size_t               num_threads;   // 0 or 1 to do everything on the calling thread
+    tsv_violation_policy on_violation;
+    FILE*                messages;      // where to report rows which don't fit; NULL for nowhere
+    tsv_format           format;        // what tsv_context_encode() writes; 0 is CSV
+    const char*          columns;       // which columns it writes, as for tsv --columns; NULL for all
+    const char* const*   where;         // conditions the rows it writes must match, as for tsv --where
+    size_t               num_where;
+} tsv_context_options;
+
+TSV_API tsv_context*  tsv_context_open_fd(int fd, const tsv_context_options* options);
+TSV_API tsv_context*  tsv_context_open_buffer(const char* data, size_t size, const tsv_context_options* options);
+TSV_API void          tsv_context_free(tsv_context* ctx);
+TSV_API int           tsv_context_detect(tsv_context* ctx);
+TSV_API int           tsv_context_set_layout(tsv_context* ctx, const size_t* field_lengths, size_t num_fields);
+TSV_API size_t        tsv_context_num_fields(const tsv_context* ctx);
+TSV_API const size_t* tsv_context_field_lengths(const tsv_context* ctx);
+TSV_API int           tsv_context_next_row(tsv_context* ctx, const tsv_field** fields);
+TSV_API size_t        tsv_context_line_no(const tsv_context* ctx);
+TSV_API int           tsv_context_encode(tsv_context* ctx, const tsv_sink* sink);
+
+#endif //LIBTSV_H
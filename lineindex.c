@@ -0,0 +1,296 @@
+/**
+ * Line Index
+ *
+ * Compact table of where each line of the input starts. Offsets are kept as
+ * 32-bit deltas from a 64-bit anchor stored every TSV_LINEINDEX_STRIDE lines,
+ * so looking up a line's offset is O(1) and costs about 4 bytes per line.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "growbuf.h"
+#include "lineindex.h"
+
+#define DEBUG if (false)
+
+//
+// Delta value meaning "look this line up in the wide table instead".
+//
+#define WIDE_DELTA UINT32_MAX
+
+/**
+ * Create an empty line index.
+ *
+ * Returns:
+ *  pointer to initialized index, or NULL if out of memory.
+ */
+tsv_lineindex* tsv_lineindex_create(void)
+{
+    tsv_lineindex* index = (tsv_lineindex*)calloc(1, sizeof(tsv_lineindex));
+    if (NULL == index) {
+        return NULL;
+    }
+
+    index->anchors = growbuf_create(16 * sizeof(uint64_t));
+    index->deltas  = growbuf_create(TSV_LINEINDEX_STRIDE * sizeof(uint32_t));
+    index->wide    = growbuf_create(0);
+
+    if (NULL == index->anchors || NULL == index->deltas || NULL == index->wide) {
+        tsv_lineindex_free(index);
+        return NULL;
+    }
+
+    return index;
+}
+
+/**
+ * Free a line index.
+ *
+ * Args:
+ *  index   - index to free
+ */
+void tsv_lineindex_free(tsv_lineindex* index)
+{
+    if (NULL != index) {
+        growbuf_free(index->anchors);
+        growbuf_free(index->deltas);
+        growbuf_free(index->wide);
+        free(index);
+    }
+}
+
+/**
+ * Add the next line to an index.
+ *
+ * Lines must be added in order. The new line is assumed to run to the end
+ * of the indexed data until another line is added after it.
+ *
+ * Args:
+ *  index   - index to add to
+ *  offset  - offset where the line starts
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+int tsv_lineindex_add(tsv_lineindex* index, uint64_t offset)
+{
+    int      result;
+    uint64_t delta;
+    uint32_t delta32;
+
+    if (0 == index->num_lines % TSV_LINEINDEX_STRIDE) {
+        result = growbuf_push(index->anchors, uint64_t, offset);
+        if (0 != result) {
+            return result;
+        }
+    }
+
+    delta = offset - growbuf_index(index->anchors, index->num_lines / TSV_LINEINDEX_STRIDE, uint64_t);
+    if (delta < WIDE_DELTA) {
+        delta32 = (uint32_t)delta;
+    }
+    else {
+        //
+        // Only possible if this block of lines spans 4 GB.
+        //
+        tsv_lineindex_wide w = { .line = index->num_lines, .offset = offset };
+        result = growbuf_push(index->wide, tsv_lineindex_wide, w);
+        if (0 != result) {
+            return result;
+        }
+        delta32 = WIDE_DELTA;
+    }
+
+    result = growbuf_push(index->deltas, uint32_t, delta32);
+    if (0 != result) {
+        return result;
+    }
+
+    index->num_lines++;
+    return 0;
+}
+
+/**
+ * Index all the lines in a block of data.
+ *
+ * Args:
+ *  index   - empty index to fill in
+ *  data    - data to index
+ *  size    - size of the data
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+int tsv_lineindex_build(tsv_lineindex* index, const char* data, size_t size)
+{
+    const char* pos = data;
+    const char* end = data + size;
+    int result;
+
+    index->size = size;
+    index->end  = size;
+
+    while (pos < end) {
+        result = tsv_lineindex_add(index, pos - data);
+        if (0 != result) {
+            return result;
+        }
+
+        const char* nl = memchr(pos, '\n', end - pos);
+        if (NULL == nl) {
+            // last line has no newline
+            index->end = size;
+            break;
+        }
+
+        index->end = nl - data;
+        pos = nl + 1;
+    }
+
+    DEBUG fprintf(stderr, "indexed %zu lines in %zu bytes\n", index->num_lines, size);
+
+    return 0;
+}
+
+/**
+ * Get the offset where a line starts.
+ *
+ * Args:
+ *  index   - index to look in
+ *  line    - line number (0-based)
+ *
+ * Returns:
+ *  Offset of the start of the line, or the size of the indexed data if the
+ *  line is past the end.
+ */
+uint64_t tsv_lineindex_offset(const tsv_lineindex* index, size_t line)
+{
+    if (line >= index->num_lines) {
+        return index->size;
+    }
+
+    uint32_t delta = growbuf_index(index->deltas, line, uint32_t);
+    if (WIDE_DELTA != delta) {
+        return growbuf_index(index->anchors, line / TSV_LINEINDEX_STRIDE, uint64_t) + delta;
+    }
+
+    //
+    // rare case: binary search the wide table
+    //
+    size_t lo = 0;
+    size_t hi = growbuf_num_elems(index->wide, tsv_lineindex_wide);
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        tsv_lineindex_wide w = growbuf_index(index->wide, mid, tsv_lineindex_wide);
+        if (w.line == line) {
+            return w.offset;
+        }
+        else if (w.line < line) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    fprintf(stderr, "BUG: tsv_lineindex_offset(): line %zu missing from wide table!\n", line);
+    return index->size;
+}
+
+/**
+ * Get the length of a line, not including its newline.
+ *
+ * Args:
+ *  index   - index to look in
+ *  line    - line number (0-based)
+ *
+ * Returns:
+ *  Length of the line, or 0 if the line is past the end.
+ */
+size_t tsv_lineindex_length(const tsv_lineindex* index, size_t line)
+{
+    if (line >= index->num_lines) {
+        return 0;
+    }
+    else if (line == index->num_lines - 1) {
+        return index->end - tsv_lineindex_offset(index, line);
+    }
+    else {
+        return tsv_lineindex_offset(index, line + 1) - tsv_lineindex_offset(index, line) - 1;
+    }
+}
+
+/**
+ * Find which line an offset is on.
+ *
+ * Args:
+ *  index   - index to look in
+ *  offset  - offset into the indexed data
+ *
+ * Returns:
+ *  Line number (0-based) of the line containing the offset, or the number of
+ *  lines if the offset is past the end.
+ */
+size_t tsv_lineindex_lookup(const tsv_lineindex* index, uint64_t offset)
+{
+    if (offset >= index->size) {
+        return index->num_lines;
+    }
+
+    //
+    // find the last line starting at or before offset
+    //
+    size_t lo = 0;
+    size_t hi = index->num_lines;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (tsv_lineindex_offset(index, mid) <= offset) {
+            lo = mid;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/**
+ * Set up a cursor for iterating over the lines in an index.
+ *
+ * Args:
+ *  cursor  - cursor to initialize
+ *  index   - index to iterate over
+ *  line    - first line (0-based) the cursor will return
+ */
+void tsv_linecursor_init(tsv_linecursor* cursor, const tsv_lineindex* index, size_t line)
+{
+    cursor->index = index;
+    cursor->line  = line;
+}
+
+/**
+ * Get the next line from a cursor.
+ *
+ * Args:
+ *  cursor  - cursor to advance
+ *  offset  - set to the offset of the start of the line
+ *  len     - set to the length of the line, not including its newline
+ *
+ * Returns:
+ *  true if a line was returned, false if the cursor is at the end.
+ */
+bool tsv_linecursor_next(tsv_linecursor* cursor, uint64_t* offset, size_t* len)
+{
+    if (cursor->line >= cursor->index->num_lines) {
+        return false;
+    }
+
+    *offset = tsv_lineindex_offset(cursor->index, cursor->line);
+    *len    = tsv_lineindex_length(cursor->index, cursor->line);
+    cursor->line++;
+
+    return true;
+}
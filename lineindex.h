@@ -0,0 +1,53 @@
+/**
+ * Line Index
+ *
+ * Compact table of where each line of the input starts. Offsets are kept as
+ * 32-bit deltas from a 64-bit anchor stored every TSV_LINEINDEX_STRIDE lines,
+ * so looking up a line's offset is O(1) and costs about 4 bytes per line.
+ */
+
+#ifndef LINEINDEX_H
+#define LINEINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "growbuf.h"
+
+#define TSV_LINEINDEX_STRIDE 256
+
+typedef struct _tsv_lineindex
+{
+    growbuf* anchors;   // uint64_t: offset of every STRIDE-th line
+    growbuf* deltas;    // uint32_t: offset of each line minus its anchor
+    growbuf* wide;      // tsv_lineindex_wide: lines whose delta didn't fit
+    size_t   num_lines;
+    uint64_t end;       // offset of the end of the last line's text
+    uint64_t size;      // number of bytes indexed
+} tsv_lineindex;
+
+typedef struct
+{
+    size_t   line;
+    uint64_t offset;
+} tsv_lineindex_wide;
+
+typedef struct
+{
+    const tsv_lineindex* index;
+    size_t               line;
+} tsv_linecursor;
+
+tsv_lineindex* tsv_lineindex_create(void);
+void           tsv_lineindex_free(tsv_lineindex* index);
+int            tsv_lineindex_add(tsv_lineindex* index, uint64_t offset);
+int            tsv_lineindex_build(tsv_lineindex* index, const char* data, size_t size);
+uint64_t       tsv_lineindex_offset(const tsv_lineindex* index, size_t line);
+size_t         tsv_lineindex_length(const tsv_lineindex* index, size_t line);
+size_t         tsv_lineindex_lookup(const tsv_lineindex* index, uint64_t offset);
+
+void           tsv_linecursor_init(tsv_linecursor* cursor, const tsv_lineindex* index, size_t line);
+bool           tsv_linecursor_next(tsv_linecursor* cursor, uint64_t* offset, size_t* len);
+
+#endif //LINEINDEX_H
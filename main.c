@@ -9,16 +9,29 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
 #include <sysexits.h>
+#include <sys/stat.h>
 
+#include "batch.h"
 #include "growbuf.h"
-#include "csvformat.h"
+#include "convert.h"
+#include "follow.h"
+#include "input.h"
+#include "layout.h"
+#include "splitruns.h"
+#include "stats.h"
+#include "threadpool.h"
 #include "tsv.h"
+#include "writer.h"
 
 const size_t initial_field_count = 10;
+const size_t default_window_lines = 10000;
+const size_t default_window_bytes = 16 * 1024 * 1024;
+const size_t section_output_size = 256 * 1024;
 
 #define DEBUG if (false)
 
@@ -30,110 +43,501 @@ void usage()
     fprintf(stderr,
 "usage: tsv [options] [input-file]\n"
 "         > csv-output\n"
+"       tsv --batch -o <output-dir> [options] [input-file ...]\n"
 "\n"
 "Options:\n"
 "  +<start line>    Line (1-based) to start on. Default = 1.\n"
 "  -t <tab width>   Specify the width of a tab character. Default = 8.\n"
-"  --notabs         Use this if the input data contains no tab characters.\n"
-"                   This increases performance by reading directly from the\n"
-"                   input file instead of converting all tabs to spaces into a\n"
-"                   temp file first. With this option, the input must be a\n"
-"                   seekable stream.\n"
+"  --notabs         Don't expand tab characters; treat them like any other\n"
+"                   character.\n"
+"  -j, --threads <n>\n"
+"                   Number of threads to use. Default = number of CPUs.\n"
+"  --no-mmap        Read the input on a separate thread instead of mapping\n"
+"                   it into memory. Inputs which can't be mapped are always\n"
+"                   read that way.\n"
+"  --stream         Only keep a window of leading lines in memory, and\n"
+"                   detect columns from that window alone. Rows after it\n"
+"                   which don't fit the columns are handled according to\n"
+"                   --on-violation.\n"
+"  --window-lines <n>\n"
+"                   Most lines in the --stream window. Default = 10000.\n"
+"  --window-bytes <n>[K|M|G]\n"
+"                   Most bytes in the --stream window. Default = 16M.\n"
+"  --split-runs <n> Don't detect columns; instead split each line into fields\n"
+"                   wherever there are at least n spaces in a row, ignoring\n"
+"                   spaces at the start and end. Fast, and reads the input\n"
+"                   only once, but cells mustn't have n spaces in a row, or\n"
+"                   be empty. Only writes CSV.\n"
+"  --sections       Split the input into sections at blank lines, lines\n"
+"                   starting with a form feed, and repeats of the first\n"
+"                   header line, and detect each section's columns on its\n"
+"                   own. Each section's first line is its header line, and\n"
+"                   --columns and --where names are looked up in it;\n"
+"                   sections without those columns are skipped. Blank\n"
+"                   lines aren't written. Can't be used with --stream,\n"
+"                   --no-mmap, or --format pgbinary.\n"
+"  --drop-repeated-headers\n"
+"                   With --sections, don't write the header line of a\n"
+"                   section as a row when it repeats the first section's.\n"
+"  --columns <list> Only write these columns, in this order: a comma-separated\n"
+"                   list of 1-based column numbers, ranges of them like 3-5,\n"
+"                   or names from the header line. Rows are only checked\n"
+"                   against the layout up to the last column written.\n"
+"  --where <predicate>\n"
+"                   Only write rows where a column (a number or a header\n"
+"                   line name) is: col  not empty; col=text  text;\n"
+"                   col!=text  not text; col^=text  starting with text;\n"
+"                   col~regex  matching an extended regular expression;\n"
+"                   col<n, col<=n, col>n, col>=n  a number compared so\n"
+"                   with n. Can be given more than once; rows must match\n"
+"                   all of them. A CSV header line is always written.\n"
+"  --format csv|jsonl|pgcopy|pgbinary\n"
+"                   Output format: CSV, JSON Lines with one object per row\n"
+"                   keyed by the header line's fields, or PostgreSQL COPY\n"
+"                   text or binary format. The header line isn't written as\n"
+"                   a row except in CSV. JSON keys are made unique with _2,\n"
+"                   _3, ..., and bytes which aren't UTF-8 become U+FFFD.\n"
+"                   Default = csv.\n"
+"  --on-violation ignore|warn|widen|fail\n"
+"                   What to do with rows which have text over a column\n"
+"                   boundary: split them at the boundary anyway, do that\n"
+"                   and warn, extend the field to the next space and warn,\n"
+"                   or stop. Default = warn with --stream, ignore otherwise.\n"
+"  --save-layout <file>\n"
+"                   Save the detected columns, tab width, start line, and a\n"
+"                   fingerprint of the header line to a file.\n"
+"  --layout <file>  Use columns saved by --save-layout instead of detecting\n"
+"                   them. The saved tab width and start line are used unless\n"
+"                   given as options.\n"
+"  --verify-layout  With --layout, stop if the header line doesn't match the\n"
+"                   saved one, and default --on-violation to fail.\n"
+"  --follow <state-file>\n"
+"                   Convert the input, then keep converting lines as they're\n"
+"                   appended to it, until it's truncated, moved, or deleted.\n"
+"                   How far it got, along with the layout, is kept in the\n"
+"                   state file, and a later run with the same state file\n"
+"                   carries on from there. Can't be used with --format\n"
+"                   pgbinary.\n"
+"  --checkpoint <state-file>\n"
+"                   Every so often, save how far the conversion has got,\n"
+"                   along with the layout, to the state file. If it's\n"
+"                   interrupted, run it again the same way, with the output\n"
+"                   appended (>>) to, and it carries on from there. The state\n"
+"                   file is removed when the conversion finishes. The output\n"
+"                   has to be a file.\n"
+"  --batch          Convert each input file to a file of the same name, with\n"
+"                   the extension of the --format (.csv, .jsonl, .pgcopy,\n"
+"                   .pgbinary), in the --output-dir directory, on --threads\n"
+"                   threads. With no input files, their names are read from\n"
+"                   stdin, one per line. Files which would be written to the\n"
+"                   same output, or over themselves, aren't converted.\n"
+"                   Failures are reported per file, and the exit status is\n"
+"                   that of the first failure.\n"
+"  -o, --output-dir <dir>\n"
+"                   Directory to write --batch output to.\n"
+"  --stats          When done, write statistics to stderr as JSON: time per\n"
+"                   phase, bytes read and written, time spent writing\n"
+"                   output (which overlaps converting), seeks and I/O\n"
+"                   syscalls, columns, rows, and peak memory use. Setting\n"
+"                   TSV_STATS=1 in the environment does the same.\n"
             );
 }
 
 /**
- * Read from the file to the next end of line.
+ * Parse a size argument: a number, optionally followed by K, M, or G.
  *
  * Args:
- *  input       - file to read from
- *  bytes_read  - set to the number of bytes read
+ *  arg     - string to parse
+ *  size    - where to put the size
  *
  * Returns:
- *  Buffer containing the read result.
+ *  true if the argument was a valid size greater than 0.
  */
-char* read_to_eol(FILE* input, size_t* bytes_read)
+bool parse_size(const char* arg, size_t* size)
 {
-    char*    retbuf = NULL;
-    char     buf[512];
-    growbuf* gb = NULL;
+    char*              end;
+    unsigned long long n;
 
-    gb = growbuf_create(512);
+    errno = 0;
+    n = strtoull(arg, &end, 10);
+    if (0 != errno || end == arg || 0 == n || '-' == arg[0]) {
+        return false;
+    }
 
-    while (!feof(input)) {
-        size_t chunk_bytes_read = fread(buf, 1, sizeof(buf), input);
+    switch (*end) {
+    case 'G': case 'g':
+        n *= 1024;
+        // fall through
+    case 'M': case 'm':
+        n *= 1024;
+        // fall through
+    case 'K': case 'k':
+        n *= 1024;
+        end++;
+        break;
+    }
 
-        bool   got_newline = false;
-        size_t bytes_append;
-        for (bytes_append = 0; bytes_append < chunk_bytes_read; bytes_append++) {
-            if (buf[bytes_append] == '\n') {
-                got_newline = true;
-                break;
-            }
-        }
+    if ('\0' != *end || n > SIZE_MAX) {
+        return false;
+    }
 
-        growbuf_append(gb, buf, bytes_append);
+    *size = (size_t)n;
+    return true;
+}
 
-        if (got_newline) {
-            DEBUG fprintf(stderr, "read %zu bytes, newline after %zu, rewinding %zu\n", chunk_bytes_read, bytes_append, chunk_bytes_read-bytes_append);
+/**
+ * Fingerprint the header line of the input, leaving the input at the start
+ * of it.
+ *
+ * Args:
+ *  input           - input to read
+ *  file_startpos   - position of the header line
+ *  fingerprint     - where to put the fingerprint
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+int header_fingerprint(tsv_input* input, off_t file_startpos, uint64_t* fingerprint)
+{
+    const char* line;
+    size_t      len;
+    int         result;
 
-            fseek(input, -1 * (chunk_bytes_read - bytes_append - 1), SEEK_CUR);
-            goto cleanup;
-        }
+    result = tsv_input_seek(input, file_startpos);
+    if (0 != result) {
+        return result;
     }
 
-cleanup:
-    
+    if (!tsv_input_getline(input, &line, &len)) {
+        line = "";
+        len  = 0;
+    }
+
+    *fingerprint = tsv_layout_fingerprint(line, len);
+
+    return tsv_input_seek(input, file_startpos);
+}
+
+//
+// What save_checkpoint() needs.
+//
+typedef struct
+{
+    const char* filename;
+    tsv_layout* layout;
+    int         output_fd;
+} checkpoint_state;
+
+/**
+ * Save a --checkpoint file. Called by tsv_convert() as it goes.
+ *
+ * Args:
+ *  arg             - the checkpoint_state
+ *  input_offset    - offset of the first line not yet converted
+ *  line_no         - line number there
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+int save_checkpoint(void* arg, off_t input_offset, size_t line_no)
+{
+    checkpoint_state* state = (checkpoint_state*)arg;
+    struct stat       st;
+
     //
-    // free just the growbuf structure, and return the inner buffer
+    // Output is only ever added to the end, so its size is how much of it
+    // there is; with >>, the file offset wouldn't say.
     //
+    if (0 != fstat(state->output_fd, &st)) {
+        return -errno;
+    }
 
-    retbuf = gb->buf;
-    *bytes_read = gb->size;
+    state->layout->input_offset  = (uint64_t)input_offset;
+    state->layout->input_line    = line_no;
+    state->layout->output_offset = (uint64_t)st.st_size;
 
-    free(gb);
-    return retbuf;
+    return tsv_layout_save(state->filename, state->layout);
 }
 
 /**
- * Return a copy of a string with the whitespace trimmed off the start and end.
+ * Read a list of file names, one per line, from stdin.
  *
  * Args:
- *  string  - string to trim
- *  length  - length of the string (not including any null terminator)
+ *  names   - growbuf to append the names to (as char*)
+ *  arena   - arena to allocate the names from
  *
  * Returns:
- *  Copy of the string, with no leading or trailing whitespace.
+ *  -1 * an errno.h error number. 0 on success.
  */
-char* trim(const char* string, size_t length)
+int read_file_list(growbuf* names, growbuf_arena* arena)
 {
-    char* newbuf = (char*)malloc(length+1);
-    bool  start_found = false;
+    char*   line      = NULL;
+    size_t  line_size = 0;
+    ssize_t n;
+    int     result    = 0;
 
-    size_t newbuf_len = 0;
+    while (0 == result && -1 != (n = getline(&line, &line_size, stdin))) {
+        while (n > 0 && ('\n' == line[n - 1] || '\r' == line[n - 1])) {
+            line[--n] = '\0';
+        }
 
-    for (size_t i = 0; i < length; i++) {
-        if (start_found) {
-            newbuf[newbuf_len++] = string[i];
+        if (0 == n) {
+            continue;
         }
-        else if (string[i] != ' ') {
-            newbuf[newbuf_len++] = string[i];
-            start_found = true;
+
+        char* name = growbuf_arena_strndup(arena, line, (size_t)n);
+        if (NULL == name || 0 != growbuf_push(names, char*, name)) {
+            result = -ENOMEM;
         }
     }
 
-    newbuf[newbuf_len] = '\0';
-    
-    for (size_t i = newbuf_len - 1; i >= 0; i--) {
-        if (newbuf[i] == ' ') {
-            newbuf[i] = '\0';
-        }
-        else {
+    if (0 == result && ferror(stdin)) {
+        result = -EIO;
+    }
+
+    free(line);
+    return result;
+}
+
+/**
+ * Run a batch conversion and summarize how it went.
+ *
+ * Args:
+ *  inputs      - names of the files to convert (as const char*)
+ *  options     - how to convert them
+ *  pool        - thread pool to convert on, or NULL
+ *
+ * Returns:
+ *  One of the EX_* constants from sysexit.h: EX_OK if every file was
+ *  converted, otherwise the status for the first one which wasn't.
+ */
+int run_batch(const growbuf* inputs, const tsv_batch_options* options, tsv_threadpool* pool)
+{
+    size_t num_inputs = growbuf_num_elems(inputs, const char*);
+    int*   results    = (int*)calloc(num_inputs + 1, sizeof(int));
+    int    retval     = EX_OK;
+
+    if (NULL == results) {
+        fprintf(stderr, "malloc failed\n");
+        return EX_OSERR;
+    }
+
+    size_t failures = tsv_batch_convert((const char* const*)inputs->buf, num_inputs, options, pool, results);
+
+    for (size_t i = 0; i < num_inputs && EX_OK == retval; i++) {
+        switch (-results[i]) {
+        case 0:
+            break;
+        case ENOENT:
+        case EACCES:
+            retval = EX_NOINPUT;
+            break;
+        case EEXIST:
+            retval = EX_CANTCREAT;
+            break;
+        case ENOMEM:
+            retval = EX_OSERR;
+            break;
+        case EILSEQ:
+            retval = EX_DATAERR;
+            break;
+        default:
+            retval = EX_IOERR;
             break;
         }
     }
 
-    return newbuf;
+    if (failures > 0) {
+        fprintf(stderr, "%zu of %zu files failed\n", failures, num_inputs);
+    }
+
+    free(results);
+    return retval;
+}
+
+/**
+ * Report how a conversion went.
+ *
+ * Args:
+ *  result  - what tsv_convert() returned
+ *  input   - the input it converted
+ *
+ * Returns:
+ *  One of the EX_* constants from sysexit.h
+ */
+int convert_status(int result, tsv_input* input)
+{
+    if (0 == result) {
+        return EX_OK;
+    }
+    else if (-ENOMEM == result) {
+        fprintf(stderr, "malloc failed\n");
+        return EX_OSERR;
+    }
+    else if (-EILSEQ == result) {
+        // tsv_convert already said which line
+        return EX_DATAERR;
+    }
+    else if (-ENOTSUP == result && 0 != tsv_input_error(input)) {
+        fprintf(stderr, "Error: input is compressed with zstd, which needs a build with ZSTD=1\n");
+        return EX_DATAERR;
+    }
+    else if (0 != tsv_input_error(input)) {
+        fprintf(stderr, "Error reading input: %s\n", strerror(-result));
+        return (-EBADMSG == result) ? EX_DATAERR : EX_IOERR;
+    }
+
+    fprintf(stderr, "Error writing output: %s\n", strerror(-result));
+    return EX_IOERR;
+}
+
+/**
+ * Convert each section of the input with its own layout, one after another.
+ *
+ * Args:
+ *  input           - in-memory input
+ *  file_startpos   - position in the input where the first section starts
+ *  format          - output format
+ *  columns         - columns to write, for tsv_parse_columns(), or NULL for
+ *                    all; names are looked up in each section's header line
+ *  where           - --where specs (as const char*), likewise. Sections
+ *                    which don't have the columns these name are skipped.
+ *  drop_headers    - leave out the header rows of sections whose header line
+ *                    repeats the first section's
+ *  options         - conversion options; the writer, filter, line numbers
+ *                    and end of each section are filled in here
+ *  output          - where to write the output
+ *  pool            - thread pool to detect and convert on, or NULL
+ *
+ * Returns:
+ *  One of the EX_* constants from sysexit.h
+ */
+int run_sections(tsv_input* input, off_t file_startpos, tsv_format format, const char* columns, const growbuf* where,
+        bool drop_headers, tsv_convert_options* options, const tsv_sink* output, tsv_threadpool* pool)
+{
+    const tsv_lineindex* lines    = tsv_input_lines(input);
+    growbuf*             sections = NULL;
+    growbuf*             scratch  = NULL;
+    tsv_writer*          writer   = NULL;
+    tsv_filter*          filter   = NULL;
+    size_t               skipped  = 0;
+    int                  retval   = EX_OK;
+    int                  result;
+
+    sections = growbuf_create(initial_field_count * sizeof(tsv_section));
+    scratch  = growbuf_create(section_output_size);
+    if (NULL == sections || NULL == scratch) {
+        fprintf(stderr, "malloc failed\n");
+        retval = EX_OSERR;
+        goto cleanup;
+    }
+
+    tsv_stats_begin(options->stats, TSV_PHASE_DETECT);
+
+    result = tsv_find_sections(input, file_startpos, pool, sections);
+    if (-EINVAL == result) {
+        fprintf(stderr, "Error: --sections needs the input in memory\n");
+        retval = EX_USAGE;
+        goto cleanup;
+    }
+    else if (0 != result) {
+        fprintf(stderr, "Error finding sections: %s\n", strerror(-result));
+        retval = (-ENOMEM == result) ? EX_OSERR : EX_IOERR;
+        goto cleanup;
+    }
+
+    tsv_stats_begin(options->stats, TSV_PHASE_CONVERT);
+
+    //
+    // One section after another is written to the same buffer; a
+    // write-behind thread apiece isn't worth it.
+    //
+    options->scratch      = scratch;
+    options->write_behind = false;
+
+    for (size_t s = 0; s < growbuf_num_elems(sections, tsv_section); s++) {
+        const tsv_section* section  = &growbuf_index(sections, s, tsv_section);
+        const size_t*      lengths  = (const size_t*)section->field_lengths->buf;
+        off_t              startpos = (off_t)section->start;
+
+        DEBUG fprintf(stderr, "section at line %zu: %zu fields\n", section->first_line + 1, section->num_fields);
+
+        if (growbuf_num_elems(where, char*) > 0) {
+            size_t bad = 0;
+
+            result = tsv_create_filter((const char* const*)where->buf, growbuf_num_elems(where, char*),
+                    input, lengths, section->num_fields, startpos, &filter, &bad);
+            if (-EINVAL == result) {
+                DEBUG fprintf(stderr, "section at line %zu: no columns for --where \"%s\"\n",
+                        section->first_line + 1, growbuf_index(where, bad, char*));
+                skipped++;
+                continue;
+            }
+            else if (0 != result) {
+                fprintf(stderr, "Error reading the header line: %s\n", strerror(-result));
+                retval = (-ENOMEM == result) ? EX_OSERR : EX_IOERR;
+                goto cleanup;
+            }
+        }
+
+        result = tsv_create_writer(format, columns, input, lengths, section->num_fields, &startpos, &writer);
+        if (-EINVAL == result) {
+            DEBUG fprintf(stderr, "section at line %zu: no columns for --columns\n", section->first_line + 1);
+            tsv_filter_free(filter);
+            filter = NULL;
+            skipped++;
+            continue;
+        }
+        else if (0 != result) {
+            fprintf(stderr, "Error reading the header line: %s\n", strerror(-result));
+            retval = (-ENOMEM == result) ? EX_OSERR : EX_IOERR;
+            goto cleanup;
+        }
+
+        options->writer        = writer;
+        options->filter        = filter;
+        options->first_line_no = section->first_line + 1;
+        options->end_offset    = (off_t)tsv_lineindex_offset(lines, section->end_line);
+        options->continuing    = false;
+
+        if (NULL != writer && writer->skip_header) {
+            options->first_line_no++;
+        }
+        else if (drop_headers && section->repeated_header) {
+            // start after the header line, and don't write it as a row either
+            startpos = (off_t)tsv_lineindex_offset(lines, section->first_line + 1);
+            options->first_line_no++;
+            options->continuing = true;
+        }
+
+        result = tsv_convert(input, section->field_lengths, section->num_fields, startpos, options, output);
+        retval = convert_status(result, input);
+        if (EX_OK != retval) {
+            goto cleanup;
+        }
+
+        tsv_writer_free(writer);
+        tsv_filter_free(filter);
+        writer = NULL;
+        filter = NULL;
+    }
+
+    if (skipped > 0 && skipped == growbuf_num_elems(sections, tsv_section)) {
+        fprintf(stderr, "Error: no section has the columns asked for\n");
+        retval = EX_USAGE;
+    }
+    else if (skipped > 0) {
+        fprintf(stderr, "Skipped %zu of %zu sections, which don't have the columns asked for\n",
+                skipped, growbuf_num_elems(sections, tsv_section));
+    }
+
+cleanup:
+    tsv_writer_free(writer);
+    tsv_filter_free(filter);
+    growbuf_free(scratch);
+    tsv_free_sections(sections);
+
+    return retval;
 }
 
 /**
@@ -149,20 +553,58 @@ int main(int argc, char** argv)
 {
     int         retval        = EX_OK;
     const char* inFilename    = NULL;
-    char        tempFilename[16] = "";
-    FILE*       input         = NULL;
-    FILE*       output        = stdout;
+    growbuf*    inputs        = NULL;
+    bool        batch         = false;
+    growbuf_arena* input_names = NULL;   // names of inputs read from stdin
+    const char* output_dir    = NULL;
+    tsv_input*  input         = NULL;
+    tsv_sink    output        = { .fd = STDOUT_FILENO };
     growbuf*    field_lengths = NULL;
     size_t      num_fields    = 0;
-    char*       buf           = NULL;
-    size_t      bytes_read    = 0;
-    size_t      field_len     = 0;
     size_t      start_line    = 1;
     int         tab_width     = 8;
-    long        file_startpos = 0;
+    off_t       file_startpos = 0;
     bool        convert_tabs  = true;
+    bool        use_mmap      = true;
+    bool        stream        = false;
+    bool        sections      = false;
+    bool        drop_headers  = false;  // --drop-repeated-headers
+    size_t      split_runs    = 0;      // --split-runs; 0 to detect columns
+    size_t      window_lines  = default_window_lines;
+    size_t      window_bytes  = default_window_bytes;
+    bool        policy_set    = false;
+    bool        tabs_set      = false;
+    bool        start_line_set = false;
+    const char* save_layout   = NULL;
+    const char* load_layout   = NULL;
+    bool        verify_layout = false;
+    bool        want_stats    = tsv_stats_requested();
+    tsv_stats*  stats         = NULL;
+    tsv_layout  layout        = { 0 };
+    tsv_convert_options options = { 0 };
+    tsv_format  format        = TSV_FORMAT_CSV;
+    tsv_writer* writer        = NULL;
+    const char* columns       = NULL;
+    growbuf*    where         = NULL;   // --where specs, as const char*
+    tsv_filter* filter        = NULL;
+    const char* follow        = NULL;   // --follow state file
+    const char* checkpoint    = NULL;   // --checkpoint state file
+    const char* state_file    = NULL;   // whichever of those there is
+    bool        resume        = false;  // it exists already
+    checkpoint_state checkpoint_arg;
+    off_t       header_pos    = -1;
+    size_t      num_threads   = tsv_threadpool_default_size();
+    tsv_threadpool* pool      = NULL;
     bool        parse_flags   = true;
 
+    inputs = growbuf_create(initial_field_count * sizeof(char*));
+    where  = growbuf_create(initial_field_count * sizeof(char*));
+    if (NULL == inputs || NULL == where) {
+        fprintf(stderr, "malloc failed\n");
+        retval = EX_OSERR;
+        goto cleanup;
+    }
+
     for (size_t i = 1; i < argc; i++) {
         if (0 == strcmp("--", argv[i])) {
             parse_flags = false;
@@ -177,9 +619,193 @@ int main(int argc, char** argv)
         }
         else if (parse_flags && argv[i][0] == '+') {
             start_line = atoi(argv[i] + 1);
+            start_line_set = true;
         }
         else if (parse_flags && 0 == strcmp("--notabs", argv[i])) {
             convert_tabs = false;
+            tabs_set = true;
+        }
+        else if (parse_flags && 0 == strcmp("--no-mmap", argv[i])) {
+            use_mmap = false;
+        }
+        else if (parse_flags && 0 == strcmp("--stream", argv[i])) {
+            stream = true;
+        }
+        else if (parse_flags && 0 == strcmp("--sections", argv[i])) {
+            sections = true;
+        }
+        else if (parse_flags && 0 == strcmp("--drop-repeated-headers", argv[i])) {
+            drop_headers = true;
+        }
+        else if (parse_flags && 0 == strcmp("--split-runs", argv[i])) {
+            if (i + 1 == argc) {
+                fprintf(stderr, "the --split-runs flag requires an argument.\n");
+                retval = EX_USAGE;
+                goto cleanup;
+            }
+
+            int n = atoi(argv[i+1]);
+            if (n < 1) {
+                fprintf(stderr, "invalid --split-runs.\n");
+                retval = EX_USAGE;
+                goto cleanup;
+            }
+
+            split_runs = (size_t)n;
+            i++;
+        }
+        else if (parse_flags && 
+                    (0 == strcmp("--window-lines", argv[i])
+                        || 0 == strcmp("--window-bytes", argv[i])
+                    )
+                )
+        {
+            if (i + 1 == argc) {
+                fprintf(stderr, "the %s flag requires an argument.\n", argv[i]);
+                retval = EX_USAGE;
+                goto cleanup;
+            }
+
+            size_t* limit = (0 == strcmp("--window-lines", argv[i])) ? &window_lines : &window_bytes;
+            if (!parse_size(argv[i+1], limit)) {
+                fprintf(stderr, "invalid %s.\n", argv[i] + 2);
+                retval = EX_USAGE;
+                goto cleanup;
+            }
+
+            i++;
+        }
+        else if (parse_flags && 
+                    (0 == strcmp("--save-layout", argv[i])
+                        || 0 == strcmp("--layout", argv[i])
+                    )
+                )
+        {
+            if (i + 1 == argc) {
+                fprintf(stderr, "the %s flag requires an argument.\n", argv[i]);
+                retval = EX_USAGE;
+                goto cleanup;
+            }
+
+            if (0 == strcmp("--layout", argv[i])) {
+                load_layout = argv[i+1];
+            }
+            else {
+                save_layout = argv[i+1];
+            }
+
+            i++;
+        }
+        else if (parse_flags && 0 == strcmp("--verify-layout", argv[i])) {
+            verify_layout = true;
+        }
+        else if (parse_flags && 0 == strcmp("--stats", argv[i])) {
+            want_stats = true;
+        }
+        else if (parse_flags && 0 == strcmp("--batch", argv[i])) {
+            batch = true;
+        }
+        else if (parse_flags && 
+                    (0 == strcmp("--output-dir", argv[i])
+                        || 0 == strcmp("-o", argv[i])
+                    )
+                )
+        {
+            if (i + 1 == argc) {
+                fprintf(stderr, "the -o/--output-dir flag requires an argument.\n");
+                retval = EX_USAGE;
+                goto cleanup;
+            }
+
+            output_dir = argv[i+1];
+            i++;
+        }
+        else if (parse_flags && 0 == strcmp("--columns", argv[i])) {
+            if (i + 1 == argc) {
+                fprintf(stderr, "the --columns flag requires an argument.\n");
+                retval = EX_USAGE;
+                goto cleanup;
+            }
+
+            columns = argv[i+1];
+            i++;
+        }
+        else if (parse_flags && 
+                    (0 == strcmp("--follow", argv[i])
+                        || 0 == strcmp("--checkpoint", argv[i])
+                    )
+                )
+        {
+            if (i + 1 == argc) {
+                fprintf(stderr, "the %s flag requires an argument.\n", argv[i]);
+                retval = EX_USAGE;
+                goto cleanup;
+            }
+
+            if (0 == strcmp("--follow", argv[i])) {
+                follow = argv[i+1];
+            }
+            else {
+                checkpoint = argv[i+1];
+            }
+            state_file = argv[i+1];
+
+            i++;
+        }
+        else if (parse_flags && 0 == strcmp("--where", argv[i])) {
+            if (i + 1 == argc) {
+                fprintf(stderr, "the --where flag requires an argument.\n");
+                retval = EX_USAGE;
+                goto cleanup;
+            }
+
+            if (0 != growbuf_append(where, &argv[i+1], sizeof(char*))) {
+                fprintf(stderr, "malloc failed\n");
+                retval = EX_OSERR;
+                goto cleanup;
+            }
+            i++;
+        }
+        else if (parse_flags && 0 == strcmp("--format", argv[i])) {
+            if (i + 1 == argc) {
+                fprintf(stderr, "the --format flag requires an argument.\n");
+                retval = EX_USAGE;
+                goto cleanup;
+            }
+
+            i++;
+            if (0 != tsv_parse_format(argv[i], &format)) {
+                fprintf(stderr, "invalid --format \"%s\".\n", argv[i]);
+                retval = EX_USAGE;
+                goto cleanup;
+            }
+        }
+        else if (parse_flags && 0 == strcmp("--on-violation", argv[i])) {
+            if (i + 1 == argc) {
+                fprintf(stderr, "the --on-violation flag requires an argument.\n");
+                retval = EX_USAGE;
+                goto cleanup;
+            }
+
+            i++;
+            if (0 == strcmp("ignore", argv[i])) {
+                options.on_violation = TSV_VIOLATION_IGNORE;
+            }
+            else if (0 == strcmp("warn", argv[i])) {
+                options.on_violation = TSV_VIOLATION_WARN;
+            }
+            else if (0 == strcmp("widen", argv[i])) {
+                options.on_violation = TSV_VIOLATION_WIDEN;
+            }
+            else if (0 == strcmp("fail", argv[i])) {
+                options.on_violation = TSV_VIOLATION_FAIL;
+            }
+            else {
+                fprintf(stderr, "invalid --on-violation policy \"%s\".\n", argv[i]);
+                retval = EX_USAGE;
+                goto cleanup;
+            }
+            policy_set = true;
         }
         else if (parse_flags && 
                     (0 == strcmp("--tabwidth", argv[i])
@@ -199,201 +825,552 @@ int main(int argc, char** argv)
                 retval = EX_USAGE;
                 goto cleanup;
             }
+            tabs_set = true;
 
             i++;
         }
-        else if (NULL == inFilename) {
-            inFilename = argv[i];
+        else if (parse_flags && 
+                    (0 == strcmp("--threads", argv[i])
+                        || 0 == strcmp("-j", argv[i])
+                    )
+                )
+        {
+            if (i + 1 == argc) {
+                fprintf(stderr, "the -j/--threads flag requires an argument.\n");
+                retval = EX_USAGE;
+                goto cleanup;
+            }
+
+            int n = atoi(argv[i+1]);
+            if (n < 1) {
+                fprintf(stderr, "invalid number of threads.\n");
+                retval = EX_USAGE;
+                goto cleanup;
+            }
+
+            num_threads = (size_t)n;
+            i++;
         }
-        else {
-            fprintf(stderr, "Error: extra unknown argument \"%s\"\n", argv[i]);
-            retval = EX_USAGE;
+        else if (0 != growbuf_append(inputs, &argv[i], sizeof(char*))) {
+            fprintf(stderr, "malloc failed\n");
+            retval = EX_OSERR;
             goto cleanup;
         }
     }
 
-    if (NULL == inFilename) {
+    if (batch) {
+        if (NULL == output_dir) {
+            fprintf(stderr, "--batch requires -o/--output-dir.\n");
+            retval = EX_USAGE;
+            goto cleanup;
+        }
+
+        if (stream || NULL != save_layout) {
+            fprintf(stderr, "--batch can't be used with --stream or --save-layout.\n");
+            retval = EX_USAGE;
+            goto cleanup;
+        }
+    }
+    else if (growbuf_num_elems(inputs, char*) > 1) {
+        fprintf(stderr, "Error: extra unknown argument \"%s\"\n", growbuf_index(inputs, 1, char*));
+        retval = EX_USAGE;
+        goto cleanup;
+    }
+    else if (growbuf_num_elems(inputs, char*) == 1) {
+        inFilename = growbuf_index(inputs, 0, char*);
+    }
+    else {
         inFilename = "/dev/stdin";
     }
 
-    input = fopen(inFilename, "r");
-    if (NULL == input) {
-        perror("Error opening input stream");
-        retval = EX_NOINPUT;
+    if (NULL != follow) {
+        if (batch || stream || 0 == growbuf_num_elems(inputs, char*)) {
+            fprintf(stderr, "--follow requires an input file, and can't be used with --batch or --stream.\n");
+            retval = EX_USAGE;
+            goto cleanup;
+        }
+
+        if (TSV_FORMAT_PGBINARY == format) {
+            fprintf(stderr, "--follow can't be used with --format pgbinary.\n");
+            retval = EX_USAGE;
+            goto cleanup;
+        }
+
+        //
+        // Carrying on from a previous run: the state file has the layout,
+        // and reading from the middle of the file doesn't need it mapped.
+        //
+        if (0 == access(follow, F_OK)) {
+            load_layout = follow;
+            resume      = true;
+            use_mmap    = false;
+        }
+    }
+
+    if (NULL != checkpoint) {
+        struct stat st;
+
+        if (batch || stream || NULL != follow || 0 == growbuf_num_elems(inputs, char*)) {
+            fprintf(stderr, "--checkpoint requires an input file, and can't be used with --batch, --stream, or --follow.\n");
+            retval = EX_USAGE;
+            goto cleanup;
+        }
+
+        if (0 != fstat(output.fd, &st) || !S_ISREG(st.st_mode)) {
+            fprintf(stderr, "--checkpoint requires the output to be a file.\n");
+            retval = EX_USAGE;
+            goto cleanup;
+        }
+
+        if (0 == access(checkpoint, F_OK)) {
+            load_layout = checkpoint;
+            resume      = true;
+        }
+    }
+
+    if (sections) {
+        if (batch || stream || !use_mmap || NULL != load_layout || NULL != save_layout || NULL != state_file) {
+            fprintf(stderr, "--sections can't be used with --batch, --stream, --no-mmap, --layout, --save-layout, --follow, or --checkpoint.\n");
+            retval = EX_USAGE;
+            goto cleanup;
+        }
+
+        if (TSV_FORMAT_PGBINARY == format) {
+            fprintf(stderr, "--sections can't be used with --format pgbinary.\n");
+            retval = EX_USAGE;
+            goto cleanup;
+        }
+    }
+    else if (drop_headers) {
+        fprintf(stderr, "--drop-repeated-headers requires --sections.\n");
+        retval = EX_USAGE;
+        goto cleanup;
+    }
+
+    if (split_runs > 0) {
+        if (batch || stream || sections || NULL != load_layout || NULL != save_layout || NULL != state_file
+                || NULL != columns || growbuf_num_elems(where, char*) > 0 || TSV_FORMAT_CSV != format)
+        {
+            fprintf(stderr, "--split-runs only writes CSV, and can't be used with --batch, --stream, --sections, --layout, "
+                    "--save-layout, --follow, --checkpoint, --columns, or --where.\n");
+            retval = EX_USAGE;
+            goto cleanup;
+        }
+    }
+
+    if (want_stats) {
+        stats = tsv_stats_create();
+        if (NULL == stats) {
+            fprintf(stderr, "malloc failed\n");
+            retval = EX_OSERR;
+            goto cleanup;
+        }
+        options.stats = stats;
+    }
+
+    if (verify_layout && NULL == load_layout) {
+        fprintf(stderr, "--verify-layout requires --layout.\n");
+        retval = EX_USAGE;
         goto cleanup;
     }
 
-    if (convert_tabs) {
+    field_lengths = growbuf_create(initial_field_count * sizeof(size_t));
+    if (NULL == field_lengths) {
+        fprintf(stderr, "malloc failed\n");
+        retval = EX_OSERR;
+        goto cleanup;
+    }
+    layout.field_lengths = field_lengths;
+
+    if (NULL != load_layout) {
+        int result = tsv_layout_load(load_layout, &layout);
+        if (0 != result) {
+            fprintf(stderr, "Error reading layout file %s: %s\n", load_layout, strerror(-result));
+            retval = (-EINVAL == result || -ENOTSUP == result) ? EX_DATAERR : EX_NOINPUT;
+            goto cleanup;
+        }
+
         //
-        // Convert input file to an all space-separated temp file
+        // Options given explicitly win over the saved ones.
         //
 
-        int   fd         = -1;
-        FILE* tempOutput = NULL;
+        if (!tabs_set) {
+            convert_tabs = (layout.tab_width > 0);
+            tab_width    = convert_tabs ? layout.tab_width : tab_width;
+        }
 
-        strncpy(tempFilename, "/tmp/tsv.XXXXXX", sizeof(tempFilename));
-        fd = mkstemp(tempFilename);
-        if (-1 == fd) {
-            perror("Error making temporary file");
-            retval = EX_OSERR;
+        if (!start_line_set) {
+            start_line = layout.start_line;
+        }
+
+        if (verify_layout && !policy_set) {
+            options.on_violation = TSV_VIOLATION_FAIL;
+            policy_set = true;
+        }
+
+        if (resume && !layout.has_position) {
+            fprintf(stderr, "Error: %s has no position to carry on from\n", state_file);
+            retval = EX_DATAERR;
+            goto cleanup;
+        }
+    }
+
+    if (resume && NULL != checkpoint) {
+        //
+        // Drop whatever was written after the checkpoint. The output has to
+        // have been appended to (>>), not truncated, for there to be any.
+        //
+        struct stat st;
+
+        if (0 != fstat(output.fd, &st) || (uint64_t)st.st_size < layout.output_offset) {
+            fprintf(stderr, "Error: the output is shorter than at the checkpoint in %s; "
+                    "append to it with >> to carry on\n", checkpoint);
+            retval = EX_DATAERR;
             goto cleanup;
         }
 
-        DEBUG fprintf(stderr, "converting tabs to temp file %s\n", tempFilename);
+        if (0 != ftruncate(output.fd, (off_t)layout.output_offset)
+                || -1 == lseek(output.fd, (off_t)layout.output_offset, SEEK_SET))
+        {
+            fprintf(stderr, "Error truncating the output: %s\n", strerror(errno));
+            retval = EX_IOERR;
+            goto cleanup;
+        }
+    }
 
-        tempOutput = fdopen(fd, "w");
-        if (NULL == tempOutput) {
-            perror("Error opening temp file");
+    if (!policy_set) {
+        //
+        // Without the whole table to detect columns from, rows which don't
+        // fit them are to be expected, so say so.
+        //
+        options.on_violation = stream ? TSV_VIOLATION_WARN : TSV_VIOLATION_IGNORE;
+    }
+
+    if (num_threads > 1) {
+        pool = tsv_threadpool_create(num_threads);
+        if (NULL == pool) {
+            fprintf(stderr, "Error starting threads\n");
             retval = EX_OSERR;
             goto cleanup;
         }
-        
-        size_t i = 0;
-        int c;
-        while (EOF != (c = fgetc(input))) {
-            if ('\t' == c) {
-                for (size_t j = (i % tab_width); j < tab_width; j++) {
-                    fputc(' ', tempOutput);
-                    i++;
-                }
+    }
+
+    if (batch) {
+        tsv_batch_options batch_options = {
+            .output_dir   = output_dir,
+            .format       = format,
+            .columns      = columns,
+            .where        = (const char* const*)where->buf,
+            .num_where    = growbuf_num_elems(where, char*),
+            .tab_width    = convert_tabs ? tab_width : 0,
+            .start_line   = start_line,
+            .use_mmap     = use_mmap,
+            .layout       = (NULL != load_layout) ? &layout : NULL,
+            .on_violation = options.on_violation,
+            .stats        = stats,
+        };
+
+        if (0 == growbuf_num_elems(inputs, char*)) {
+            input_names = growbuf_arena_create(64 * 1024);
+            if (NULL == input_names) {
+                fprintf(stderr, "malloc failed\n");
+                retval = EX_OSERR;
+                goto cleanup;
             }
-            else {
-                if ('\n' == c) {
-                    i = 0;
-                }
-                else {
-                    i++;
-                }
-                fputc(c, tempOutput);
+
+            if (0 != read_file_list(inputs, input_names)) {
+                fprintf(stderr, "Error reading the list of input files\n");
+                retval = EX_IOERR;
+                goto cleanup;
             }
         }
 
-        fclose(input);
-        fclose(tempOutput);
-        input = fopen(tempFilename, "r");
+        tsv_stats_begin(stats, TSV_PHASE_CONVERT);
+        retval = run_batch(inputs, &batch_options, pool);
+        goto cleanup;
     }
 
-    field_lengths = growbuf_create(initial_field_count * sizeof(size_t));
-    if (NULL == field_lengths) {
+    tsv_stats_begin(stats, TSV_PHASE_OPEN);
+
+    if (split_runs > 0) {
+        // nothing is read twice, so there's no need for a window
+        input = tsv_input_open_stream(inFilename, 0, 0);
+    }
+    else if (stream) {
+        input = tsv_input_open_stream(inFilename, window_lines, window_bytes);
+    }
+    else {
+        input = tsv_input_open(inFilename, use_mmap);
+    }
+    if (NULL == input && ENOTSUP == errno) {
+        fprintf(stderr, "Error: input is compressed with zstd, which needs a build with ZSTD=1\n");
+        retval = EX_DATAERR;
+        goto cleanup;
+    }
+    else if (NULL == input) {
+        perror("Error opening input stream");
+        retval = EX_NOINPUT;
+        goto cleanup;
+    }
+
+    if (convert_tabs && 0 != tsv_input_set_tab_width(input, tab_width)) {
         fprintf(stderr, "malloc failed\n");
         retval = EX_OSERR;
         goto cleanup;
     }
 
+    tsv_input_set_stats(input, stats);
+
     //
     // Skip to the start line
     //
 
-    for (size_t line_no = 1; line_no < start_line; /* nothing */) {
-        int c = fgetc(input);
-        if ((char)c == '\n') {
-            line_no++;
+    int result = (start_line > 1) ? tsv_input_seek_line(input, start_line - 1) : 0;
+    if (0 != result) {
+        fprintf(stderr, "Error skipping to the start line: %s\n", strerror(-result));
+        retval = EX_IOERR;
+        goto cleanup;
+    }
+    file_startpos = tsv_input_tell(input);
+
+    if (split_runs > 0) {
+        options.write_behind = true;
+
+        tsv_stats_begin(stats, TSV_PHASE_CONVERT);
+        result = tsv_convert_runs(input, split_runs, &options, &output);
+        retval = convert_status(result, input);
+        goto cleanup;
+    }
+
+    if (sections) {
+        options.pool     = pool;
+        options.messages = stderr;
+
+        retval = run_sections(input, file_startpos, format, columns, where, drop_headers, &options, &output, pool);
+        goto cleanup;
+    }
+
+    //
+    // Figure out the field lengths, unless they were saved already.
+    //
+
+    tsv_stats_begin(stats, TSV_PHASE_DETECT);
+
+    if (NULL != load_layout) {
+        num_fields = layout.num_fields;
+
+        if (verify_layout || resume) {
+            uint64_t fingerprint;
+
+            result = header_fingerprint(input, file_startpos, &fingerprint);
+            if (0 != result) {
+                fprintf(stderr, "Error reading input: %s\n", strerror(-result));
+                retval = EX_IOERR;
+                goto cleanup;
+            }
+
+            if (fingerprint != layout.fingerprint) {
+                fprintf(stderr, "Error: the header line doesn't match layout file %s\n", load_layout);
+                retval = EX_DATAERR;
+                goto cleanup;
+            }
         }
-        if (c == EOF) {
+    }
+    else {
+        num_fields = tsv_get_field_lengths(input, field_lengths, file_startpos, pool);
+        if (0 == num_fields) {
+            retval = EX_OSERR;
             goto cleanup;
         }
     }
-    file_startpos = ftell(input);
 
-    //
-    // Figure out the field lengths.
-    //
+    if (NULL != save_layout) {
+        layout.num_fields = num_fields;
+        layout.tab_width  = convert_tabs ? tab_width : 0;
+        layout.start_line = start_line;
+
+        result = header_fingerprint(input, file_startpos, &layout.fingerprint);
+        if (0 == result) {
+            result = tsv_layout_save(save_layout, &layout);
+        }
 
-    num_fields = tsv_get_field_lengths(input, field_lengths, file_startpos);
+        if (0 != result) {
+            fprintf(stderr, "Error saving layout file %s: %s\n", save_layout, strerror(-result));
+            retval = EX_CANTCREAT;
+            goto cleanup;
+        }
+    }
     
     DEBUG
     for (size_t i = 0; i < num_fields; i++) {
         fprintf(stderr, "field %zu: %zu\n", i, ((size_t*)field_lengths->buf)[i]);
     }
 
-    fseek(input, file_startpos, SEEK_SET);
-
     //
     // Read the fields.
     //
 
-    while (!feof(input)) {
+    header_pos = file_startpos;
 
-        for (size_t i = 0; i < num_fields; i++) {
-            field_len = ((size_t*)field_lengths->buf)[i];
+    if (growbuf_num_elems(where, char*) > 0) {
+        size_t bad = 0;
 
-            if (0 == field_len) {
-                //
-                // 0 is a special case, it means "read to end of line"
-                //
+        result = tsv_create_filter((const char* const*)where->buf, growbuf_num_elems(where, char*),
+                input, (const size_t*)field_lengths->buf, num_fields, file_startpos, &filter, &bad);
+        if (-EINVAL == result) {
+            fprintf(stderr, "Error: invalid --where \"%s\"\n", growbuf_index(where, bad, char*));
+            retval = EX_USAGE;
+            goto cleanup;
+        }
+        else if (0 != result) {
+            fprintf(stderr, "Error reading the header line: %s\n", strerror(-result));
+            retval = (-ENOMEM == result) ? EX_OSERR : EX_IOERR;
+            goto cleanup;
+        }
+    }
 
-                buf = read_to_eol(input, &bytes_read);
+    result = tsv_create_writer(format, columns, input, (const size_t*)field_lengths->buf, num_fields, &file_startpos, &writer);
+    if (-EINVAL == result) {
+        fprintf(stderr, "Error: --columns \"%s\" doesn't match the table's columns\n", columns);
+        retval = EX_USAGE;
+        goto cleanup;
+    }
+    else if (0 != result) {
+        fprintf(stderr, "Error reading the header line: %s\n", strerror(-result));
+        retval = (-ENOMEM == result) ? EX_OSERR : EX_IOERR;
+        goto cleanup;
+    }
 
-                DEBUG fprintf(stderr, "got %zu bytes to eol: ", bytes_read);
-                DEBUG fwrite(buf, 1, bytes_read, stderr);
-            }
-            else {
-                buf = (char*)malloc(field_len + 1);
-                if (NULL == buf) {
-                    fprintf(stderr, "malloc failed\n");
-                    retval = EX_OSERR;
-                    goto cleanup;
-                }
+    options.pool          = pool;
+    options.first_line_no = start_line;
+    options.messages      = stderr;
+    options.writer        = writer;
+    options.filter        = filter;
+    options.write_behind  = true;
 
-                bytes_read = fread(buf, 1, field_len, input);
+    if (NULL != writer && writer->skip_header) {
+        options.first_line_no++;
+    }
 
-                DEBUG fprintf(stderr, "got %zu bytes: ", bytes_read);
-                DEBUG fwrite(buf, 1, bytes_read, stderr);
-            }
+    TSV_STATS_ADD(stats, columns, num_fields);
+    tsv_stats_begin(stats, TSV_PHASE_CONVERT);
 
-            if (0 == bytes_read) {
-                //
-                // EOL or error; don't continue
-                //
-                if (NULL != buf) {
-                    free(buf);
-                    buf = NULL;
-                }
-                break;
-            }
+    if (NULL != state_file && !resume) {
+        layout.num_fields    = num_fields;
+        layout.tab_width     = convert_tabs ? tab_width : 0;
+        layout.start_line    = start_line;
+        layout.has_position  = true;
+        layout.input_offset  = file_startpos;
+        layout.input_line    = options.first_line_no;
+        layout.output_offset = 0;
 
-            //
-            // trim any whitespace from the field
-            //
+        result = header_fingerprint(input, header_pos, &layout.fingerprint);
+        if (0 != result) {
+            fprintf(stderr, "Error reading input: %s\n", strerror(-result));
+            retval = EX_IOERR;
+            goto cleanup;
+        }
+    }
 
-            char* trimmed = trim(buf, bytes_read);
+    if (NULL != follow) {
+        if (TSV_COMPRESSION_NONE != input->compression) {
+            fprintf(stderr, "Error: --follow can't follow %s-compressed input\n", tsv_compression_name(input->compression));
+            retval = EX_USAGE;
+            goto cleanup;
+        }
 
-            //
-            // write the csv field
-            //
+        if (resume || (NULL != writer && writer->skip_header)) {
+            // no header line to write, unfiltered or otherwise
+            header_pos = -1;
+        }
 
-            print_csv_field(trimmed, output);
+        tsv_input_close(input);
+        input = NULL;
 
-            if (i == num_fields - 1) {
-                fwrite("\n", 1, 1, output);
-            }
-            else {
-                fwrite(",", 1, 1, output);
+        result = tsv_follow(inFilename, follow, &layout, header_pos, &options, &output);
+        if (-ENOMEM == result) {
+            fprintf(stderr, "malloc failed\n");
+            retval = EX_OSERR;
+        }
+        else if (-EILSEQ == result) {
+            retval = EX_DATAERR;
+        }
+        else if (-ESTALE == result) {
+            fprintf(stderr, "Error: %s was truncated, moved, or deleted\n", inFilename);
+            retval = EX_DATAERR;
+        }
+        else {
+            fprintf(stderr, "Error following %s: %s\n", inFilename, strerror(-result));
+            retval = EX_IOERR;
+        }
+        goto cleanup;
+    }
+
+    if (NULL != checkpoint) {
+        checkpoint_arg.filename  = checkpoint;
+        checkpoint_arg.layout    = &layout;
+        checkpoint_arg.output_fd = output.fd;
+
+        if (resume) {
+            file_startpos         = (off_t)layout.input_offset;
+            options.first_line_no = layout.input_line;
+            options.continuing    = true;
+        }
+        else {
+            //
+            // Save one before starting, so there's always one to carry on
+            // from once anything has been written.
+            //
+            result = save_checkpoint(&checkpoint_arg, file_startpos, options.first_line_no);
+            if (0 != result) {
+                fprintf(stderr, "Error saving checkpoint file %s: %s\n", checkpoint, strerror(-result));
+                retval = EX_CANTCREAT;
+                goto cleanup;
             }
+        }
 
-            free(buf);
-            free(trimmed);
-            buf = NULL;
+        options.checkpoint     = save_checkpoint;
+        options.checkpoint_arg = &checkpoint_arg;
+    }
 
-        } // fields
+    result = tsv_convert(input, field_lengths, num_fields, file_startpos, &options, &output);
+    if (0 == result && NULL != checkpoint) {
+        // finished, so there's nothing to carry on from
+        unlink(checkpoint);
+    }
 
-    } // lines
+    retval = convert_status(result, input);
 
 cleanup:
+    if (NULL != stats) {
+        tsv_stats_end(stats);
+        tsv_stats_print(stats, stderr);
+        tsv_stats_free(stats);
+    }
+
+    if (NULL != pool) {
+        tsv_threadpool_free(pool);
+    }
+
     if (NULL != input) {
-        fclose(input);
+        tsv_input_close(input);
+    }
+
+    tsv_writer_free(writer);
+    tsv_filter_free(filter);
+
+    if (NULL != where) {
+        growbuf_free(where);
     }
 
     if (NULL != field_lengths) {
         growbuf_free(field_lengths);
     }
 
-    if (NULL != buf) {
-        free(buf);
-    }
+    growbuf_arena_free(input_names);
 
-    if (convert_tabs) {
-        unlink(tempFilename);
+    if (NULL != inputs) {
+        growbuf_free(inputs);
     }
 
     return retval;
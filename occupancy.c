@@ -0,0 +1,139 @@
+/**
+ * Column Occupancy Kernels
+ *
+ * Vectorized versions of the inner loop of column detection, picked at
+ * runtime according to what the CPU supports.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "occupancy.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OCCUPANCY_X86
+#include <immintrin.h>
+#endif
+
+#define DEBUG if (false)
+
+typedef void (*occupancy_fn)(unsigned char*, const char*, size_t);
+
+/**
+ * Portable kernel; one column at a time.
+ */
+static void occupancy_or_scalar(unsigned char* occupied, const char* line, size_t len)
+{
+    for (size_t k = 0; k < len; k++) {
+        occupied[k] |= (' ' != line[k]);
+    }
+}
+
+#ifdef OCCUPANCY_X86
+
+/**
+ * SSE2 kernel; 16 columns at a time.
+ */
+__attribute__((target("sse2")))
+static void occupancy_or_sse2(unsigned char* occupied, const char* line, size_t len)
+{
+    const __m128i spaces = _mm_set1_epi8(' ');
+    size_t k = 0;
+
+    for (; k + 16 <= len; k += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(line + k));
+        __m128i occ   = _mm_loadu_si128((const __m128i*)(occupied + k));
+
+        // andnot(a, b) == ~a & b; sets 0xFF wherever the byte isn't a space
+        __m128i set   = _mm_andnot_si128(_mm_cmpeq_epi8(bytes, spaces), _mm_set1_epi8(-1));
+
+        _mm_storeu_si128((__m128i*)(occupied + k), _mm_or_si128(occ, set));
+    }
+
+    occupancy_or_scalar(occupied + k, line + k, len - k);
+}
+
+/**
+ * AVX2 kernel; 32 columns at a time, finishing off with SSE2.
+ */
+__attribute__((target("avx2")))
+static void occupancy_or_avx2(unsigned char* occupied, const char* line, size_t len)
+{
+    const __m256i spaces = _mm256_set1_epi8(' ');
+    size_t k = 0;
+
+    for (; k + 32 <= len; k += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i*)(line + k));
+        __m256i occ   = _mm256_loadu_si256((const __m256i*)(occupied + k));
+        __m256i set   = _mm256_andnot_si256(_mm256_cmpeq_epi8(bytes, spaces), _mm256_set1_epi8(-1));
+
+        _mm256_storeu_si256((__m256i*)(occupied + k), _mm256_or_si256(occ, set));
+    }
+
+    occupancy_or_sse2(occupied + k, line + k, len - k);
+}
+
+#endif // OCCUPANCY_X86
+
+static occupancy_fn   occupancy_kernel      = NULL;
+static const char*    occupancy_kernel_name = "scalar";
+static pthread_once_t occupancy_once        = PTHREAD_ONCE_INIT;
+
+/**
+ * Pick the best kernel for this CPU.
+ */
+static void occupancy_select(void)
+{
+    occupancy_fn kernel = occupancy_or_scalar;
+    const char*  name   = "scalar";
+
+#ifdef OCCUPANCY_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernel = occupancy_or_avx2;
+        name   = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse2")) {
+        kernel = occupancy_or_sse2;
+        name   = "sse2";
+    }
+#endif
+
+    DEBUG fprintf(stderr, "using %s occupancy kernel\n", name);
+
+    occupancy_kernel_name = name;
+    occupancy_kernel      = kernel;
+}
+
+/**
+ * Mark the columns of a line which hold a non-space character.
+ *
+ * Only the first len columns are touched, so ragged lines are fine as long
+ * as the map is at least len wide.
+ *
+ * Args:
+ *  occupied    - occupancy map to update (one byte per column; nonzero means
+ *                occupied)
+ *  line        - line to scan
+ *  len         - length of the line
+ */
+void tsv_occupancy_or(unsigned char* occupied, const char* line, size_t len)
+{
+    pthread_once(&occupancy_once, occupancy_select);
+
+    occupancy_kernel(occupied, line, len);
+}
+
+/**
+ * Get the name of the kernel tsv_occupancy_or() uses on this CPU.
+ */
+const char* tsv_occupancy_kernel_name(void)
+{
+    pthread_once(&occupancy_once, occupancy_select);
+
+    return occupancy_kernel_name;
+}
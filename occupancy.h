@@ -0,0 +1,16 @@
+/**
+ * Column Occupancy Kernels
+ *
+ * Vectorized versions of the inner loop of column detection, picked at
+ * runtime according to what the CPU supports.
+ */
+
+#ifndef OCCUPANCY_H
+#define OCCUPANCY_H
+
+#include <stddef.h>
+
+void        tsv_occupancy_or(unsigned char* occupied, const char* line, size_t len);
+const char* tsv_occupancy_kernel_name(void);
+
+#endif //OCCUPANCY_H
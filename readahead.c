@@ -0,0 +1,573 @@
+/**
+ * Read-Ahead
+ *
+ * Reads a file descriptor on a background thread into a ring of large
+ * buffers, so the thread taking lines from it rarely waits on the disk (or
+ * the network), and the disk is kept busy while lines are being converted.
+ * Seekable files are read with pread(), everything else with read().
+ * Compressed input can be decompressed on the same thread as it's read.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "readahead.h"
+
+#define DEBUG if (false)
+
+/**
+ * Read the file into a buffer, from read_pos, and advance read_pos.
+ *
+ * Regular files fill the whole buffer unless they end first. Anything else
+ * returns as soon as it has something, so lines arriving slowly down a pipe
+ * aren't held up waiting for more.
+ *
+ * Args:
+ *  ra      - read-ahead to read for
+ *  data    - buffer to read into
+ *  size    - size of the buffer
+ *
+ * Returns:
+ *  Number of bytes read (0 at EOF), or -1 * an errno.h error number.
+ */
+static ssize_t read_buffer(tsv_readahead* ra, char* data, size_t size)
+{
+    size_t total = 0;
+
+    while (total < size) {
+        ssize_t n;
+
+        if (ra->seekable) {
+            n = pread(ra->fd, data + total, size - total, ra->read_pos + (off_t)total);
+        }
+        else {
+            n = read(ra->fd, data + total, size - total);
+        }
+
+        if (n < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return -errno;
+        }
+
+        total += (size_t)n;
+
+        if (0 == n || !ra->seekable) {
+            break;
+        }
+    }
+
+    ra->read_pos += (off_t)total;
+    return (ssize_t)total;
+}
+
+/**
+ * Read the start of the file into a buffer, and if it's compressed, set up
+ * to decompress it.
+ *
+ * Args:
+ *  ra      - read-ahead to read for
+ *  buf     - buffer to read into
+ *
+ * Returns:
+ *  Number of bytes read (0 at EOF), or -1 * an errno.h error number. If the
+ *  input is compressed, they've been moved to ra->raw to be decompressed.
+ */
+static ssize_t detect_compression(tsv_readahead* ra, tsv_readbuf* buf)
+{
+    size_t total = 0;
+
+    ra->detected = true;
+
+    //
+    // A pipe might not have all of the magic bytes yet.
+    //
+    while (total < TSV_COMPRESSION_MAGIC_LEN) {
+        ssize_t n = read_buffer(ra, buf->data + total, ra->buffer_size - total);
+        if (n < 0) {
+            return n;
+        }
+        if (0 == n) {
+            break;
+        }
+        total += (size_t)n;
+    }
+
+    ra->compression = tsv_detect_compression(buf->data, total);
+    if (TSV_COMPRESSION_NONE == ra->compression) {
+        return (ssize_t)total;
+    }
+
+    DEBUG fprintf(stderr, "read-ahead: input is %s compressed\n", tsv_compression_name(ra->compression));
+
+    ra->decoder = tsv_decoder_create(ra->compression);
+    if (NULL == ra->decoder) {
+        return -errno;
+    }
+
+    ra->raw = (char*)malloc(ra->buffer_size);
+    if (NULL == ra->raw) {
+        return -ENOMEM;
+    }
+
+    memcpy(ra->raw, buf->data, total);
+    ra->raw_pos = 0;
+    ra->raw_len = total;
+    return (ssize_t)total;
+}
+
+/**
+ * Decompress into a buffer, reading more of the file as needed.
+ *
+ * Args:
+ *  ra      - read-ahead to read for
+ *  buf     - buffer to decompress into
+ *
+ * Returns:
+ *  Number of bytes decompressed (0 at EOF), or -1 * an errno.h error number.
+ *  -EBADMSG if the input is corrupt or truncated.
+ */
+static ssize_t decompress_buffer(tsv_readahead* ra, tsv_readbuf* buf)
+{
+    size_t total = 0;
+
+    while (total < ra->buffer_size) {
+        size_t consumed;
+        size_t produced;
+
+        if (ra->raw_pos == ra->raw_len) {
+            if (ra->raw_eof || (total > 0 && !ra->seekable)) {
+                // done, or hand over what there is rather than wait on a pipe
+                break;
+            }
+
+            ssize_t n = read_buffer(ra, ra->raw, ra->buffer_size);
+            if (n < 0) {
+                return n;
+            }
+
+            ra->raw_pos = 0;
+            ra->raw_len = (size_t)n;
+            ra->raw_eof = (0 == n);
+        }
+
+        int result = tsv_decoder_run(ra->decoder, ra->raw + ra->raw_pos, ra->raw_len - ra->raw_pos, &consumed,
+                buf->data + total, ra->buffer_size - total, &produced);
+        if (0 != result) {
+            return result;
+        }
+
+        ra->raw_pos += consumed;
+        total       += produced;
+
+        if (0 == consumed && 0 == produced && ra->raw_pos < ra->raw_len) {
+            // stuck: data after the end of the compressed stream
+            return -EBADMSG;
+        }
+    }
+
+    if (0 == total && !tsv_decoder_at_end(ra->decoder)) {
+        return -EBADMSG;
+    }
+
+    return (ssize_t)total;
+}
+
+/**
+ * Fill the next free buffer in the ring. Called with the lock held, which is
+ * dropped while reading.
+ *
+ * Args:
+ *  ra  - read-ahead to fill; must have a free buffer
+ */
+static void fill_buffer(tsv_readahead* ra)
+{
+    tsv_readbuf* buf = &ra->buffers[(ra->head + ra->count) % ra->num_buffers];
+    ssize_t      n;
+
+    pthread_mutex_unlock(&ra->lock);
+    if (ra->detect && !ra->detected) {
+        n = detect_compression(ra, buf);
+        if (n > 0 && NULL != ra->decoder) {
+            n = decompress_buffer(ra, buf);
+        }
+    }
+    else if (NULL != ra->decoder) {
+        n = decompress_buffer(ra, buf);
+    }
+    else {
+        n = read_buffer(ra, buf->data, ra->buffer_size);
+    }
+    pthread_mutex_lock(&ra->lock);
+
+    if (n > 0) {
+        buf->len = (size_t)n;
+        ra->count++;
+    }
+    else {
+        DEBUG fprintf(stderr, "read-ahead done at %lld: %zd\n", (long long)ra->read_pos, n);
+        ra->eof   = true;
+        ra->error = (int)n;
+    }
+
+    pthread_cond_broadcast(&ra->filled);
+}
+
+/**
+ * Read-ahead thread: keeps the ring full until the input ends or it's told
+ * to stop.
+ *
+ * Args:
+ *  arg - the tsv_readahead
+ *
+ * Returns:
+ *  NULL
+ */
+static void* readahead_thread(void* arg)
+{
+    tsv_readahead* ra = (tsv_readahead*)arg;
+
+    pthread_mutex_lock(&ra->lock);
+    while (!ra->stop && !ra->eof) {
+        if (ra->count == ra->num_buffers) {
+            pthread_cond_wait(&ra->emptied, &ra->lock);
+        }
+        else {
+            fill_buffer(ra);
+        }
+    }
+    pthread_mutex_unlock(&ra->lock);
+
+    return NULL;
+}
+
+/**
+ * Stop the read-ahead thread, if it's running, and wait for it to finish.
+ *
+ * Args:
+ *  ra  - read-ahead to stop
+ */
+static void stop_thread(tsv_readahead* ra)
+{
+    if (!ra->running) {
+        return;
+    }
+
+    pthread_mutex_lock(&ra->lock);
+    ra->stop = true;
+    pthread_cond_broadcast(&ra->emptied);
+    pthread_mutex_unlock(&ra->lock);
+
+    pthread_join(ra->thread, NULL);
+    ra->running = false;
+    ra->stop    = false;
+}
+
+/**
+ * Give back the buffer lines were being taken from, and wait for the next
+ * one. The read-ahead thread is started on first use.
+ *
+ * Args:
+ *  ra  - read-ahead to take a buffer from
+ *
+ * Returns:
+ *  true if there's a new current buffer, false at EOF or on error.
+ */
+static bool next_buffer(tsv_readahead* ra)
+{
+    pthread_mutex_lock(&ra->lock);
+
+    for (;;) {
+        if (NULL != ra->current) {
+            ra->current = NULL;
+            ra->head    = (ra->head + 1) % ra->num_buffers;
+            ra->count--;
+            pthread_cond_broadcast(&ra->emptied);
+        }
+
+        if (!ra->running && !ra->synchronous) {
+            if (0 == pthread_create(&ra->thread, NULL, readahead_thread, ra)) {
+                ra->running = true;
+            }
+            else {
+                DEBUG fprintf(stderr, "no read-ahead thread; reading synchronously\n");
+                ra->synchronous = true;
+            }
+        }
+
+        while (0 == ra->count && !ra->eof) {
+            if (ra->synchronous) {
+                fill_buffer(ra);
+            }
+            else {
+                pthread_cond_wait(&ra->filled, &ra->lock);
+            }
+        }
+
+        if (0 == ra->count) {
+            break;
+        }
+
+        ra->current = &ra->buffers[ra->head];
+        if (ra->skip < ra->current->len) {
+            ra->pos  = ra->skip;
+            ra->skip = 0;
+            break;
+        }
+
+        //
+        // Seeked past all of this one.
+        //
+        ra->skip -= ra->current->len;
+    }
+
+    pthread_mutex_unlock(&ra->lock);
+    return NULL != ra->current;
+}
+
+/**
+ * Start reading ahead from a file descriptor.
+ *
+ * Reading starts from the file descriptor's current offset, the first time
+ * a line is asked for.
+ *
+ * Args:
+ *  fd          - file descriptor to read; closed when the read-ahead is freed
+ *  buffer_size - size of each buffer; rounded up to TSV_READAHEAD_ALIGN
+ *  num_buffers - number of buffers in the ring; at least 2
+ *  detect      - decompress the input if it starts with the magic bytes of
+ *                a compression format. Compressed input can't be seeked in.
+ *
+ * Returns:
+ *  The new read-ahead, or NULL with errno set on failure. The file
+ *  descriptor is left open on failure.
+ */
+tsv_readahead* tsv_readahead_create(int fd, size_t buffer_size, size_t num_buffers, bool detect)
+{
+    struct stat st;
+    off_t       start;
+
+    tsv_readahead* ra = (tsv_readahead*)calloc(1, sizeof(tsv_readahead));
+    if (NULL == ra) {
+        return NULL;
+    }
+
+    ra->fd          = fd;
+    ra->buffer_size = (buffer_size + TSV_READAHEAD_ALIGN - 1) & ~(size_t)(TSV_READAHEAD_ALIGN - 1);
+    ra->num_buffers = (num_buffers < 2) ? 2 : num_buffers;
+    ra->detect      = detect;
+
+    if (0 == fstat(fd, &st) && S_ISREG(st.st_mode) && -1 != (start = lseek(fd, 0, SEEK_CUR))) {
+        ra->seekable = true;
+        ra->offset   = start;
+        ra->read_pos = start - start % TSV_READAHEAD_ALIGN;
+        ra->skip     = (size_t)(start - ra->read_pos);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    ra->line    = growbuf_create(256);
+    ra->buffers = (tsv_readbuf*)calloc(ra->num_buffers, sizeof(tsv_readbuf));
+    if (NULL == ra->line || NULL == ra->buffers) {
+        goto nomem;
+    }
+
+    for (size_t i = 0; i < ra->num_buffers; i++) {
+        if (0 != posix_memalign((void**)&ra->buffers[i].data, TSV_READAHEAD_ALIGN, ra->buffer_size)) {
+            goto nomem;
+        }
+    }
+
+    pthread_mutex_init(&ra->lock, NULL);
+    pthread_cond_init(&ra->filled, NULL);
+    pthread_cond_init(&ra->emptied, NULL);
+
+    return ra;
+
+nomem:
+    if (NULL != ra->buffers) {
+        for (size_t i = 0; i < ra->num_buffers; i++) {
+            free(ra->buffers[i].data);
+        }
+        free(ra->buffers);
+    }
+    growbuf_free(ra->line);
+    free(ra);
+    errno = ENOMEM;
+    return NULL;
+}
+
+/**
+ * Stop reading ahead, close the file descriptor, and free everything.
+ *
+ * Args:
+ *  ra  - read-ahead to free
+ */
+void tsv_readahead_free(tsv_readahead* ra)
+{
+    if (NULL == ra) {
+        return;
+    }
+
+    stop_thread(ra);
+
+    for (size_t i = 0; i < ra->num_buffers; i++) {
+        free(ra->buffers[i].data);
+    }
+    free(ra->buffers);
+
+    pthread_mutex_destroy(&ra->lock);
+    pthread_cond_destroy(&ra->filled);
+    pthread_cond_destroy(&ra->emptied);
+
+    close(ra->fd);
+    tsv_decoder_free(ra->decoder);
+    free(ra->raw);
+    growbuf_free(ra->line);
+    free(ra);
+}
+
+/**
+ * Read the next line, as getline() would.
+ *
+ * Args:
+ *  ra      - read-ahead to read from
+ *  line    - set to point to the line, which includes its newline if it has
+ *            one, and isn't null-terminated. It remains valid until the next
+ *            call.
+ *
+ * Returns:
+ *  Length of the line, or -1 at EOF or on error; tsv_readahead_error() tells
+ *  which.
+ */
+ssize_t tsv_readahead_getline(tsv_readahead* ra, const char** line)
+{
+    ra->line->size = 0;
+
+    for (;;) {
+        if (NULL == ra->current || ra->pos == ra->current->len) {
+            if (!next_buffer(ra)) {
+                break;
+            }
+            continue;
+        }
+
+        const char* start   = ra->current->data + ra->pos;
+        size_t      avail   = ra->current->len - ra->pos;
+        const char* newline = (const char*)memchr(start, '\n', avail);
+        size_t      n       = (NULL != newline) ? (size_t)(newline + 1 - start) : avail;
+
+        ra->pos    += n;
+        ra->offset += (off_t)n;
+
+        if (NULL != newline && 0 == ra->line->size) {
+            *line = start;
+            return (ssize_t)n;
+        }
+
+        //
+        // The line carries on into the next buffer.
+        //
+        if (0 != growbuf_append(ra->line, start, n)) {
+            pthread_mutex_lock(&ra->lock);
+            ra->error = -ENOMEM;
+            pthread_mutex_unlock(&ra->lock);
+            return -1;
+        }
+
+        if (NULL != newline) {
+            break;
+        }
+    }
+
+    if (0 == ra->line->size) {
+        return -1;
+    }
+
+    *line = (const char*)ra->line->buf;
+    return (ssize_t)ra->line->size;
+}
+
+/**
+ * Seek to an absolute position. Anything read ahead is thrown away.
+ *
+ * Args:
+ *  ra      - read-ahead to seek in
+ *  offset  - byte offset from the start of the file
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success. -ESPIPE if the file can't be
+ *  seeked in, or is being decompressed.
+ */
+int tsv_readahead_seek(tsv_readahead* ra, off_t offset)
+{
+    if (offset < 0) {
+        return -EINVAL;
+    }
+
+    if (!ra->seekable) {
+        return -ESPIPE;
+    }
+
+    //
+    // The thread sets up the decoder, so it has to be stopped to look. If
+    // it's not seeking after all, it starts again on the next read.
+    //
+    stop_thread(ra);
+    if (NULL != ra->decoder) {
+        return -ESPIPE;
+    }
+
+    ra->head     = 0;
+    ra->count    = 0;
+    ra->eof      = false;
+    ra->error    = 0;
+    ra->current  = NULL;
+    ra->pos      = 0;
+    ra->read_pos = offset - offset % TSV_READAHEAD_ALIGN;
+    ra->skip     = (size_t)(offset - ra->read_pos);
+    ra->offset   = offset;
+
+    return 0;
+}
+
+/**
+ * Get the offset of the next line.
+ *
+ * Args:
+ *  ra  - read-ahead to query
+ *
+ * Returns:
+ *  Byte offset from the start of the file.
+ */
+off_t tsv_readahead_tell(const tsv_readahead* ra)
+{
+    return ra->offset;
+}
+
+/**
+ * Find out whether reading failed.
+ *
+ * Args:
+ *  ra  - read-ahead to query
+ *
+ * Returns:
+ *  -1 * an errno.h error number, or 0 if there's been no error.
+ */
+int tsv_readahead_error(tsv_readahead* ra)
+{
+    pthread_mutex_lock(&ra->lock);
+    int error = ra->error;
+    pthread_mutex_unlock(&ra->lock);
+
+    return error;
+}
@@ -0,0 +1,79 @@
+/**
+ * Read-Ahead
+ *
+ * Reads a file descriptor on a background thread into a ring of large
+ * buffers, so the thread taking lines from it rarely waits on the disk (or
+ * the network), and the disk is kept busy while lines are being converted.
+ * Seekable files are read with pread(), everything else with read().
+ * Compressed input can be decompressed on the same thread as it's read.
+ */
+
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "growbuf.h"
+#include "decompress.h"
+
+//
+// Buffers, and the offsets they're read from, are aligned to this.
+//
+#define TSV_READAHEAD_ALIGN 4096
+
+typedef struct
+{
+    char*  data;    // TSV_READAHEAD_ALIGN aligned
+    size_t len;     // bytes read into it
+} tsv_readbuf;
+
+typedef struct _tsv_readahead
+{
+    int             fd;
+    bool            seekable;       // read with pread(), and can be seeked in
+    size_t          buffer_size;
+    size_t          num_buffers;
+    tsv_readbuf*    buffers;        // ring; filled ones start at head
+    pthread_t       thread;
+    bool            running;        // thread has been started, and not joined
+    bool            synchronous;    // couldn't start a thread; read on the caller's
+    bool            detect;         // decompress the input if it turns out to be compressed
+
+    // only touched by whichever thread is reading
+    bool            detected;       // the start of the input has been looked at
+    tsv_compression compression;
+    tsv_decoder*    decoder;        // NULL unless compressed
+    char*           raw;            // compressed data read but not yet decompressed
+    size_t          raw_pos;
+    size_t          raw_len;
+    bool            raw_eof;
+    off_t           read_pos;       // where the file is read from next
+
+    pthread_mutex_t lock;           // guards everything down to stop
+    pthread_cond_t  filled;
+    pthread_cond_t  emptied;
+    size_t          head;           // next buffer for the caller
+    size_t          count;          // buffers filled and not yet given back
+    bool            eof;            // nothing more will be filled
+    int             error;          // -1 * an errno.h error number, if reading failed
+    bool            stop;
+
+    // only touched by the caller
+    tsv_readbuf*    current;        // buffer lines are being taken from, or NULL
+    size_t          pos;            // how far into it
+    size_t          skip;           // bytes to skip at the start of the next buffer
+    off_t           offset;         // file offset of the next line
+    growbuf*        line;           // lines which span buffers are joined here
+} tsv_readahead;
+
+tsv_readahead* tsv_readahead_create(int fd, size_t buffer_size, size_t num_buffers, bool detect);
+void           tsv_readahead_free(tsv_readahead* ra);
+ssize_t        tsv_readahead_getline(tsv_readahead* ra, const char** line);
+int            tsv_readahead_seek(tsv_readahead* ra, off_t offset);
+off_t          tsv_readahead_tell(const tsv_readahead* ra);
+int            tsv_readahead_error(tsv_readahead* ra);
+
+#endif //READAHEAD_H
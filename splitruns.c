@@ -0,0 +1,361 @@
+/**
+ * Splitting on Runs of Spaces
+ *
+ * A fast path for tables whose columns are always at least N spaces apart,
+ * and whose cells never have that many spaces in a row: each line is split
+ * on its own, with no column detection, in one pass over the input. Nothing
+ * is read twice, so it works the same on pipes as on files.
+ *
+ * Most of the work is finding two spaces in a row, since a run of N starts
+ * with one; that's vectorized, picked at runtime like the occupancy kernels.
+ * Single spaces inside cells are skipped over 16 or 32 bytes at a time.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "growbuf.h"
+#include "input.h"
+#include "convert.h"
+#include "writer.h"
+#include "csvformat.h"
+#include "writebehind.h"
+#include "splitruns.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SPLITRUNS_X86
+#include <immintrin.h>
+#endif
+
+#define DEBUG if (false)
+
+//
+// Output is written once it gets this big.
+//
+#define OUTPUT_FLUSH_SIZE (256 * 1024)
+
+//
+// Buffers in the write-behind ring.
+//
+#define WRITE_BEHIND_BUFFERS 3
+
+typedef size_t (*find_pair_fn)(const char*, size_t);
+
+/**
+ * Portable kernel; memchr() to each space, then a look at the next byte.
+ */
+static size_t find_pair_scalar(const char* line, size_t len)
+{
+    const char* p   = line;
+    const char* end = line + len;
+
+    while (end - p >= 2) {
+        // stop one short, so p[1] is always there
+        p = (const char*)memchr(p, ' ', end - p - 1);
+        if (NULL == p) {
+            break;
+        }
+
+        if (' ' == p[1]) {
+            return p - line;
+        }
+        p += 2;
+    }
+
+    return len;
+}
+
+#ifdef SPLITRUNS_X86
+
+/**
+ * SSE2 kernel; 16 positions at a time, comparing the line with itself one
+ * byte on.
+ */
+__attribute__((target("sse2")))
+static size_t find_pair_sse2(const char* line, size_t len)
+{
+    const __m128i spaces = _mm_set1_epi8(' ');
+    size_t k = 0;
+
+    for (; k + 17 <= len; k += 16) {
+        __m128i here = _mm_loadu_si128((const __m128i*)(line + k));
+        __m128i next = _mm_loadu_si128((const __m128i*)(line + k + 1));
+        int     mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(here, spaces), _mm_cmpeq_epi8(next, spaces)));
+
+        if (0 != mask) {
+            return k + __builtin_ctz(mask);
+        }
+    }
+
+    return k + find_pair_scalar(line + k, len - k);
+}
+
+/**
+ * AVX2 kernel; 32 positions at a time, finishing off with SSE2.
+ */
+__attribute__((target("avx2")))
+static size_t find_pair_avx2(const char* line, size_t len)
+{
+    const __m256i spaces = _mm256_set1_epi8(' ');
+    size_t k = 0;
+
+    for (; k + 33 <= len; k += 32) {
+        __m256i  here = _mm256_loadu_si256((const __m256i*)(line + k));
+        __m256i  next = _mm256_loadu_si256((const __m256i*)(line + k + 1));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(here, spaces), _mm256_cmpeq_epi8(next, spaces)));
+
+        if (0 != mask) {
+            return k + __builtin_ctz(mask);
+        }
+    }
+
+    return k + find_pair_sse2(line + k, len - k);
+}
+
+#endif // SPLITRUNS_X86
+
+static find_pair_fn   find_pair      = NULL;
+static pthread_once_t find_pair_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Pick the best kernel for this CPU.
+ */
+static void find_pair_select(void)
+{
+    find_pair_fn kernel = find_pair_scalar;
+    const char*  name   = "scalar";
+
+#ifdef SPLITRUNS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernel = find_pair_avx2;
+        name   = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse2")) {
+        kernel = find_pair_sse2;
+        name   = "sse2";
+    }
+#endif
+
+    DEBUG fprintf(stderr, "using %s run-splitting kernel\n", name);
+
+    find_pair = kernel;
+}
+
+/**
+ * Find the next run of spaces which could separate fields.
+ *
+ * Args:
+ *  line    - text to search
+ *  len     - its length
+ *  min_run - fewest spaces which separate fields
+ *
+ * Returns:
+ *  Where the run starts, or len if there isn't one. It may turn out to be
+ *  shorter than min_run.
+ */
+static inline size_t find_run(const char* line, size_t len, size_t min_run)
+{
+    if (1 == min_run) {
+        const char* space = (const char*)memchr(line, ' ', len);
+        return (NULL == space) ? len : (size_t)(space - line);
+    }
+
+    return find_pair(line, len);
+}
+
+/**
+ * Slice the next field off a line.
+ *
+ * Args:
+ *  line    - line being split, with trailing spaces trimmed off
+ *  len     - its length
+ *  min_run - fewest spaces which separate fields
+ *  pos     - where the field starts; moved past the run after it
+ *  field   - set to the field
+ */
+static inline void next_field(const char* line, size_t len, size_t min_run, size_t* pos, tsv_field* field)
+{
+    size_t search = *pos;
+
+    for (;;) {
+        size_t run     = search + find_run(line + search, len - search, min_run);
+        size_t run_end = run;
+
+        while (run_end < len && ' ' == line[run_end]) {
+            run_end++;
+        }
+
+        //
+        // Trailing spaces are gone, so the line can't end in a run.
+        //
+        if (run == len || run_end - run >= min_run) {
+            field->data = line + *pos;
+            field->len  = run - *pos;
+            *pos        = run_end;
+            return;
+        }
+
+        search = run_end;
+    }
+}
+
+/**
+ * Trim the spaces off both ends of a line.
+ *
+ * Args:
+ *  line    - line to trim
+ *  len     - its length; shortened to exclude the trailing spaces
+ *
+ * Returns:
+ *  Where the first field starts.
+ */
+static inline size_t trim_line(const char* line, size_t* len)
+{
+    size_t pos = 0;
+
+    while (*len > 0 && ' ' == line[*len - 1]) {
+        (*len)--;
+    }
+    while (pos < *len && ' ' == line[pos]) {
+        pos++;
+    }
+
+    return pos;
+}
+
+/**
+ * Write out and empty the output buffer, or queue it to be written behind.
+ *
+ * Args:
+ *  out     - buffer to write; replaced by an empty one if queued
+ *  wb      - write-behind to queue it on, or NULL to write it now
+ *  output  - where to write it
+ *  stats   - stats to count the write in, or NULL
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+static int flush(growbuf** out, tsv_writebehind* wb, const tsv_sink* output, tsv_stats* stats)
+{
+    if (NULL != wb) {
+        return tsv_writebehind_submit(wb, out);
+    }
+
+    return tsv_flush_output(*out, output, stats);
+}
+
+/**
+ * Convert an input to CSV by splitting each line on runs of spaces.
+ *
+ * Every line is a row, with as many fields as it splits into; a blank line
+ * is an empty row. The input is read once, front to back, from wherever it
+ * is.
+ *
+ * Args:
+ *  input   - input to convert; a stream without a window works best
+ *  min_run - fewest spaces which separate fields; at least 1
+ *  options - conversion options; only stats, scratch and write_behind are
+ *            used
+ *  output  - where to write the output
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success. -ENOMEM means the conversion
+ *  itself failed; anything else is an I/O error, reading the input if
+ *  tsv_input_error() says so, otherwise writing the output.
+ */
+int tsv_convert_runs(tsv_input* input, size_t min_run, const tsv_convert_options* options, const tsv_sink* output)
+{
+    growbuf*         out    = NULL;
+    tsv_writebehind* wb     = NULL;
+    uint64_t         rows   = 0;
+    const char*      line;
+    size_t           len;
+    int              result = 0;
+
+    pthread_once(&find_pair_once, find_pair_select);
+
+    if (options->write_behind) {
+        wb = tsv_writebehind_create(output, options->stats, OUTPUT_FLUSH_SIZE, WRITE_BEHIND_BUFFERS);
+        if (NULL == wb) {
+            result = -ENOMEM;
+            goto cleanup;
+        }
+        out = tsv_writebehind_buffer(wb);
+    }
+    else if (NULL != options->scratch) {
+        out = options->scratch;
+        out->size = 0;
+    }
+    else {
+        out = growbuf_create(OUTPUT_FLUSH_SIZE);
+        if (NULL == out) {
+            result = -ENOMEM;
+            goto cleanup;
+        }
+    }
+
+    //
+    // Each field is written as it's found, followed by a comma; the row's
+    // last comma is then swapped for its newline. Spaces at the start and end
+    // of the line don't separate anything, and shorter runs are part of the
+    // fields they're in.
+    //
+    while (0 == result && tsv_input_getline(input, &line, &len)) {
+        size_t row_start = out->size;
+
+        for (size_t pos = trim_line(line, &len); 0 == result && pos < len; ) {
+            tsv_field field;
+
+            next_field(line, len, min_run, &pos, &field);
+
+            result = append_csv_field(field.data, field.len, out);
+            if (0 == result) {
+                result = growbuf_append_byte(out, ',');
+            }
+        }
+        if (0 != result) {
+            break;
+        }
+
+        if (out->size > row_start) {
+            ((char*)out->buf)[out->size - 1] = '\n';
+        }
+        else {
+            result = growbuf_append_byte(out, '\n');
+        }
+        rows++;
+
+        if (0 == result && out->size >= OUTPUT_FLUSH_SIZE) {
+            result = flush(&out, wb, output, options->stats);
+        }
+    }
+
+    if (0 == result) {
+        result = flush(&out, wb, output, options->stats);
+    }
+
+    if (0 == result) {
+        result = tsv_input_error(input);
+    }
+
+cleanup:
+    TSV_STATS_ADD(options->stats, rows, rows);
+    if (NULL != wb) {
+        int wb_result = tsv_writebehind_free(wb);
+        if (0 == result) {
+            result = wb_result;
+        }
+    }
+    else if (out != options->scratch) {
+        growbuf_free(out);
+    }
+
+    return result;
+}
@@ -0,0 +1,20 @@
+/**
+ * Splitting on Runs of Spaces
+ *
+ * A fast path for tables whose columns are always at least N spaces apart,
+ * and whose cells never have that many spaces in a row: each line is split
+ * on its own, with no column detection, in one pass over the input.
+ */
+
+#ifndef SPLITRUNS_H
+#define SPLITRUNS_H
+
+#include <stddef.h>
+
+#include "growbuf.h"
+#include "input.h"
+#include "convert.h"
+
+int tsv_convert_runs(tsv_input* input, size_t min_run, const tsv_convert_options* options, const tsv_sink* output);
+
+#endif //SPLITRUNS_H
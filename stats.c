@@ -0,0 +1,224 @@
+/**
+ * Run Statistics
+ *
+ * Per-phase timings and I/O counters, reported by --stats.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include <sys/resource.h>
+
+#include "stats.h"
+
+#define DEBUG if (false)
+
+//
+// Environment variable which turns stats on, for programs embedding libtsv.
+//
+#define STATS_ENV "TSV_STATS"
+
+static const char* const phase_names[TSV_NUM_PHASES] = {
+    [TSV_PHASE_OPEN]    = "open",
+    [TSV_PHASE_DETECT]  = "detect",
+    [TSV_PHASE_CONVERT] = "convert",
+};
+
+static double clock_seconds(clockid_t clock)
+{
+    struct timespec ts;
+
+    if (0 != clock_gettime(clock, &ts)) {
+        return 0;
+    }
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**
+ * Read the kernel's I/O counters for this process.
+ *
+ * Args:
+ *  io  - where to put them; io->valid is false if they aren't available
+ */
+static void read_io_counters(tsv_io_counters* io)
+{
+    FILE* file = fopen("/proc/self/io", "r");
+    char  key[32];
+    unsigned long long value;
+    int   found = 0;
+
+    memset(io, 0, sizeof(*io));
+    if (NULL == file) {
+        return;
+    }
+
+    while (2 == fscanf(file, "%31[^:]: %llu ", key, &value)) {
+        if (0 == strcmp("rchar", key)) {
+            io->rchar = value;
+            found++;
+        }
+        else if (0 == strcmp("wchar", key)) {
+            io->wchar = value;
+            found++;
+        }
+        else if (0 == strcmp("syscr", key)) {
+            io->syscr = value;
+            found++;
+        }
+        else if (0 == strcmp("syscw", key)) {
+            io->syscw = value;
+            found++;
+        }
+    }
+
+    fclose(file);
+    io->valid = (4 == found);
+}
+
+/**
+ * Start collecting stats.
+ *
+ * Returns:
+ *  The new stats, or NULL on failure.
+ */
+tsv_stats* tsv_stats_create(void)
+{
+    tsv_stats* stats = (tsv_stats*)calloc(1, sizeof(tsv_stats));
+    if (NULL == stats) {
+        return NULL;
+    }
+
+    stats->phase = TSV_NUM_PHASES;
+    read_io_counters(&stats->io_start);
+    return stats;
+}
+
+/**
+ * Free stats.
+ *
+ * Args:
+ *  stats   - stats to free; may be NULL
+ */
+void tsv_stats_free(tsv_stats* stats)
+{
+    free(stats);
+}
+
+/**
+ * Mark the start of a phase, ending the one in progress, if any.
+ *
+ * Args:
+ *  stats   - stats to record in; may be NULL
+ *  phase   - the phase starting
+ */
+void tsv_stats_begin(tsv_stats* stats, tsv_phase phase)
+{
+    if (NULL == stats) {
+        return;
+    }
+
+    tsv_stats_end(stats);
+
+    stats->phase      = phase;
+    stats->wall_start = clock_seconds(CLOCK_MONOTONIC);
+    stats->cpu_start  = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+/**
+ * Mark the end of the phase in progress, if any, adding its time to the
+ * phase's total.
+ *
+ * Args:
+ *  stats   - stats to record in; may be NULL
+ */
+void tsv_stats_end(tsv_stats* stats)
+{
+    if (NULL == stats || TSV_NUM_PHASES == stats->phase) {
+        return;
+    }
+
+    stats->wall[stats->phase] += clock_seconds(CLOCK_MONOTONIC) - stats->wall_start;
+    stats->cpu[stats->phase]  += clock_seconds(CLOCK_PROCESS_CPUTIME_ID) - stats->cpu_start;
+    stats->phase = TSV_NUM_PHASES;
+}
+
+/**
+ * Write stats out as one line of JSON.
+ *
+ * Args:
+ *  stats   - stats to write
+ *  out     - where to write them
+ */
+void tsv_stats_print(const tsv_stats* stats, FILE* out)
+{
+    tsv_io_counters io;
+    struct rusage   usage;
+
+    read_io_counters(&io);
+
+    fprintf(out, "{\"phases\":{");
+    for (int i = 0; i < TSV_NUM_PHASES; i++) {
+        fprintf(out, "%s\"%s\":{\"wall_s\":%.6f,\"cpu_s\":%.6f}",
+                (i > 0) ? "," : "", phase_names[i], stats->wall[i], stats->cpu[i]);
+    }
+    fprintf(out, "},");
+
+    fprintf(out, "\"bytes_read\":%" PRIu64 ",\"bytes_written\":%" PRIu64 ",\"output_wall_s\":%.6f"
+            ",\"seeks\":%" PRIu64 ",\"columns\":%" PRIu64 ",\"rows\":%" PRIu64,
+            stats->bytes_read, stats->bytes_written, (double)stats->output_ns / 1e9,
+            stats->seeks, stats->columns, stats->rows);
+
+    if (io.valid && stats->io_start.valid) {
+        fprintf(out, ",\"read_syscalls\":%" PRIu64 ",\"write_syscalls\":%" PRIu64
+                ",\"syscall_bytes_read\":%" PRIu64 ",\"syscall_bytes_written\":%" PRIu64,
+                io.syscr - stats->io_start.syscr, io.syscw - stats->io_start.syscw,
+                io.rchar - stats->io_start.rchar, io.wchar - stats->io_start.wchar);
+    }
+
+    if (0 == getrusage(RUSAGE_SELF, &usage)) {
+        // ru_maxrss is in kilobytes on Linux
+        fprintf(out, ",\"peak_rss_kb\":%ld", usage.ru_maxrss);
+    }
+
+    fprintf(out, "}\n");
+}
+
+/**
+ * Read the clock, for timing something which isn't a phase of its own, like
+ * writing output, which overlaps converting.
+ *
+ * Args:
+ *  stats   - stats the time is for; may be NULL
+ *
+ * Returns:
+ *  Monotonic time in nanoseconds, or 0 if stats is NULL.
+ */
+uint64_t tsv_stats_clock(const tsv_stats* stats)
+{
+    struct timespec ts;
+
+    if (NULL == stats || 0 != clock_gettime(CLOCK_MONOTONIC, &ts)) {
+        return 0;
+    }
+
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Check whether stats were asked for through the environment.
+ *
+ * Returns:
+ *  true if TSV_STATS is set to something other than "" or "0".
+ */
+bool tsv_stats_requested(void)
+{
+    const char* value = getenv(STATS_ENV);
+
+    return NULL != value && '\0' != value[0] && 0 != strcmp("0", value);
+}
@@ -0,0 +1,70 @@
+/**
+ * Run Statistics
+ *
+ * Per-phase timings and I/O counters, reported by --stats. Everything takes
+ * a possibly-NULL tsv_stats*, and does nothing with NULL, so when stats are
+ * off the counters cost a pointer test.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum
+{
+    TSV_PHASE_OPEN,     // opening the input and finding the start line
+    TSV_PHASE_DETECT,   // finding (or loading) the column layout
+    TSV_PHASE_CONVERT,  // extraction, encoding, and output; see also output_ns
+    TSV_NUM_PHASES,
+} tsv_phase;
+
+//
+// What the kernel counted for this process, from /proc/self/io.
+//
+typedef struct
+{
+    bool     valid;
+    uint64_t rchar;
+    uint64_t wchar;
+    uint64_t syscr;
+    uint64_t syscw;
+} tsv_io_counters;
+
+typedef struct
+{
+    double          wall[TSV_NUM_PHASES];   // seconds
+    double          cpu[TSV_NUM_PHASES];    // seconds, all threads
+    tsv_phase       phase;                  // in progress; TSV_NUM_PHASES for none
+    double          wall_start;             // of the phase in progress
+    double          cpu_start;
+    tsv_io_counters io_start;               // when the stats were created
+    uint64_t        bytes_read;
+    uint64_t        bytes_written;
+    uint64_t        output_ns;              // writing output, on whichever threads do it
+    uint64_t        seeks;
+    uint64_t        rows;
+    uint64_t        columns;
+} tsv_stats;
+
+//
+// Add to a counter. Safe to use from several threads at once.
+//
+#define TSV_STATS_ADD(stats, counter, n)                                    \
+    do {                                                                    \
+        if (NULL != (stats)) {                                              \
+            __atomic_fetch_add(&(stats)->counter, (n), __ATOMIC_RELAXED);   \
+        }                                                                   \
+    } while (0)
+
+tsv_stats* tsv_stats_create(void);
+void       tsv_stats_free(tsv_stats* stats);
+void       tsv_stats_begin(tsv_stats* stats, tsv_phase phase);
+void       tsv_stats_end(tsv_stats* stats);
+void       tsv_stats_print(const tsv_stats* stats, FILE* out);
+uint64_t   tsv_stats_clock(const tsv_stats* stats);
+bool       tsv_stats_requested(void);
+
+#endif //STATS_H
@@ -0,0 +1,289 @@
+/**
+ * Thread Pool
+ *
+ * Fixed set of worker threads, each with its own task queue, which steal
+ * from each other's queues when their own runs dry.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "growbuf.h"
+#include "threadpool.h"
+
+#define DEBUG if (false)
+
+/**
+ * Take the next task for a worker: the oldest one in its own queue, or
+ * failing that, the newest one in some other worker's.
+ *
+ * Args:
+ *  pool    - the pool
+ *  self    - the worker looking for something to do
+ *  task    - where to put the task
+ *
+ * Returns:
+ *  true if a task was taken.
+ */
+static bool take_task(tsv_threadpool* pool, tsv_worker* self, tsv_task* task)
+{
+    for (size_t i = 0; i < pool->num_threads; i++) {
+        tsv_worker* worker = &pool->workers[(self->index + i) % pool->num_threads];
+        bool        found  = false;
+
+        pthread_mutex_lock(&worker->lock);
+        size_t count = growbuf_num_elems(worker->tasks, tsv_task);
+        if (worker->head < count) {
+            if (worker == self) {
+                *task = growbuf_index(worker->tasks, worker->head++, tsv_task);
+            }
+            else {
+                *task = growbuf_index(worker->tasks, count - 1, tsv_task);
+                worker->tasks->size -= sizeof(tsv_task);
+                DEBUG fprintf(stderr, "worker %zu stole from worker %zu\n", self->index, worker->index);
+            }
+
+            if (worker->head == growbuf_num_elems(worker->tasks, tsv_task)) {
+                //
+                // queue is drained; reuse its space
+                //
+                worker->tasks->size = 0;
+                worker->head        = 0;
+            }
+            found = true;
+        }
+        pthread_mutex_unlock(&worker->lock);
+
+        if (found) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Worker thread main loop: run tasks until the pool shuts down.
+ *
+ * Args:
+ *  arg - the worker
+ */
+static void* worker_main(void* arg)
+{
+    tsv_worker*     self = (tsv_worker*)arg;
+    tsv_threadpool* pool = self->pool;
+
+    pthread_setspecific(pool->current, self);
+
+    for (;;) {
+        tsv_task task;
+
+        if (take_task(pool, self, &task)) {
+            pthread_mutex_lock(&pool->lock);
+            pool->queued--;
+            pthread_mutex_unlock(&pool->lock);
+
+            task.fn(task.arg);
+
+            pthread_mutex_lock(&pool->lock);
+            if (0 == --pool->pending) {
+                pthread_cond_broadcast(&pool->work_done);
+            }
+            pthread_mutex_unlock(&pool->lock);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->shutdown && 0 == pool->queued) {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        bool done = (0 == pool->queued);    // shutting down, and nothing left to do
+        pthread_mutex_unlock(&pool->lock);
+
+        if (done) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Create a thread pool.
+ *
+ * Args:
+ *  num_threads - number of worker threads to start (at least 1)
+ *
+ * Returns:
+ *  pointer to initialized pool, or NULL on failure.
+ */
+tsv_threadpool* tsv_threadpool_create(size_t num_threads)
+{
+    if (0 == num_threads) {
+        num_threads = 1;
+    }
+
+    tsv_threadpool* pool = (tsv_threadpool*)calloc(1, sizeof(tsv_threadpool));
+    if (NULL == pool) {
+        return NULL;
+    }
+
+    pool->workers = (tsv_worker*)calloc(num_threads, sizeof(tsv_worker));
+    if (NULL == pool->workers || 0 != pthread_key_create(&pool->current, NULL)) {
+        free(pool->workers);
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+
+    for (size_t i = 0; i < num_threads; i++) {
+        tsv_worker* worker = &pool->workers[i];
+
+        worker->pool  = pool;
+        worker->index = i;
+        worker->tasks = growbuf_create(16 * sizeof(tsv_task));
+        if (NULL == worker->tasks) {
+            break;
+        }
+        pthread_mutex_init(&worker->lock, NULL);
+
+        if (0 != pthread_create(&worker->thread, NULL, worker_main, worker)) {
+            DEBUG fprintf(stderr, "only started %zu of %zu threads\n", i, num_threads);
+            pthread_mutex_destroy(&worker->lock);
+            growbuf_free(worker->tasks);
+            break;
+        }
+        pool->num_threads++;
+    }
+
+    if (0 == pool->num_threads) {
+        tsv_threadpool_free(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+/**
+ * Stop a thread pool and free it. Tasks already submitted are finished first.
+ *
+ * Args:
+ *  pool    - pool to free
+ */
+void tsv_threadpool_free(tsv_threadpool* pool)
+{
+    if (NULL == pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->num_threads; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+        pthread_mutex_destroy(&pool->workers[i].lock);
+        growbuf_free(pool->workers[i].tasks);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->work_done);
+    pthread_key_delete(pool->current);
+
+    free(pool->workers);
+    free(pool);
+}
+
+/**
+ * Queue a task to be run on the pool.
+ *
+ * Tasks submitted by a worker go on its own queue; others are spread over
+ * the workers in turn. Idle workers steal from busy ones, so it doesn't
+ * matter much where a task starts out.
+ *
+ * Args:
+ *  pool    - pool to run on
+ *  fn      - function to call
+ *  arg     - argument to pass it
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+int tsv_threadpool_submit(tsv_threadpool* pool, tsv_task_fn fn, void* arg)
+{
+    tsv_task    task   = { .fn = fn, .arg = arg };
+    tsv_worker* worker = (tsv_worker*)pthread_getspecific(pool->current);
+
+    pthread_mutex_lock(&pool->lock);
+
+    if (NULL == worker || worker->pool != pool) {
+        worker = &pool->workers[pool->next_worker++ % pool->num_threads];
+    }
+
+    pthread_mutex_lock(&worker->lock);
+    int result = growbuf_append(worker->tasks, &task, sizeof(task));
+    pthread_mutex_unlock(&worker->lock);
+
+    if (0 == result) {
+        pool->queued++;
+        pool->pending++;
+        pthread_cond_signal(&pool->work_ready);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return result;
+}
+
+/**
+ * Wait for all submitted tasks to finish.
+ *
+ * Args:
+ *  pool    - pool to wait on
+ */
+void tsv_threadpool_wait(tsv_threadpool* pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Get which worker the calling thread is, so tasks can keep per-worker
+ * state.
+ *
+ * Args:
+ *  pool    - the pool
+ *
+ * Returns:
+ *  The worker's index, less than pool->num_threads, or pool->num_threads if
+ *  the caller isn't one of the pool's workers.
+ */
+size_t tsv_threadpool_current_worker(tsv_threadpool* pool)
+{
+    tsv_worker* worker = (tsv_worker*)pthread_getspecific(pool->current);
+
+    return (NULL != worker) ? worker->index : pool->num_threads;
+}
+
+/**
+ * Get the default number of threads to use: one per online CPU.
+ */
+size_t tsv_threadpool_default_size(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (size_t)n : 1;
+}
@@ -0,0 +1,58 @@
+/**
+ * Thread Pool
+ *
+ * Fixed set of worker threads, each with its own task queue, which steal
+ * from each other's queues when their own runs dry.
+ */
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "growbuf.h"
+
+typedef void (*tsv_task_fn)(void* arg);
+
+typedef struct
+{
+    tsv_task_fn fn;
+    void*       arg;
+} tsv_task;
+
+struct _tsv_threadpool;
+
+typedef struct
+{
+    struct _tsv_threadpool* pool;
+    size_t          index;
+    pthread_t       thread;
+    pthread_mutex_t lock;           // guards tasks and head
+    growbuf*        tasks;          // tsv_task
+    size_t          head;
+} tsv_worker;
+
+typedef struct _tsv_threadpool
+{
+    pthread_mutex_t lock;           // guards everything but the workers' queues
+    pthread_cond_t  work_ready;
+    pthread_cond_t  work_done;
+    size_t          queued;         // tasks waiting in any worker's queue
+    size_t          pending;        // tasks queued or running
+    size_t          next_worker;    // queue for the next task submitted from outside
+    bool            shutdown;
+    size_t          num_threads;
+    tsv_worker*     workers;
+    pthread_key_t   current;        // the calling thread's tsv_worker, if it's one
+} tsv_threadpool;
+
+tsv_threadpool* tsv_threadpool_create(size_t num_threads);
+void            tsv_threadpool_free(tsv_threadpool* pool);
+int             tsv_threadpool_submit(tsv_threadpool* pool, tsv_task_fn fn, void* arg);
+void            tsv_threadpool_wait(tsv_threadpool* pool);
+size_t          tsv_threadpool_current_worker(tsv_threadpool* pool);
+size_t          tsv_threadpool_default_size(void);
+
+#endif //THREADPOOL_H
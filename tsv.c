@@ -7,230 +7,676 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <errno.h>
 #include <sysexits.h>
 
 #include "growbuf.h"
+#include "input.h"
+#include "occupancy.h"
+#include "threadpool.h"
 #include "tsv.h"
 
 const size_t initial_col_count = 10;
 
-#define DEBUG if (false)
+//
+// Tables with fewer lines than this per thread are scanned on one thread.
+//
+#define MIN_LINES_PER_CHUNK 16384
 
-static growbuf *line_lengths = NULL;
+#define DEBUG if (false)
 
 typedef struct {
-    size_t start, end;
-} linelen_pair;
+    const char*          data;
+    const tsv_lineindex* lines;
+    size_t               first_line;
+    size_t               end_line;
+    int                  tab_width;
+    size_t               section;   // index of the section it's part of, if any
+    growbuf*             occupancy;
+    size_t               width;
+    int                  result;
+} occupancy_chunk;
 
 /**
- * Get the lengths of the fields (columns) in a TSV file.
+ * Widen an occupancy map to cover at least the given number of columns.
+ * New columns start out unoccupied.
  *
  * Args:
- *  input           - file to read
- *  field_lengths   - initialized growbuf to store the lengths in (as size_t)
- *  file_startpos   - position in the file where TSV data starts
+ *  occupancy   - growbuf holding one byte per column
+ *  width       - number of columns needed
  *
  * Returns:
- *  The number of fields in the file.
+ *  -1 * an errno.h error number. 0 on success.
  */
-size_t tsv_get_field_lengths(FILE* input, growbuf* field_lengths, long file_startpos)
+static int occupancy_widen(growbuf* occupancy, size_t width)
 {
-    size_t num_fields = 0;
-    size_t field_len  = 0;
+    if (occupancy->size >= width) {
+        return 0;
+    }
 
-    fseek(input, 0, SEEK_SET);
-    get_line_lengths(input);
-    fseek(input, file_startpos, SEEK_SET);
+    int result = growbuf_reserve(occupancy, width - occupancy->size);
+    if (0 != result) {
+        return result;
+    }
 
-    do {
-        field_len = locate_field(input, num_fields++, field_lengths, file_startpos);
-        growbuf_append(field_lengths, (void*)&field_len, sizeof(size_t));
-    } while (field_len != 0);
+    memset((char*)occupancy->buf + occupancy->size, 0, width - occupancy->size);
+    occupancy->size = width;
 
-    growbuf_free(line_lengths);
-   
-    return num_fields;
+    return 0;
 }
 
 /**
- * Check whether a column in a file contains only spaces.
+ * Build the column occupancy map of a table in one sequential pass.
+ *
+ * Column k of the map is set if any line has a non-space character at
+ * column k. The table ends at the first empty line, or at EOF.
  *
- * Arguments:
- *  input   - file to read
- *  linepos - column (0-based) to check
+ * Args:
+ *  input       - input to read, positioned at the start of a line
+ *  occupancy   - initialized, empty growbuf to store the map in (one byte per
+ *                column, nonzero if occupied)
  *
  * Returns:
- *  0 if all lines contain spaces in the given column, or are shorter and
- *      don't extend into the given column.
- *  Otherwise, the number of columns to move right to get to a space in the
- *      first row found to have a non-space character in the given column.
+ *  The width of the widest line read.
  */
-size_t check_column(FILE* input, size_t linepos)
+size_t tsv_column_occupancy(tsv_input* input, growbuf* occupancy)
 {
-    size_t hint = 0;
-    long   pos  = ftell(input);
-
-    size_t line_no = 1;
-    int c;
-    do {
-        size_t line_len = nextline(input);
-        if (line_len == 0) {
-            // past the last line
-            c = EOF;
+    size_t      max_width = 0;
+    const char* line;
+    size_t      len;
+
+    while (tsv_input_getline(input, &line, &len)) {
+        if (0 == len) {
+            DEBUG fprintf(stderr, "empty line; end of table.\n");
             break;
         }
-        else if (linepos >= line_len) {
-            DEBUG fprintf(stderr, "line too sort; continuing.\n");
-            c = ' ';
-            continue;
+
+        if (len > max_width) {
+            if (0 != occupancy_widen(occupancy, len)) {
+                break;
+            }
+            max_width = len;
         }
-        else {
-            fseek(input, linepos, SEEK_CUR);
-            c = fgetc(input);
-            DEBUG fprintf(stderr, "line %zu: got (%c)\n", line_no++, (char)c);
+
+        tsv_occupancy_or((unsigned char*)occupancy->buf, line, len);
+    }
+
+    return max_width;
+}
+
+/**
+ * Build the occupancy map of one chunk of lines. Runs on a worker thread.
+ *
+ * Args:
+ *  arg - the occupancy_chunk to scan; its occupancy, width and result are
+ *        filled in.
+ */
+static void occupancy_chunk_run(void* arg)
+{
+    occupancy_chunk* chunk   = (occupancy_chunk*)arg;
+    growbuf*         scratch = NULL;
+    tsv_linecursor   cursor;
+    uint64_t         offset;
+    size_t           len;
+
+    chunk->occupancy = growbuf_create(initial_col_count * 8);
+    scratch          = growbuf_create(512);
+    if (NULL == chunk->occupancy || NULL == scratch) {
+        chunk->result = -ENOMEM;
+        goto cleanup;
+    }
+
+    tsv_linecursor_init(&cursor, chunk->lines, chunk->first_line);
+    while (cursor.line < chunk->end_line && tsv_linecursor_next(&cursor, &offset, &len)) {
+        const char* line = chunk->data + offset;
+
+        if (chunk->tab_width > 0) {
+            line = tsv_expand_tabs(line, len, chunk->tab_width, scratch, &len);
+            if (NULL == line) {
+                chunk->result = -ENOMEM;
+                goto cleanup;
+            }
+        }
+
+        if (len > chunk->width) {
+            chunk->result = occupancy_widen(chunk->occupancy, len);
+            if (0 != chunk->result) {
+                goto cleanup;
+            }
+            chunk->width = len;
         }
-    } while (c == ' ');
 
-    if (c != EOF) {
-        while ((char)c != ' ' && (char)c != '\n' && c != EOF) {
-            c = fgetc(input);
-            hint++;
+        tsv_occupancy_or((unsigned char*)chunk->occupancy->buf, line, len);
+    }
+
+cleanup:
+    growbuf_free(scratch);
+}
+
+/**
+ * OR a chunk's occupancy map into a table's.
+ *
+ * Args:
+ *  occupancy   - the table's map; widened as needed
+ *  width       - width of the table's map; updated
+ *  chunk       - chunk whose map to merge, once occupancy_chunk_run() is done
+ *
+ * Returns:
+ *  -1 * an errno.h error number, from scanning the chunk or widening the
+ *  map. 0 on success.
+ */
+static int occupancy_merge(growbuf* occupancy, size_t* width, const occupancy_chunk* chunk)
+{
+    if (0 != chunk->result) {
+        return chunk->result;
+    }
+
+    if (chunk->width > *width) {
+        int result = occupancy_widen(occupancy, chunk->width);
+        if (0 != result) {
+            return result;
         }
+        *width = chunk->width;
     }
 
-    fseek(input, pos, SEEK_SET);
+    unsigned char*       occupied = (unsigned char*)occupancy->buf;
+    const unsigned char* partial  = (const unsigned char*)chunk->occupancy->buf;
+    for (size_t k = 0; k < chunk->width; k++) {
+        occupied[k] |= partial[k];
+    }
 
-    return hint;
+    return 0;
 }
 
 /**
- * Figure out the length of the Nth field in a TSV file.
+ * Build the column occupancy map of a table on a thread pool.
  *
- * This needs the lengths of fields < N in order to work properly.
+ * The table is split into chunks of whole lines, each chunk gets its own map,
+ * and the maps are ORed together. This gives the same result as
+ * tsv_column_occupancy().
  *
  * Args:
- *  input           - file to read
- *  index           - index of the field to find
- *  field_lengths   - growbuf with the lengths of all the fields up to this one
- *  file_startpos   - position in the file where TSV data starts
+ *  input       - in-memory input, positioned at the start of a line
+ *  occupancy   - initialized, empty growbuf to store the map in
+ *  pool        - thread pool to run on
+ *  width       - set to the width of the widest line read
  *
  * Returns:
- *  Length of the field, or 0 if it is the last field (this means it continues
- *  to EOL).
+ *  -1 * an errno.h error number. 0 on success.
  */
-size_t locate_field(FILE* input, size_t index, const growbuf* field_lengths, long file_startpos)
+static int parallel_occupancy(tsv_input* input, growbuf* occupancy, tsv_threadpool* pool, size_t* width)
 {
+    const tsv_lineindex* lines  = tsv_input_lines(input);
+    occupancy_chunk*     chunks = NULL;
+    size_t               num_chunks;
+    int                  result = 0;
+
     //
-    // seek to the end of all the previous fields on the first line
+    // The table ends at the first empty line; the index knows where that is
+    // without having to look at the data.
     //
+    size_t first_line = tsv_lineindex_lookup(lines, tsv_input_tell(input));
+    size_t end_line   = first_line;
+    while (end_line < lines->num_lines && 0 != tsv_lineindex_length(lines, end_line)) {
+        end_line++;
+    }
+
+    num_chunks = (end_line - first_line) / MIN_LINES_PER_CHUNK;
+    if (num_chunks > pool->num_threads) {
+        num_chunks = pool->num_threads;
+    }
+    if (num_chunks < 2) {
+        *width = tsv_column_occupancy(input, occupancy);
+        return 0;
+    }
+
+    DEBUG fprintf(stderr, "scanning lines %zu-%zu in %zu chunks\n", first_line, end_line, num_chunks);
 
-    long line_startpos = 0;
-    for (size_t i = 0; i < index; i++) {
-        line_startpos += ((size_t*)field_lengths->buf)[i];
+    chunks = (occupancy_chunk*)calloc(num_chunks, sizeof(occupancy_chunk));
+    if (NULL == chunks) {
+        return -ENOMEM;
     }
 
-    DEBUG fprintf(stderr, "file start pos: %ld\n", file_startpos);
-    DEBUG fprintf(stderr, "line start pos: %ld\n", line_startpos);
+    size_t per_chunk = (end_line - first_line) / num_chunks;
+    for (size_t i = 0; i < num_chunks; i++) {
+        chunks[i].data       = input->data;
+        chunks[i].lines      = lines;
+        chunks[i].first_line = first_line + i * per_chunk;
+        chunks[i].end_line   = (i == num_chunks - 1) ? end_line : chunks[i].first_line + per_chunk;
+        chunks[i].tab_width  = input->tab_width;
+
+        if (0 != tsv_threadpool_submit(pool, occupancy_chunk_run, &chunks[i])) {
+            //
+            // couldn't queue it; do it here instead
+            //
+            occupancy_chunk_run(&chunks[i]);
+        }
+    }
 
-    fseek(input, file_startpos + line_startpos, SEEK_SET);
+    tsv_threadpool_wait(pool);
 
     //
-    // find a field on the first line
+    // OR-reduce the chunks' maps
     //
+    *width = 0;
+    for (size_t i = 0; i < num_chunks; i++) {
+        int merged = occupancy_merge(occupancy, width, &chunks[i]);
+        if (0 != merged) {
+            result = merged;
+        }
+    }
 
-    size_t field_len = 0;
-    int c;
-    do {
-        c = fgetc(input);
-        field_len++;
+    for (size_t i = 0; i < num_chunks; i++) {
+        growbuf_free(chunks[i].occupancy);
+    }
+    free(chunks);
 
-        if ((char)c == ' ' && field_len > 1) {
-            DEBUG fprintf(stderr, "whitespace at %lu\n", line_startpos + field_len);
+    //
+    // leave the input where the serial scan would have
+    //
+    tsv_input_seek_line(input, end_line + 1);
 
-            size_t hint = 0;
-            if (0 == (hint = check_column(input, line_startpos + field_len - 1))) {
-                DEBUG fprintf(stderr, "found a field of length %zu\n", field_len);
-                break;
+    return result;
+}
+
+/**
+ * Find the field boundaries on a header line, given the occupancy map of the
+ * lines below it.
+ *
+ * Args:
+ *  first           - the header line, with tabs expanded
+ *  first_len       - its length
+ *  occupied        - occupancy map of the rest of the table
+ *  width           - width of the map
+ *  field_lengths   - growbuf to append the lengths to (as size_t)
+ *
+ * Returns:
+ *  The number of fields, or 0 if out of memory.
+ */
+static size_t field_boundaries(const char* first, size_t first_len, const unsigned char* occupied, size_t width, growbuf* field_lengths)
+{
+    size_t num_fields = 0;
+    size_t start      = 0;
+    size_t field_len;
+
+    for (size_t k = 0; ; k++) {
+        if (k >= first_len) {
+            //
+            // special case: the last field on the line is given as length 0
+            //
+            DEBUG fprintf(stderr, "found last field\n");
+            field_len = 0;
+            if (0 != growbuf_push(field_lengths, size_t, field_len)) {
+                return 0;
             }
-            else {
-                DEBUG fprintf(stderr, "nope, seeking %zu\n", hint);
-                fseek(input, hint - 1, SEEK_CUR);
-                field_len += hint - 1;
+            num_fields++;
+            break;
+        }
+
+        if (' ' == first[k] && k > start && (k >= width || !occupied[k])) {
+            field_len = k - start + 1;
+            DEBUG fprintf(stderr, "found a field of length %zu\n", field_len);
+            if (0 != growbuf_push(field_lengths, size_t, field_len)) {
+                return 0;
             }
+            num_fields++;
+            start = k + 1;
         }
-    } while (c != EOF && (char)c != '\n');
+    }
+
+    return num_fields;
+}
+
+/**
+ * Get the lengths of the fields (columns) in a TSV file.
+ *
+ * A field ends at a space on the first line which has a space (or nothing)
+ * below it on every following line of the table. The first character of a
+ * field is never a field boundary.
+ *
+ * Args:
+ *  input           - input to read
+ *  field_lengths   - initialized growbuf to store the lengths in (as size_t)
+ *  file_startpos   - position in the file where TSV data starts
+ *  pool            - thread pool to scan the table on, or NULL to scan it on
+ *                    this thread. Only in-memory inputs are scanned in
+ *                    parallel.
+ *
+ * Returns:
+ *  The number of fields in the file, or 0 on error. The last field is given
+ *  as length 0, which means it continues to EOL.
+ */
+size_t tsv_get_field_lengths(tsv_input* input, growbuf* field_lengths, off_t file_startpos, tsv_threadpool* pool)
+{
+    size_t   num_fields = 0;
+    size_t   width      = 0;
+    growbuf* first_line = growbuf_create(initial_col_count * 8);
+    growbuf* occupancy  = growbuf_create(initial_col_count * 8);
+
+    if (NULL == first_line || NULL == occupancy) {
+        fprintf(stderr, "malloc failed\n");
+        goto cleanup;
+    }
+
+    tsv_input_seek(input, file_startpos);
 
-    if ((char)c == '\n') {
+    const char* line;
+    size_t      len;
+    if (tsv_input_getline(input, &line, &len)) {
         //
-        // special case: the last field on the line is given as length 0
+        // copy it, because the next read may overwrite it
         //
-        DEBUG fprintf(stderr, "found last field\n");
-        field_len = 0;
+        growbuf_append(first_line, line, len);
     }
-    
-    return field_len;
+
+    if (NULL != pool && NULL != tsv_input_lines(input)) {
+        if (0 != parallel_occupancy(input, occupancy, pool, &width)) {
+            fprintf(stderr, "malloc failed\n");
+            goto cleanup;
+        }
+    }
+    else {
+        width = tsv_column_occupancy(input, occupancy);
+    }
+
+    DEBUG fprintf(stderr, "first line is %zu wide, table is %zu wide\n", first_line->size, width);
+
+    num_fields = field_boundaries((const char*)first_line->buf, first_line->size,
+            (const unsigned char*)occupancy->buf, width, field_lengths);
+
+cleanup:
+    growbuf_free(first_line);
+    growbuf_free(occupancy);
+
+    return num_fields;
 }
 
 /**
- * Compute the lengths of all lines of the given file.
- * This is used by nextline() to avoid having to do any unnecessary repeated 
- * reads on the file. It won't work without first calling this method.
+ * Find out whether a line is blank: nothing but spaces, tabs, carriage
+ * returns, and form feeds.
+ *
+ * Args:
+ *  line    - line to check
+ *  len     - its length
  *
- * Note that because this uses a static variable, this means nextline() will
- * only work on the file given to this function. (TODO: fix this limitation)
+ * Returns:
+ *  true if it's blank.
  */
-void get_line_lengths(FILE* input)
+static bool is_blank(const char* line, size_t len)
 {
-    line_lengths = growbuf_create(10*sizeof(linelen_pair));
-    
-    size_t pos   = 0;
-    size_t start = 0;
-    size_t line_no = 1;
-    int    c;
-    do {
-        c = fgetc(input);
-        if ((char)c == '\n' || c == EOF) {
-            linelen_pair p = { .start = start, .end = pos };
-            DEBUG fprintf(stderr, "line %zu, (%zX - %zX)\n", line_no++, start, pos);
-            growbuf_append(line_lengths, &p, sizeof(linelen_pair));
-            start = pos+1;
-        }
-        pos++;
-    } while (c != EOF);
+    for (size_t i = 0; i < len; i++) {
+        switch (line[i]) {
+        case ' ': case '\t': case '\r': case '\f': case '\v':
+            break;
+        default:
+            return false;
+        }
+    }
+
+    return true;
 }
 
 /**
- * Seek to the start of the next line in a file.
+ * Split the lines of an in-memory input into sections.
+ *
+ * Blank lines separate sections, and aren't part of any. A line starting
+ * with a form feed, or which is the same as the first section's header line
+ * (apart from a leading form feed), starts a new section.
  *
  * Args:
- *  input   - file to seek in
+ *  data        - the input's data
+ *  lines       - its line index
+ *  first_line  - line to start at
+ *  sections    - growbuf to append the sections to (as tsv_section), without
+ *                their layouts
  *
  * Returns:
- *  The length of the new line now positioned on.
+ *  -1 * an errno.h error number. 0 on success.
  */
-size_t nextline(FILE* input)
+static int split_sections(const char* data, const tsv_lineindex* lines, size_t first_line, growbuf* sections)
 {
-    int pos = ftell(input);
+    const char*    header     = NULL;   // the first section's header line
+    size_t         header_len = 0;
+    bool           in_section = false;
+    tsv_linecursor cursor;
+    uint64_t       offset;
+    size_t         len;
+
+    tsv_linecursor_init(&cursor, lines, first_line);
+    while (tsv_linecursor_next(&cursor, &offset, &len)) {
+        size_t      line_no = cursor.line - 1;
+        const char* text    = data + offset;
+
+        if (is_blank(text, len)) {
+            in_section = false;
+            continue;
+        }
 
-    DEBUG fprintf(stderr, "position is %X\n", pos);
+        bool form_feed = ('\f' == text[0]);
+        while (len > 0 && '\f' == text[0]) {
+            text++;
+            len--;
+        }
 
-    if (NULL == line_lengths) {
-        fprintf(stderr, "BUG: nextline(): line lengths are unset!\n");
-        return 0;
-    }
+        bool repeated = (NULL != header && len == header_len && 0 == memcmp(text, header, len));
 
-    for (size_t i = 0; i < growbuf_num_elems(line_lengths, linelen_pair); i++) {
-        linelen_pair p = growbuf_index(line_lengths, i, linelen_pair);
-        if (pos >= p.start && pos <= p.end) {
-            DEBUG fprintf(stderr, "on line %zu\n", i+1);
-            DEBUG fprintf(stderr, "line starts at %zX and ends at %zX\n", p.start, p.end);
-            fseek(input, p.end - pos + 1, SEEK_CUR);
+        if (!in_section || form_feed || repeated) {
+            tsv_section section = {
+                .first_line      = line_no,
+                .start           = (uint64_t)(text - data),
+                .repeated_header = repeated,
+            };
 
-            linelen_pair next = growbuf_index(line_lengths, i+1, linelen_pair);
-            return (next.end - next.start);
+            if (0 != growbuf_push(sections, tsv_section, section)) {
+                return -ENOMEM;
+            }
+            in_section = true;
+
+            if (NULL == header) {
+                header     = text;
+                header_len = len;
+            }
         }
+
+        growbuf_index(sections, growbuf_num_elems(sections, tsv_section) - 1, tsv_section).end_line = line_no + 1;
     }
 
     return 0;
 }
 
+/**
+ * Split an in-memory input into sections, and get the lengths of the fields
+ * in each one.
+ *
+ * Each section is a table with its own layout, found the same way as
+ * tsv_get_field_lengths() finds the layout of the whole input; its first
+ * line is its header line. Blank lines separate sections, and aren't part of
+ * any. A line starting with a form feed, or a repeat of the first section's
+ * header line, starts a new section; the form feeds aren't part of its
+ * header line.
+ *
+ * The sections' lines are split into chunks which are scanned in parallel:
+ * one chunk per section for small sections, and more for big ones.
+ *
+ * Args:
+ *  input           - in-memory input
+ *  file_startpos   - position in the file where TSV data starts
+ *  pool            - thread pool to scan the sections on, or NULL to scan
+ *                    them on this thread
+ *  sections        - initialized, empty growbuf to store the sections in (as
+ *                    tsv_section); free them with tsv_free_sections()
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success. -EINVAL if the input isn't
+ *  in memory.
+ */
+int tsv_find_sections(tsv_input* input, off_t file_startpos, tsv_threadpool* pool, growbuf* sections)
+{
+    const tsv_lineindex* lines      = NULL;
+    growbuf*             chunks     = NULL;
+    growbuf*             occupancy  = NULL;
+    growbuf*             scratch    = NULL;
+    size_t               num_sections;
+    size_t               num_chunks;
+    size_t               chunk_lines = SIZE_MAX;
+    size_t               total_lines = 0;
+    int                  result;
+
+    result = tsv_input_seek(input, file_startpos);
+    if (0 != result) {
+        return result;
+    }
+
+    lines = tsv_input_lines(input);
+    if (NULL == lines) {
+        return -EINVAL;
+    }
+
+    result = split_sections(input->data, lines, tsv_lineindex_lookup(lines, file_startpos), sections);
+    if (0 != result) {
+        return result;
+    }
+
+    num_sections = growbuf_num_elems(sections, tsv_section);
+    for (size_t s = 0; s < num_sections; s++) {
+        const tsv_section* section = &growbuf_index(sections, s, tsv_section);
+        total_lines += section->end_line - section->first_line - 1;
+    }
+
+    //
+    // Spread big sections over the threads, but don't split them any finer
+    // than tsv_get_field_lengths() would.
+    //
+    if (NULL != pool) {
+        chunk_lines = total_lines / pool->num_threads + 1;
+        if (chunk_lines < MIN_LINES_PER_CHUNK) {
+            chunk_lines = MIN_LINES_PER_CHUNK;
+        }
+    }
+
+    chunks    = growbuf_create(initial_col_count * sizeof(occupancy_chunk));
+    occupancy = growbuf_create(initial_col_count * 8);
+    scratch   = growbuf_create(512);
+    if (NULL == chunks || NULL == occupancy || NULL == scratch) {
+        result = -ENOMEM;
+        goto cleanup;
+    }
+
+    for (size_t s = 0; s < num_sections; s++) {
+        const tsv_section* section = &growbuf_index(sections, s, tsv_section);
+
+        //
+        // The header line isn't part of the occupancy map.
+        //
+        size_t line = section->first_line + 1;
+        while (line < section->end_line) {
+            occupancy_chunk chunk = {
+                .data       = input->data,
+                .lines      = lines,
+                .first_line = line,
+                .end_line   = (section->end_line - line > chunk_lines) ? line + chunk_lines : section->end_line,
+                .tab_width  = input->tab_width,
+                .section    = s,
+            };
+
+            result = growbuf_push(chunks, occupancy_chunk, chunk);
+            if (0 != result) {
+                goto cleanup;
+            }
+            line = chunk.end_line;
+        }
+    }
+
+    num_chunks = growbuf_num_elems(chunks, occupancy_chunk);
+
+    DEBUG fprintf(stderr, "%zu sections, %zu lines, scanning in %zu chunks\n", num_sections, total_lines, num_chunks);
+
+    for (size_t i = 0; i < num_chunks; i++) {
+        occupancy_chunk* chunk = &growbuf_index(chunks, i, occupancy_chunk);
+
+        if (NULL == pool || 0 != tsv_threadpool_submit(pool, occupancy_chunk_run, chunk)) {
+            occupancy_chunk_run(chunk);
+        }
+    }
+
+    if (NULL != pool) {
+        tsv_threadpool_wait(pool);
+    }
+
+    //
+    // The chunks are in section order; merge each section's, then find its
+    // fields from its header line.
+    //
+    size_t next_chunk = 0;
+    for (size_t s = 0; s < num_sections; s++) {
+        tsv_section* section = &growbuf_index(sections, s, tsv_section);
+        size_t       width   = 0;
+        uint64_t     offset  = tsv_lineindex_offset(lines, section->first_line);
+        const char*  header  = input->data + section->start;
+        size_t       len     = tsv_lineindex_length(lines, section->first_line) - (size_t)(section->start - offset);
+
+        occupancy->size = 0;
+        for (; next_chunk < num_chunks && s == growbuf_index(chunks, next_chunk, occupancy_chunk).section; next_chunk++) {
+            int merged = occupancy_merge(occupancy, &width, &growbuf_index(chunks, next_chunk, occupancy_chunk));
+            if (0 != merged) {
+                result = merged;
+            }
+        }
+        if (0 != result) {
+            continue;
+        }
+
+        if (input->tab_width > 0) {
+            header = tsv_expand_tabs(header, len, input->tab_width, scratch, &len);
+            if (NULL == header) {
+                result = -ENOMEM;
+                continue;
+            }
+        }
+
+        section->field_lengths = growbuf_create(initial_col_count * sizeof(size_t));
+        if (NULL == section->field_lengths) {
+            result = -ENOMEM;
+            continue;
+        }
+
+        section->num_fields = field_boundaries(header, len, (const unsigned char*)occupancy->buf, width, section->field_lengths);
+        if (0 == section->num_fields) {
+            result = -ENOMEM;
+        }
+
+        DEBUG fprintf(stderr, "section %zu: lines %zu-%zu, %zu fields\n", s, section->first_line, section->end_line, section->num_fields);
+    }
+
+cleanup:
+    if (NULL != chunks) {
+        for (size_t i = 0; i < growbuf_num_elems(chunks, occupancy_chunk); i++) {
+            growbuf_free(growbuf_index(chunks, i, occupancy_chunk).occupancy);
+        }
+        growbuf_free(chunks);
+    }
+    growbuf_free(occupancy);
+    growbuf_free(scratch);
+
+    return result;
+}
+
+/**
+ * Free the sections found by tsv_find_sections(), and the growbuf they're
+ * in.
+ *
+ * Args:
+ *  sections    - growbuf of tsv_section
+ */
+void tsv_free_sections(growbuf* sections)
+{
+    if (NULL == sections) {
+        return;
+    }
+
+    for (size_t s = 0; s < growbuf_num_elems(sections, tsv_section); s++) {
+        growbuf_free(growbuf_index(sections, s, tsv_section).field_lengths);
+    }
+    growbuf_free(sections);
+}
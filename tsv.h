@@ -8,10 +8,26 @@
 #define TSV_H
 
 #include "growbuf.h"
+#include "input.h"
+#include "threadpool.h"
 
-size_t tsv_get_field_lengths(FILE* input, growbuf* field_lengths, long file_startpos);
-size_t locate_field(FILE* input, size_t index, const growbuf* field_lengths, long file_startpos);
-void get_line_lengths(FILE* input);
-size_t nextline(FILE* input);
+//
+// One table of a multi-section input, with its own layout; see
+// tsv_find_sections().
+//
+typedef struct
+{
+    size_t   first_line;        // 0-based line number of its header line
+    uint64_t start;             // offset of its header line, past any form feeds it starts with
+    size_t   end_line;          // one past its last line
+    bool     repeated_header;   // its header line repeats the first section's
+    growbuf* field_lengths;     // size_t each; the last one is 0
+    size_t   num_fields;
+} tsv_section;
+
+size_t tsv_get_field_lengths(tsv_input* input, growbuf* field_lengths, off_t file_startpos, tsv_threadpool* pool);
+size_t tsv_column_occupancy(tsv_input* input, growbuf* occupancy);
+int    tsv_find_sections(tsv_input* input, off_t file_startpos, tsv_threadpool* pool, growbuf* sections);
+void   tsv_free_sections(growbuf* sections);
 
 #endif
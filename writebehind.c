@@ -0,0 +1,246 @@
+/**
+ * Write-Behind
+ *
+ * Writes converted output to a sink on a background thread, so converting
+ * carries on while the last buffer is still being written. A fixed ring of
+ * buffers bounds how far conversion can get ahead of the output.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "writebehind.h"
+
+#define DEBUG if (false)
+
+/**
+ * Write-behind thread: writes out buffers as they're queued, until it's told
+ * to stop and the queue is empty.
+ *
+ * After a write fails, buffers are thrown away instead of written, so the
+ * caller doesn't block; it finds out about the error from the next submit.
+ *
+ * Args:
+ *  arg - the tsv_writebehind
+ *
+ * Returns:
+ *  NULL
+ */
+static void* writebehind_thread(void* arg)
+{
+    tsv_writebehind* wb = (tsv_writebehind*)arg;
+
+    pthread_mutex_lock(&wb->lock);
+    for (;;) {
+        while (0 == wb->count && !wb->stop) {
+            pthread_cond_wait(&wb->queued, &wb->lock);
+        }
+
+        if (0 == wb->count) {
+            break;
+        }
+
+        growbuf* buf   = wb->buffers[wb->head];
+        bool     write = (0 == wb->error);
+
+        pthread_mutex_unlock(&wb->lock);
+        int result = write ? tsv_flush_output(buf, &wb->sink, wb->stats) : 0;
+        buf->size = 0;
+        pthread_mutex_lock(&wb->lock);
+
+        if (0 != result) {
+            DEBUG fprintf(stderr, "write-behind failed: %d\n", result);
+            wb->error = result;
+        }
+
+        wb->head = (wb->head + 1) % wb->num_buffers;
+        wb->count--;
+        pthread_cond_broadcast(&wb->written);
+    }
+    pthread_mutex_unlock(&wb->lock);
+
+    return NULL;
+}
+
+/**
+ * Start writing behind to a sink.
+ *
+ * If a thread can't be started, buffers are written as they're submitted
+ * instead, which is slower but otherwise the same.
+ *
+ * Args:
+ *  sink        - where to write; copied
+ *  stats       - stats to count the writes in, or NULL
+ *  buffer_size - initial size of each buffer
+ *  num_buffers - number of buffers: the one being filled, and up to
+ *                num_buffers - 1 waiting to be written. At least 2.
+ *
+ * Returns:
+ *  The new write-behind, or NULL if out of memory.
+ */
+tsv_writebehind* tsv_writebehind_create(const tsv_sink* sink, tsv_stats* stats, size_t buffer_size, size_t num_buffers)
+{
+    tsv_writebehind* wb = (tsv_writebehind*)calloc(1, sizeof(tsv_writebehind));
+    if (NULL == wb) {
+        return NULL;
+    }
+
+    wb->sink        = *sink;
+    wb->stats       = stats;
+    wb->num_buffers = (num_buffers < 2) ? 2 : num_buffers;
+
+    wb->buffers = (growbuf**)calloc(wb->num_buffers, sizeof(growbuf*));
+    if (NULL == wb->buffers) {
+        free(wb);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < wb->num_buffers; i++) {
+        wb->buffers[i] = growbuf_create(buffer_size);
+        if (NULL == wb->buffers[i]) {
+            for (size_t j = 0; j < i; j++) {
+                growbuf_free(wb->buffers[j]);
+            }
+            free(wb->buffers);
+            free(wb);
+            return NULL;
+        }
+    }
+
+    pthread_mutex_init(&wb->lock, NULL);
+    pthread_cond_init(&wb->queued, NULL);
+    pthread_cond_init(&wb->written, NULL);
+
+    wb->running = (0 == pthread_create(&wb->thread, NULL, writebehind_thread, wb));
+    DEBUG if (!wb->running) fprintf(stderr, "no write-behind thread; writing synchronously\n");
+
+    return wb;
+}
+
+/**
+ * Write out everything submitted, stop the thread, and free everything.
+ * Anything in the caller's buffer that wasn't submitted is thrown away.
+ *
+ * Args:
+ *  wb  - write-behind to free
+ *
+ * Returns:
+ *  -1 * an errno.h error number from any write that failed. 0 on success.
+ */
+int tsv_writebehind_free(tsv_writebehind* wb)
+{
+    if (NULL == wb) {
+        return 0;
+    }
+
+    int result = tsv_writebehind_drain(wb);
+
+    if (wb->running) {
+        pthread_mutex_lock(&wb->lock);
+        wb->stop = true;
+        pthread_cond_broadcast(&wb->queued);
+        pthread_mutex_unlock(&wb->lock);
+
+        pthread_join(wb->thread, NULL);
+    }
+
+    for (size_t i = 0; i < wb->num_buffers; i++) {
+        growbuf_free(wb->buffers[i]);
+    }
+    free(wb->buffers);
+
+    pthread_mutex_destroy(&wb->lock);
+    pthread_cond_destroy(&wb->queued);
+    pthread_cond_destroy(&wb->written);
+    free(wb);
+
+    return result;
+}
+
+/**
+ * Get the buffer to fill with output.
+ *
+ * Args:
+ *  wb  - write-behind to write to
+ *
+ * Returns:
+ *  The caller's buffer. It stays the caller's until it's submitted.
+ */
+growbuf* tsv_writebehind_buffer(tsv_writebehind* wb)
+{
+    pthread_mutex_lock(&wb->lock);
+    growbuf* out = wb->buffers[(wb->head + wb->count) % wb->num_buffers];
+    pthread_mutex_unlock(&wb->lock);
+
+    return out;
+}
+
+/**
+ * Queue the caller's buffer to be written, and swap it for an empty one.
+ * Blocks while the ring is full.
+ *
+ * Args:
+ *  wb  - write-behind to write to
+ *  out - the caller's buffer, from tsv_writebehind_buffer() or an earlier
+ *        submit; set to its replacement
+ *
+ * Returns:
+ *  -1 * an errno.h error number if a write has failed. 0 on success.
+ */
+int tsv_writebehind_submit(tsv_writebehind* wb, growbuf** out)
+{
+    int result;
+
+    if (!wb->running) {
+        if (0 == wb->error) {
+            wb->error = tsv_flush_output(*out, &wb->sink, wb->stats);
+        }
+        (*out)->size = 0;
+        return wb->error;
+    }
+
+    pthread_mutex_lock(&wb->lock);
+
+    wb->count++;
+    pthread_cond_signal(&wb->queued);
+
+    while (wb->count == wb->num_buffers) {
+        pthread_cond_wait(&wb->written, &wb->lock);
+    }
+
+    *out = wb->buffers[(wb->head + wb->count) % wb->num_buffers];
+    (*out)->size = 0;
+    result = wb->error;
+
+    pthread_mutex_unlock(&wb->lock);
+
+    return result;
+}
+
+/**
+ * Wait until everything submitted has been written.
+ *
+ * Args:
+ *  wb  - write-behind to wait for
+ *
+ * Returns:
+ *  -1 * an errno.h error number if a write has failed. 0 on success.
+ */
+int tsv_writebehind_drain(tsv_writebehind* wb)
+{
+    pthread_mutex_lock(&wb->lock);
+
+    while (wb->count > 0) {
+        pthread_cond_wait(&wb->written, &wb->lock);
+    }
+    int result = wb->error;
+
+    pthread_mutex_unlock(&wb->lock);
+
+    return result;
+}
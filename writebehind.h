@@ -0,0 +1,44 @@
+/**
+ * Write-Behind
+ *
+ * Writes converted output to a sink on a background thread, so converting
+ * carries on while the last buffer is still being written. A fixed ring of
+ * buffers bounds how far conversion can get ahead of the output.
+ */
+
+#ifndef WRITEBEHIND_H
+#define WRITEBEHIND_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "growbuf.h"
+#include "convert.h"
+#include "stats.h"
+
+typedef struct _tsv_writebehind
+{
+    tsv_sink        sink;
+    tsv_stats*      stats;
+    size_t          num_buffers;
+    growbuf**       buffers;        // ring; queued ones start at head, then the caller's
+    pthread_t       thread;
+    bool            running;        // false if it couldn't be started; written synchronously
+
+    pthread_mutex_t lock;           // guards everything below
+    pthread_cond_t  queued;
+    pthread_cond_t  written;
+    size_t          head;           // next buffer to write
+    size_t          count;          // buffers queued to be written
+    bool            stop;
+    int             error;          // -1 * an errno.h error number, from the first failed write
+} tsv_writebehind;
+
+tsv_writebehind* tsv_writebehind_create(const tsv_sink* sink, tsv_stats* stats, size_t buffer_size, size_t num_buffers);
+int              tsv_writebehind_free(tsv_writebehind* wb);
+growbuf*         tsv_writebehind_buffer(tsv_writebehind* wb);
+int              tsv_writebehind_submit(tsv_writebehind* wb, growbuf** out);
+int              tsv_writebehind_drain(tsv_writebehind* wb);
+
+#endif //WRITEBEHIND_H
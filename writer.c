@@ -0,0 +1,623 @@
+/**
+ * Output Writers
+ *
+ * Encoders for JSON Lines and PostgreSQL COPY; CSV is in csvformat.c.
+ *
+ * Each encoder copies runs of bytes which don't need escaping in one go,
+ * finding the end of each run with a lookup table.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "growbuf.h"
+#include "writer.h"
+
+#define DEBUG if (false)
+
+//
+// Bytes which JSON strings can't hold as they are: quote, backslash, and
+// control characters.
+//
+static const unsigned char json_special[256] = {
+    [0x00] = 1, [0x01] = 1, [0x02] = 1, [0x03] = 1, [0x04] = 1, [0x05] = 1, [0x06] = 1, [0x07] = 1,
+    [0x08] = 1, [0x09] = 1, [0x0a] = 1, [0x0b] = 1, [0x0c] = 1, [0x0d] = 1, [0x0e] = 1, [0x0f] = 1,
+    [0x10] = 1, [0x11] = 1, [0x12] = 1, [0x13] = 1, [0x14] = 1, [0x15] = 1, [0x16] = 1, [0x17] = 1,
+    [0x18] = 1, [0x19] = 1, [0x1a] = 1, [0x1b] = 1, [0x1c] = 1, [0x1d] = 1, [0x1e] = 1, [0x1f] = 1,
+    ['"']  = 1, ['\\'] = 1,
+};
+
+//
+// Bytes which COPY text format needs backslash-escaped.
+//
+static const unsigned char pgtext_special[256] = {
+    ['\\'] = 1, ['\t'] = 1, ['\n'] = 1, ['\r'] = 1,
+};
+
+//
+// PostgreSQL COPY binary format file header: signature, flags, and header
+// extension length.
+//
+static const char pgbinary_header[] = "PGCOPY\n\377\r\n\0" "\0\0\0\0" "\0\0\0\0";
+
+/**
+ * Look up an output format by name.
+ *
+ * Args:
+ *  name    - "csv", "jsonl", "pgcopy", or "pgbinary"
+ *  format  - where to put the format
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success; -EINVAL for an unknown name.
+ */
+int tsv_parse_format(const char* name, tsv_format* format)
+{
+    if (0 == strcmp("csv", name)) {
+        *format = TSV_FORMAT_CSV;
+    }
+    else if (0 == strcmp("jsonl", name)) {
+        *format = TSV_FORMAT_JSONL;
+    }
+    else if (0 == strcmp("pgcopy", name)) {
+        *format = TSV_FORMAT_PGTEXT;
+    }
+    else if (0 == strcmp("pgbinary", name)) {
+        *format = TSV_FORMAT_PGBINARY;
+    }
+    else {
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+/**
+ * Get the file name extension for an output format.
+ *
+ * Args:
+ *  format  - output format
+ *
+ * Returns:
+ *  The extension, including its dot.
+ */
+const char* tsv_format_extension(tsv_format format)
+{
+    switch (format) {
+    case TSV_FORMAT_JSONL:
+        return ".jsonl";
+    case TSV_FORMAT_PGTEXT:
+        return ".pgcopy";
+    case TSV_FORMAT_PGBINARY:
+        return ".pgbinary";
+    default:
+        return ".csv";
+    }
+}
+
+/**
+ * Find the length of the UTF-8 sequence a non-ASCII byte starts.
+ *
+ * Args:
+ *  p   - the byte
+ *  end - end of the text it's in
+ *
+ * Returns:
+ *  2 to 4, or 0 if it isn't valid UTF-8: a stray continuation byte, a
+ *  sequence cut short, an overlong form, a surrogate, or past U+10FFFF.
+ */
+static size_t utf8_sequence(const unsigned char* p, const unsigned char* end)
+{
+    size_t   len;
+    uint32_t c;
+    uint32_t min;
+
+    if (p[0] >= 0xc2 && p[0] <= 0xdf) {
+        len = 2, c = p[0] & 0x1f, min = 0x80;
+    }
+    else if (0xe0 == (p[0] & 0xf0)) {
+        len = 3, c = p[0] & 0x0f, min = 0x800;
+    }
+    else if (p[0] >= 0xf0 && p[0] <= 0xf4) {
+        len = 4, c = p[0] & 0x07, min = 0x10000;
+    }
+    else {
+        return 0;
+    }
+
+    if ((size_t)(end - p) < len) {
+        return 0;
+    }
+
+    for (size_t i = 1; i < len; i++) {
+        if (0x80 != (p[i] & 0xc0)) {
+            return 0;
+        }
+        c = (c << 6) | (p[i] & 0x3f);
+    }
+
+    if (c < min || c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff)) {
+        return 0;
+    }
+
+    return len;
+}
+
+/**
+ * Append a JSON string, with quotes.
+ *
+ * JSON text has to be UTF-8, so each byte which isn't part of a valid UTF-8
+ * sequence, as in Latin-1 text, is replaced with U+FFFD.
+ */
+static int append_json_string(const char* str, size_t len, growbuf* out)
+{
+    static const char    replacement[] = "\xef\xbf\xbd";   // U+FFFD
+    const unsigned char* p   = (const unsigned char*)str;
+    const unsigned char* end = p + len;
+    int                  result;
+
+    result = growbuf_append_byte(out, '"');
+
+    while (0 == result && p < end) {
+        const unsigned char* run = p;
+        while (p < end) {
+            if (*p < 0x80) {
+                if (json_special[*p]) {
+                    break;
+                }
+                p++;
+            }
+            else {
+                size_t n = utf8_sequence(p, end);
+                if (0 == n) {
+                    break;
+                }
+                p += n;
+            }
+        }
+
+        if (p > run) {
+            result = growbuf_append(out, run, p - run);
+        }
+
+        if (0 == result && p < end && *p >= 0x80) {
+            result = growbuf_append(out, replacement, sizeof(replacement) - 1);
+            p++;
+        }
+        else if (0 == result && p < end) {
+            char escape[8];
+            int  escape_len;
+
+            switch (*p) {
+            case '"':  escape_len = sprintf(escape, "\\\""); break;
+            case '\\': escape_len = sprintf(escape, "\\\\"); break;
+            case '\t': escape_len = sprintf(escape, "\\t");  break;
+            case '\n': escape_len = sprintf(escape, "\\n");  break;
+            case '\r': escape_len = sprintf(escape, "\\r");  break;
+            default:   escape_len = sprintf(escape, "\\u%04x", *p); break;
+            }
+
+            result = growbuf_append(out, escape, escape_len);
+            p++;
+        }
+    }
+
+    if (0 == result) {
+        result = growbuf_append_byte(out, '"');
+    }
+
+    return result;
+}
+
+/**
+ * Parse a column number or range of them, like "3" or "3-5".
+ *
+ * Returns:
+ *  true if it was one.
+ */
+static bool parse_column_range(const char* item, size_t len, size_t* first, size_t* last)
+{
+    size_t* n = first;
+    bool    digits = false;
+
+    *first = 0;
+    *last  = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        if (item[i] >= '0' && item[i] <= '9') {
+            *n = *n * 10 + (item[i] - '0');
+            digits = true;
+        }
+        else if ('-' == item[i] && n == first && digits) {
+            n = last;
+            digits = false;
+        }
+        else {
+            return false;
+        }
+    }
+
+    if (n == first) {
+        *last = *first;
+    }
+
+    return digits;
+}
+
+/**
+ * Parse a list of columns to write.
+ *
+ * Args:
+ *  spec        - comma-separated 1-based field numbers, ranges of them like
+ *                "3-5", or names from the header line, in the order they're
+ *                to be written
+ *  header      - the table's header row, split into fields
+ *  num_fields  - number of fields
+ *  columns     - growbuf to append the 0-based field numbers to (as size_t)
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success; -EINVAL if any of them isn't a
+ *  field of the table.
+ */
+int tsv_parse_columns(const char* spec, const tsv_field* header, size_t num_fields, growbuf* columns)
+{
+    const char* item = spec;
+
+    while (true) {
+        const char* end = strchr(item, ',');
+        size_t      len = (NULL == end) ? strlen(item) : (size_t)(end - item);
+        size_t      first;
+        size_t      last;
+
+        if (!parse_column_range(item, len, &first, &last)) {
+            first = 0;
+            for (size_t i = 0; i < num_fields && 0 == first; i++) {
+                if (len > 0 && header[i].len == len && 0 == memcmp(header[i].data, item, len)) {
+                    first = i + 1;
+                }
+            }
+            last = first;
+        }
+
+        if (0 == first || first > last || last > num_fields) {
+            return -EINVAL;
+        }
+
+        for (size_t i = first - 1; i < last; i++) {
+            if (0 != growbuf_append(columns, &i, sizeof(i))) {
+                return -ENOMEM;
+            }
+        }
+
+        if (NULL == end) {
+            break;
+        }
+        item = end + 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Build the name of a JSON Lines key: the header line's field, or
+ * "column<N>" if that's empty, with "_<n>" after it for its nth repeat.
+ *
+ * Args:
+ *  header  - the field's header
+ *  field   - the field's number (0-based)
+ *  n       - 1 for the name itself, 2 and up for repeats of it
+ *  name    - growbuf to put the name in, replacing whatever was there
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+static int key_name(const tsv_field* header, size_t field, size_t n, growbuf* name)
+{
+    char number[48];
+    int  result;
+
+    name->size = 0;
+
+    if (0 == header->len) {
+        result = growbuf_append(name, number, sprintf(number, "column%zu", field + 1));
+    }
+    else {
+        result = growbuf_append(name, header->data, header->len);
+    }
+
+    if (0 == result && n > 1) {
+        result = growbuf_append(name, number, sprintf(number, "_%zu", n));
+    }
+
+    return result;
+}
+
+/**
+ * Find out whether the key being added to a writer is the same as one of
+ * the ones before it. Keys are compared as they're written, escapes and all.
+ *
+ * Args:
+ *  writer      - writer being set up
+ *  num_keys    - number of keys already added
+ *  offset      - where the new key starts in writer->keys; it runs to the end
+ *
+ * Returns:
+ *  true if it's a repeat.
+ */
+static bool key_exists(const tsv_writer* writer, size_t num_keys, size_t offset)
+{
+    const size_t* offsets = (const size_t*)writer->key_offsets->buf;
+    const char*   keys    = (const char*)writer->keys->buf;
+    size_t        len     = writer->keys->size - offset;
+
+    for (size_t k = 0; k < num_keys; k++) {
+        size_t end = (k + 1 < num_keys) ? offsets[k + 1] : offset;
+
+        if (end - offsets[k] == len && 0 == memcmp(keys + offsets[k], keys + offset, len)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Create a writer.
+ *
+ * Args:
+ *  format      - output format
+ *  header      - the table's header row, split into fields. JSON Lines uses
+ *                these as the keys, naming any empty ones "column<N>", and
+ *                adding "_2", "_3", ... to repeats.
+ *  num_fields  - number of fields in the table
+ *  columns     - which fields to write (0-based), in order, or NULL for all
+ *                of them
+ *  num_columns - number of columns
+ *
+ * Returns:
+ *  The new writer, or NULL on failure.
+ */
+tsv_writer* tsv_writer_create(tsv_format format, const tsv_field* header, size_t num_fields, const size_t* columns, size_t num_columns)
+{
+    growbuf*    name   = NULL;
+    tsv_writer* writer = (tsv_writer*)calloc(1, sizeof(tsv_writer));
+    if (NULL == writer) {
+        return NULL;
+    }
+
+    writer->format      = format;
+    writer->num_fields  = (NULL != columns) ? num_columns : num_fields;
+    writer->skip_header = (TSV_FORMAT_CSV != format);
+
+    if (NULL != columns) {
+        writer->columns = (size_t*)malloc(num_columns * sizeof(size_t));
+        if (NULL == writer->columns) {
+            goto fail;
+        }
+        memcpy(writer->columns, columns, num_columns * sizeof(size_t));
+    }
+
+    if (TSV_FORMAT_JSONL == format) {
+        writer->keys        = growbuf_create(writer->num_fields * 16);
+        writer->key_offsets = growbuf_create((writer->num_fields + 1) * sizeof(size_t));
+        name                = growbuf_create(64);
+        if (NULL == writer->keys || NULL == writer->key_offsets || NULL == name) {
+            goto fail;
+        }
+
+        for (size_t i = 0; i < writer->num_fields; i++) {
+            size_t field  = (NULL != columns) ? columns[i] : i;
+            size_t offset = writer->keys->size;
+
+            //
+            // Keys have to be unique, or most parsers keep only one of the
+            // columns; repeats get _2, _3, and so on.
+            //
+            for (size_t n = 1; ; n++) {
+                writer->keys->size = offset;
+
+                if (0 != key_name(&header[field], field, n, name)
+                        || 0 != append_json_string(name->buf, name->size, writer->keys)
+                        || 0 != growbuf_append_byte(writer->keys, ':'))
+                {
+                    goto fail;
+                }
+
+                if (!key_exists(writer, i, offset)) {
+                    break;
+                }
+            }
+
+            if (0 != growbuf_append(writer->key_offsets, &offset, sizeof(offset))) {
+                goto fail;
+            }
+        }
+
+        size_t end = writer->keys->size;
+        if (0 != growbuf_append(writer->key_offsets, &end, sizeof(end))) {
+            goto fail;
+        }
+    }
+
+    growbuf_free(name);
+    return writer;
+
+fail:
+    growbuf_free(name);
+    tsv_writer_free(writer);
+    return NULL;
+}
+
+/**
+ * Free a writer.
+ *
+ * Args:
+ *  writer  - writer to free; may be NULL
+ */
+void tsv_writer_free(tsv_writer* writer)
+{
+    if (NULL == writer) {
+        return;
+    }
+
+    growbuf_free(writer->keys);
+    growbuf_free(writer->key_offsets);
+    free(writer->columns);
+    free(writer);
+}
+
+/**
+ * Write whatever goes at the start of the output.
+ *
+ * Args:
+ *  writer  - writer; NULL for CSV
+ *  out     - growbuf to append to
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+int tsv_writer_begin(const tsv_writer* writer, growbuf* out)
+{
+    if (NULL != writer && TSV_FORMAT_PGBINARY == writer->format) {
+        return growbuf_append(out, pgbinary_header, sizeof(pgbinary_header) - 1);
+    }
+
+    return 0;
+}
+
+/**
+ * Write whatever goes at the end of the output.
+ *
+ * Args:
+ *  writer  - writer; NULL for CSV
+ *  out     - growbuf to append to
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+int tsv_writer_end(const tsv_writer* writer, growbuf* out)
+{
+    if (NULL != writer && TSV_FORMAT_PGBINARY == writer->format) {
+        static const char trailer[2] = { '\xff', '\xff' };   // field count of -1
+        return growbuf_append(out, trailer, sizeof(trailer));
+    }
+
+    return 0;
+}
+
+/**
+ * Write one field of a JSON Lines row.
+ *
+ * Args:
+ *  as for tsv_writer_field()
+ */
+int jsonl_field(const tsv_writer* writer, size_t index, size_t num_fields, const char* field, size_t len, growbuf* out)
+{
+    const size_t* offsets = (const size_t*)writer->key_offsets->buf;
+    int           result;
+
+    result = growbuf_append_byte(out, (0 == index) ? '{' : ',');
+
+    if (0 == result && index < writer->num_fields) {
+        result = growbuf_append(out, (const char*)writer->keys->buf + offsets[index], offsets[index + 1] - offsets[index]);
+    }
+
+    if (0 == result) {
+        result = append_json_string(field, len, out);
+    }
+
+    if (0 == result && index == num_fields - 1) {
+        result = growbuf_append(out, "}\n", 2);
+    }
+
+    return result;
+}
+
+/**
+ * Write one field of a COPY text format row. Every field is a string;
+ * there are no NULLs.
+ *
+ * Args:
+ *  as for tsv_writer_field()
+ */
+int pgtext_field(size_t index, size_t num_fields, const char* field, size_t len, growbuf* out)
+{
+    const unsigned char* p   = (const unsigned char*)field;
+    const unsigned char* end = p + len;
+    int                  result = 0;
+
+    while (0 == result && p < end) {
+        const unsigned char* run = p;
+        while (p < end && !pgtext_special[*p]) {
+            p++;
+        }
+
+        if (p > run) {
+            result = growbuf_append(out, run, p - run);
+        }
+
+        if (0 == result && p < end) {
+            char escape[2] = { '\\', 0 };
+
+            switch (*p) {
+            case '\t': escape[1] = 't';  break;
+            case '\n': escape[1] = 'n';  break;
+            case '\r': escape[1] = 'r';  break;
+            default:   escape[1] = '\\'; break;
+            }
+
+            result = growbuf_append(out, escape, 2);
+            p++;
+        }
+    }
+
+    if (0 == result) {
+        result = growbuf_append_byte(out, (index == num_fields - 1) ? '\n' : '\t');
+    }
+
+    return result;
+}
+
+/**
+ * Append a big-endian integer of the given size.
+ */
+static int append_be(uint32_t value, size_t bytes, growbuf* out)
+{
+    unsigned char buf[4];
+
+    for (size_t i = 0; i < bytes; i++) {
+        buf[i] = (unsigned char)(value >> (8 * (bytes - 1 - i)));
+    }
+
+    return growbuf_append(out, buf, bytes);
+}
+
+/**
+ * Write one field of a COPY binary format row, as text.
+ *
+ * Args:
+ *  as for tsv_writer_field()
+ */
+int pgbinary_field(size_t index, size_t num_fields, const char* field, size_t len, growbuf* out)
+{
+    int result = 0;
+
+    if (0 == index) {
+        result = append_be((uint32_t)num_fields, 2, out);
+    }
+
+    if (0 == result) {
+        result = append_be((uint32_t)len, 4, out);
+    }
+
+    if (0 == result && len > 0) {
+        result = growbuf_append(out, field, len);
+    }
+
+    return result;
+}
@@ -0,0 +1,76 @@
+/**
+ * Output Writers
+ *
+ * Encoders for each output format. Rows are written a field at a time into
+ * a growbuf, through tsv_writer_field(), which dispatches to the format's
+ * encoder inline.
+ */
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "growbuf.h"
+#include "csvformat.h"
+#include "libtsv.h"   // tsv_format, tsv_field
+
+typedef struct _tsv_writer
+{
+    tsv_format format;
+    bool       skip_header;     // the header row names the fields instead of being written
+    size_t     num_fields;      // number of fields in each row written
+    size_t*    columns;         // which of the table's fields those are, or NULL for all of them
+    growbuf*   keys;            // TSV_FORMAT_JSONL: "key": for each field, back to back
+    growbuf*   key_offsets;     // TSV_FORMAT_JSONL: size_t start of each key in keys, then the end
+} tsv_writer;
+
+int         tsv_parse_format(const char* name, tsv_format* format);
+const char* tsv_format_extension(tsv_format format);
+int         tsv_parse_columns(const char* spec, const tsv_field* header, size_t num_fields, growbuf* columns);
+tsv_writer* tsv_writer_create(tsv_format format, const tsv_field* header, size_t num_fields, const size_t* columns, size_t num_columns);
+void        tsv_writer_free(tsv_writer* writer);
+int         tsv_writer_begin(const tsv_writer* writer, growbuf* out);
+int         tsv_writer_end(const tsv_writer* writer, growbuf* out);
+
+int jsonl_field(const tsv_writer* writer, size_t index, size_t num_fields, const char* field, size_t len, growbuf* out);
+int pgtext_field(size_t index, size_t num_fields, const char* field, size_t len, growbuf* out);
+int pgbinary_field(size_t index, size_t num_fields, const char* field, size_t len, growbuf* out);
+
+/**
+ * Write one field of a row, along with whatever goes before the row (if it's
+ * the first field) or after it (if it's the last).
+ *
+ * Args:
+ *  writer      - writer for the output format; NULL for CSV
+ *  index       - which field of the row this is
+ *  num_fields  - number of fields in the row
+ *  field       - the field's text
+ *  len         - length of the field
+ *  out         - growbuf to append to
+ *
+ * Returns:
+ *  -1 * an errno.h error number. 0 on success.
+ */
+static inline int tsv_writer_field(const tsv_writer* writer, size_t index, size_t num_fields, const char* field, size_t len, growbuf* out)
+{
+    switch ((NULL == writer) ? TSV_FORMAT_CSV : writer->format) {
+    case TSV_FORMAT_JSONL:
+        return jsonl_field(writer, index, num_fields, field, len, out);
+    case TSV_FORMAT_PGTEXT:
+        return pgtext_field(index, num_fields, field, len, out);
+    case TSV_FORMAT_PGBINARY:
+        return pgbinary_field(index, num_fields, field, len, out);
+    default:
+        break;
+    }
+
+    int result = append_csv_field(field, len, out);
+    if (0 == result) {
+        result = growbuf_append_byte(out, (index == num_fields - 1) ? '\n' : ',');
+    }
+    return result;
+}
+
+#endif //WRITER_H